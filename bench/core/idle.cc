@@ -0,0 +1,355 @@
+// bench/core/idle.cc -- memory held by idle keep-alive connections
+#include <core/byte_buffer.hh>
+#include <core/coro.hh>
+#include <core/ev_loop.hh>
+#include <core/exception.hh>
+#include <core/input_buffer.hh>
+#include <core/mem.hh>
+#include <core/slab.hh>
+#include <http/parser.hh>
+#include <http/types.hh>
+#include <http/writer.hh>
+
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <future>
+#include <new>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <fmt/format.h>
+
+using namespace izumo;
+
+// allocations made on any thread while counting, through malloc or operator new
+static std::atomic<bool> counting {false};
+static std::atomic<std::size_t> allocations {0};
+
+static void
+count() noexcept
+{
+    if (counting.load(std::memory_order_relaxed)) allocations.fetch_add(1, std::memory_order_relaxed);
+}
+
+extern "C" {
+    void* __libc_malloc(std::size_t);
+    void* __libc_calloc(std::size_t, std::size_t);
+    void* __libc_realloc(void*, std::size_t);
+
+    void* malloc(std::size_t size) { count(); return __libc_malloc(size); }
+    void* calloc(std::size_t n, std::size_t size) { count(); return __libc_calloc(n, size); }
+    void* realloc(void* ptr, std::size_t size) { count(); return __libc_realloc(ptr, size); }
+}
+
+static void*
+counted_new(std::size_t size)
+{
+    count();
+    if (auto ret = __libc_malloc(size ? size : 1)) return ret;
+    throw std::bad_alloc();
+}
+
+void* operator new(std::size_t size) { return counted_new(size); }
+void* operator new[](std::size_t size) { return counted_new(size); }
+void operator delete(void* ptr) noexcept { std::free(ptr); }
+void operator delete[](void* ptr) noexcept { std::free(ptr); }
+void operator delete(void* ptr, std::size_t) noexcept { std::free(ptr); }
+void operator delete[](void* ptr, std::size_t) noexcept { std::free(ptr); }
+
+constexpr std::string_view REQUEST =
+    "GET /index.html HTTP/1.1\r\n"
+    "Host: www.example.com\r\n"
+    "User-Agent: Mozilla/5.0 (X11; Linux x86_64; rv:125.0) Gecko/20100101 Firefox/125.0\r\n"
+    "Accept: text/html,application/xhtml+xml,application/xml;q=0.9,*/*;q=0.8\r\n"
+    "Accept-Encoding: gzip, deflate, br\r\n"
+    "Connection: keep-alive\r\n"
+    "\r\n";
+constexpr std::string_view BODY = "ok";
+
+// a connection served the way a client of the server is: between
+// requests it holds no input or output block, nor a chunk of its pool
+class connection {
+private:
+    core::async_fd m_sock;
+    core::input_buffer m_in;
+    core::byte_buffer m_out;
+    core::mem_pool m_pool;
+    http::request m_req;
+    http::request_parser m_parser;
+
+    // answer every complete request received so far
+    std::size_t
+    process()
+    {
+	std::size_t size = 0;
+	while (!m_in.empty()) {
+	    if (m_parser.parse(m_req, m_in.front()) != http::parse_result::done) break;
+
+	    http::response res(m_pool);
+	    res.status_code = 200;
+	    http::response_writer w(m_out, size);
+	    w.head(res);
+	    w.write(http::static_header::server);
+	    w.write(http::static_header::content_type_text);
+	    w.header("Content-Length", BODY.size());
+	    w.end_head();
+	    w.write(BODY);
+	    size = w.size();
+
+	    m_in.consume(m_parser.consumed());
+	    m_parser.reset();
+	    m_req.clear();
+	    m_pool.reset();
+	}
+	return size;
+    }
+
+    core::task<>
+    run()
+    {
+	m_sock.receive_into(m_in);
+	auto drained = true;
+
+	while (true) {
+	    if (drained && m_in.empty()) {
+		m_in.shrink();
+		m_pool = core::mem_pool();
+		if (co_await core::async_readable(m_sock) < 0) break;
+	    }
+
+	    if (co_await core::async_recv(m_sock, m_in, drained) <= 0) break;
+
+	    auto size = process();
+	    std::size_t sent = 0;
+	    while (sent < size) {
+		auto ret = co_await core::async_send(m_sock, m_out.ptr() + sent, size - sent);
+		if (ret < 0) co_return;
+		sent += ret;
+	    }
+	    m_out = core::byte_buffer();
+	}
+    }
+
+public:
+    explicit connection(int fd): m_sock(fd), m_req(m_pool) {}
+
+    void start() { core::spawn(run()); }
+};
+
+// accepts connections on the loop, which serves them until the bench ends
+class acceptor: public core::ev_watcher {
+private:
+    std::vector<int> m_queue;
+
+    void
+    serve(int fd)
+    {
+	(new connection(fd))->start();
+    }
+
+public:
+    explicit acceptor(int fd): ev_watcher(fd) {}
+
+    void
+    on_accepted(int fd) override
+    {
+	if (fd < 0) throw core::osexception(-fd);
+	serve(fd);
+    }
+
+    bool
+    on_event(bool r, bool) override
+    {
+	if (!r) return false;
+
+	while (true) {
+	    auto ret = accept4(m_fd, nullptr, nullptr, SOCK_NONBLOCK);
+	    if (ret < 0) break;
+	    m_queue.push_back(ret);
+	}
+	return !m_queue.empty();
+    }
+
+    void
+    on_deferred() override
+    {
+	for (auto fd: m_queue) serve(fd);
+	m_queue.clear();
+    }
+};
+
+// resident set size of the process in bytes
+static std::size_t
+rss()
+{
+    std::size_t pages = 0, resident = 0;
+    if (auto f = std::fopen("/proc/self/statm", "r")) {
+	if (std::fscanf(f, "%zu %zu", &pages, &resident) != 2) resident = 0;
+	std::fclose(f);
+    }
+    return resident * sysconf(_SC_PAGESIZE);
+}
+
+static bool
+send_all(int fd, std::string_view bytes)
+{
+    return send(fd, bytes.data(), bytes.size(), 0) == ssize_t(bytes.size());
+}
+
+// read a whole response; allocates nothing
+static bool
+read_response(int fd)
+{
+    char buf[512];
+    std::size_t n = 0;
+    while (n < 4 + BODY.size() || std::memcmp(buf + n - BODY.size() - 4, "\r\n\r\n", 4)) {
+	auto ret = recv(fd, buf + n, sizeof(buf) - n, 0);
+	if (ret <= 0) return false;
+	n += ret;
+    }
+    return true;
+}
+
+static bool
+round_trip(int fd)
+{
+    return send_all(fd, REQUEST) && read_response(fd);
+}
+
+// connect from 127.0.0.x, 20000 connections per address, as a single
+// address runs out of ephemeral ports well before 50k
+static int
+connect_to(const sockaddr_in& server, std::size_t i)
+{
+    constexpr std::size_t PER_ADDRESS = 20000;
+
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd < 0) return -1;
+
+    sockaddr_in local = {};
+    local.sin_family = AF_INET;
+    local.sin_addr.s_addr = htonl(INADDR_LOOPBACK + 1 + i / PER_ADDRESS);
+    if (bind(fd, reinterpret_cast<sockaddr*>(&local), sizeof(local)) < 0 ||
+	connect(fd, reinterpret_cast<const sockaddr*>(&server), sizeof(server)) < 0) {
+	close(fd);
+	return -1;
+    }
+    return fd;
+}
+
+static void
+print_memory(const char* when, std::size_t bytes, std::size_t conns, const core::slab_stats& stats)
+{
+    fmt::print("{:<14}{:>10.1f} MiB {:>8.2f} KiB/conn {:>10.1f} MiB {:>10.1f} MiB\n", when,
+	       bytes / 1048576.0, bytes / 1024.0 / conns,
+	       stats.free_bytes / 1048576.0, stats.trimmed_bytes / 1048576.0);
+}
+
+int
+main(int argc, char** argv)
+{
+    std::size_t conns = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 10000;
+    if (argc > 2 && !core::ev_loop::set_default_impl(argv[2])) {
+	fmt::print(stderr, "no ev_loop implementation named {}\n", argv[2]);
+	return 1;
+    }
+
+    // both ends of every connection are in this process
+    rlimit lim;
+    getrlimit(RLIMIT_NOFILE, &lim);
+    lim.rlim_cur = lim.rlim_max;
+    setrlimit(RLIMIT_NOFILE, &lim);
+    if (conns * 2 + 64 > lim.rlim_cur) {
+	conns = (lim.rlim_cur - 64) / 2;
+	fmt::print("open files are limited to {}; {} connections\n", lim.rlim_cur, conns);
+    }
+
+    int listen_fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+    sockaddr_in server = {};
+    server.sin_family = AF_INET;
+    server.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socklen_t len = sizeof(server);
+    if (bind(listen_fd, reinterpret_cast<sockaddr*>(&server), len) < 0 ||
+	listen(listen_fd, SOMAXCONN) < 0 ||
+	getsockname(listen_fd, reinterpret_cast<sockaddr*>(&server), &len) < 0) {
+	fmt::print(stderr, "can't listen: {}\n", std::strerror(errno));
+	return 1;
+    }
+
+    std::promise<core::ev_loop*> started;
+    std::thread t([&started, listen_fd] {
+	auto& loop = core::ev_loop::instance();
+	acceptor ac(listen_fd);
+	loop.add_watcher(ac, 0);
+	if (!loop.accept_multishot(ac)) loop.modify_watcher(ac, core::EV_READ);
+	started.set_value(&loop);
+	loop.run_forever();
+	loop.remove_watcher(ac);
+    });
+    auto& loop = *started.get_future().get();
+
+    // slabs are per thread, so they are trimmed and looked at on the loop
+    auto on_loop = [&loop](auto fn) {
+	std::promise<core::slab_stats> done;
+	loop.post([&done, &fn] { fn(); done.set_value(core::slab_allocator::stats()); });
+	return done.get_future().get();
+    };
+
+    auto base = rss();
+
+    std::vector<int> fds;
+    fds.reserve(conns);
+    for (std::size_t i = 0; i < conns; ++i) {
+	auto fd = connect_to(server, i);
+	if (fd < 0) {
+	    fmt::print(stderr, "connection {} failed: {}\n", i, std::strerror(errno));
+	    return 1;
+	}
+	fds.push_back(fd);
+    }
+
+    // a burst of slow requests: every connection holds an input block
+    // at once until its request is complete, then goes idle again and
+    // frees it, as after a spike of load
+    auto half = REQUEST.size() / 2;
+    for (auto fd: fds) {
+	if (!send_all(fd, REQUEST.substr(0, half))) return 1;
+    }
+    on_loop([] {});
+    on_loop([] {});
+    for (auto fd: fds) {
+	if (!send_all(fd, REQUEST.substr(half))) return 1;
+    }
+    for (auto fd: fds) {
+	if (!read_response(fd)) return 1;
+    }
+
+    fmt::print("{} idle keep-alive connections, {:.1f} MiB resident before\n\n",
+	       conns, base / 1048576.0);
+    fmt::print("{:<14}{:>14}{:>18}{:>15}{:>15}\n", "", "rss", "", "slab free", "trimmed");
+    print_memory("before trim", rss() - base, conns, on_loop([] {}));
+    auto stats = on_loop([] { core::slab_allocator::trim(); });
+    print_memory("after trim", rss() - base, conns, stats);
+
+    // once warm, a request on an idle connection should allocate nothing
+    // but slab blocks, trimmed or not
+    counting = true;
+    for (auto fd: fds) {
+	if (!round_trip(fd)) return 1;
+    }
+    counting = false;
+    fmt::print("\n{} requests once warm: {} allocations\n", conns, allocations.load());
+
+    for (auto fd: fds) close(fd);
+    loop.post([] { core::ev_loop::instance().stop(); });
+    t.join();
+}
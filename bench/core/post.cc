@@ -0,0 +1,113 @@
+// bench/core/post.cc -- cost of posting tasks to a loop from another thread
+#include <core/ev_loop.hh>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <future>
+#include <thread>
+#include <vector>
+
+#include <fmt/format.h>
+
+using namespace izumo::core;
+using clock_type = std::chrono::steady_clock;
+
+// a task counting down the tasks of a burst left to run
+struct count_node: post_node {
+    std::atomic<std::size_t>* left = nullptr;
+
+    void run() override { left->fetch_sub(1, std::memory_order_release); }
+};
+
+// post `n` tasks at once, and wait for the loop to run them all
+// @return: tasks run per second
+template <bool nodes_t>
+static double
+burst(ev_loop& loop, std::size_t n, std::vector<count_node>& nodes)
+{
+    std::atomic<std::size_t> left {n};
+    for (auto& node: nodes) node.left = &left;
+
+    auto start = clock_type::now();
+    for (std::size_t i = 0; i < n; ++i) {
+	if constexpr (nodes_t) {
+	    loop.post(nodes[i]);
+	} else {
+	    loop.post([&left] { left.fetch_sub(1, std::memory_order_release); });
+	}
+    }
+    while (left.load(std::memory_order_acquire)) std::this_thread::yield();
+
+    return n / std::chrono::duration<double>(clock_type::now() - start).count();
+}
+
+// post one task at a time, each after the previous one has run
+// @return: round trips in nanoseconds, sorted
+template <bool nodes_t>
+static std::vector<double>
+round_trips(ev_loop& loop, std::size_t n)
+{
+    std::vector<double> ret;
+    ret.reserve(n);
+
+    std::atomic<std::size_t> left {0};
+    count_node node;
+    node.left = &left;
+
+    for (std::size_t i = 0; i < n; ++i) {
+	left.store(1, std::memory_order_relaxed);
+	auto start = clock_type::now();
+	if constexpr (nodes_t) {
+	    loop.post(node);
+	} else {
+	    loop.post([&left] { left.fetch_sub(1, std::memory_order_release); });
+	}
+	while (left.load(std::memory_order_acquire)) {}
+	ret.push_back(std::chrono::duration<double, std::nano>(clock_type::now() - start).count());
+    }
+
+    std::sort(ret.begin(), ret.end());
+    return ret;
+}
+
+template <bool nodes_t>
+static void
+run(ev_loop& loop, const char* name)
+{
+    constexpr std::size_t BURST = 100000, ROUNDS = 20, TRIPS = 20000;
+
+    std::vector<count_node> nodes(BURST);
+    burst<nodes_t>(loop, BURST, nodes); // warm up
+    double best = 0;
+    for (std::size_t i = 0; i < ROUNDS; ++i) best = std::max(best, burst<nodes_t>(loop, BURST, nodes));
+
+    auto trips = round_trips<nodes_t>(loop, TRIPS);
+    fmt::print("{:<16}{:>14.2f}{:>12.0f}{:>12.0f}{:>12.0f}\n", name, best / 1e6,
+	       trips[trips.size() / 2], trips[trips.size() * 99 / 100], trips.back());
+}
+
+int
+main(int argc, char** argv)
+{
+    if (argc > 1 && !ev_loop::set_default_impl(argv[1])) {
+	fmt::print(stderr, "no ev_loop implementation named {}\n", argv[1]);
+	return 1;
+    }
+
+    std::promise<ev_loop*> started;
+    std::thread t([&started] {
+	auto& loop = ev_loop::instance();
+	started.set_value(&loop);
+	loop.run_forever();
+    });
+    auto& loop = *started.get_future().get();
+
+    fmt::print("burst of 100000 tasks, then one at a time\n\n");
+    fmt::print("{:<16}{:>14}{:>12}{:>12}{:>12}\n", "", "Mtasks/s", "p50 ns", "p99 ns", "max ns");
+    run<false>(loop, "std::function");
+    run<true>(loop, "post_node");
+
+    loop.post([] { ev_loop::instance().stop(); });
+    t.join();
+}
@@ -9,17 +9,28 @@ namespace izumo::core {
 
     class byte_buffer_view;
     
-    /** byte_buffer: contiguous container for raw bytes */
+    /** byte_buffer: contiguous container for raw bytes
+     *   buffers up to 64K are blocks of slab_allocator, larger ones come
+     *   from malloc. resizing within the block keeps the memory in place.
+     */
     class byte_buffer {
     private:
 	byte_t* m_ptr = nullptr;
 	std::size_t m_size = 0;
+	std::size_t m_capacity = 0;
 
     public:
 	byte_buffer() = default;
 	byte_buffer(std::size_t initial_size);
 	byte_buffer(const byte_buffer&);
-	byte_buffer(byte_buffer&&) = default;
+	byte_buffer(byte_buffer&& rhs) noexcept:
+	    m_ptr(rhs.m_ptr), m_size(rhs.m_size), m_capacity(rhs.m_capacity)
+	{
+	    rhs.m_ptr = nullptr;
+	    rhs.m_size = rhs.m_capacity = 0;
+	}
+
+	byte_buffer& operator=(byte_buffer&& rhs) noexcept;
 
 	~byte_buffer();
 
@@ -7,14 +7,28 @@
 namespace izumo::core {
     using timestamp_ms_t = uint64_t; // representing a timestamp in milliseconds
     using timedelta_ms_t = int64_t;  // representintg the difference of two timestamps in milliseconds
+    using timestamp_ns_t = uint64_t; // representing a timestamp in nanoseconds
     
+    /** clock: monotonic clock
+     *   timestamps count from an unspecified point, usually boot, and
+     *   never go backwards. they are not related to wall time.
+     *   code running on an ev_loop should prefer `ev_loop::now`, which
+     *   is read once per iteration.
+     */
     class clock {
     public:
 	/** now: return current timestamp
 	 *   @return:
 	 *      current timestamp in milliseconds
 	 */
-	static timestamp_ms_t now(); 
+	static timestamp_ms_t now() noexcept;
+
+	/** now_ns: return current timestamp in full resolution
+	 *   for latency measurement
+	 *   @return:
+	 *      current timestamp in nanoseconds
+	 */
+	static timestamp_ns_t now_ns() noexcept;
     };
 }
 
@@ -0,0 +1,555 @@
+// core/coro.hh -- coroutines over ev_loop
+#ifndef IZUMO_CORE_CORO_HH_
+#define IZUMO_CORE_CORO_HH_
+
+#include <core/ev_loop.hh>
+#include <core/ev_watcher.hh>
+#include <core/mem.hh>
+
+#include <coroutine>
+#include <cstddef>
+#include <exception>
+#include <optional>
+#include <utility>
+
+#include <sys/socket.h>
+#include <sys/types.h>
+
+namespace izumo::core {
+    template <typename _t> class task;
+
+    /** frame_slot: room for the frame of one coroutine at a time
+     *   a coroutine taking a frame_slot& has its frame put there when it
+     *   fits, and on the heap otherwise, so a coroutine lasting as long
+     *   as the object embedding the slot costs no allocation. the slot
+     *   must outlive the frame.
+     */
+    template <std::size_t _size>
+    class frame_slot {
+    private:
+	alignas(std::max_align_t) std::byte m_storage[_size];
+
+    public:
+	frame_slot() noexcept = default;
+	frame_slot(const frame_slot&) = delete;
+
+	void* data() noexcept { return m_storage; }
+	constexpr static std::size_t size() noexcept { return _size; }
+    };
+
+    // parts of a task promise not depending on the result type
+    class _task_promise_base {
+    private:
+	// put in front of every frame; tells whether it's on the heap
+	struct alignas(std::max_align_t) frame_header {
+	    bool heap;
+	};
+
+	static mem_pool* m_pool_of(mem_pool& pool) noexcept { return &pool; }
+	template <typename _u> static mem_pool* m_pool_of(_u&) noexcept { return nullptr; }
+
+	template <std::size_t _size> static void*
+	m_slot_of(frame_slot<_size>& slot, std::size_t n) noexcept
+	{
+	    return n <= _size ? slot.data() : nullptr;
+	}
+
+	template <typename _u> static void* m_slot_of(_u&, std::size_t) noexcept { return nullptr; }
+
+	struct final_awaiter {
+	    bool await_ready() noexcept { return false; }
+
+	    template <typename _promise_t> std::coroutine_handle<>
+	    await_suspend(std::coroutine_handle<_promise_t> h) noexcept
+	    {
+		_task_promise_base& p = h.promise();
+		if (p.m_continuation) return p.m_continuation;
+		if (p.m_detached) h.destroy();
+		return std::noop_coroutine();
+	    }
+
+	    void await_resume() noexcept {}
+	};
+
+    protected:
+	std::coroutine_handle<> m_continuation; // awaiting coroutine
+	std::exception_ptr m_exception;
+	bool m_detached = false;
+
+	/** m_allocate: allocate a coroutine frame
+	 *   frames of coroutines taking a frame_slot& go there if they fit.
+	 *   those taking a mem_pool& are allocated from the first such pool,
+	 *   and never freed by themselves. the rest are on the heap.
+	 *   @parameters:
+	 *      size: size of the frame
+	 *      args: parameters of the coroutine
+	 */
+	template <typename... _args_t> static void*
+	m_allocate(std::size_t size, _args_t&... args)
+	{
+	    auto n = sizeof(frame_header) + size;
+
+	    void* mem = nullptr;
+	    ((mem = mem ? mem : m_slot_of(args, n)), ...);
+	    if (mem) return new (mem) frame_header { false } + 1;
+
+	    mem_pool* pool = nullptr;
+	    ((pool = pool ? pool : m_pool_of(args)), ...);
+	    if (pool) return new (pool->allocate(n, alignof(frame_header))) frame_header { false } + 1;
+
+	    return new (::operator new(n)) frame_header { true } + 1;
+	}
+
+	// free a frame from `m_allocate` if it's on the heap
+	static void
+	m_deallocate(void* ptr) noexcept
+	{
+	    auto header = static_cast<frame_header*>(ptr) - 1;
+	    if (header->heap) ::operator delete(header);
+	}
+
+    public:
+	std::suspend_always initial_suspend() noexcept { return {}; }
+	final_awaiter final_suspend() noexcept { return {}; }
+
+	void
+	unhandled_exception()
+	{
+	    // nobody waits for a detached task, so it propagates to the
+	    // loop like an exception from `on_event` does
+	    if (m_detached) throw;
+	    m_exception = std::current_exception();
+	}
+
+	void set_continuation(std::coroutine_handle<> h) noexcept { m_continuation = h; }
+	void detach() noexcept { m_detached = true; }
+    };
+
+    template <typename _t>
+    class _task_promise: public _task_promise_base {
+    private:
+	std::optional<_t> m_value;
+
+    public:
+	template <typename _u> void
+	return_value(_u&& value)
+	{
+	    m_value.emplace(std::forward<_u>(value));
+	}
+
+	_t
+	result()
+	{
+	    if (m_exception) std::rethrow_exception(m_exception);
+	    return std::move(*m_value);
+	}
+    };
+
+    template <>
+    class _task_promise<void>: public _task_promise_base {
+    public:
+	void return_void() noexcept {}
+
+	void
+	result()
+	{
+	    if (m_exception) std::rethrow_exception(m_exception);
+	}
+    };
+
+    /** _task_frame_promise: promise of a coroutine returning task<T>
+     *   chosen by the coroutine_traits below for each list of parameter
+     *   types, so that `operator new` taking the parameters needn't be
+     *   a template. GCC takes a template one paired with a usual
+     *   `operator delete` for a mismatch (-Wmismatched-new-delete).
+     */
+    template <typename _t, typename... _args_t>
+    class _task_frame_promise: public _task_promise<_t> {
+    public:
+	static void*
+	operator new(std::size_t size, _args_t&... args)
+	{
+	    return _task_promise_base::m_allocate(size, args...);
+	}
+
+	static void
+	operator delete(void* ptr, std::size_t) noexcept
+	{
+	    _task_promise_base::m_deallocate(ptr);
+	}
+
+	task<_t> get_return_object() noexcept;
+    };
+
+    /** task: a coroutine producing a T
+     *   a task starts when it's awaited, and the awaiting coroutine goes
+     *   on when it's done; exceptions are rethrown there. a task not
+     *   awaiting anything runs in the callbacks of the loop of current
+     *   thread. `spawn` starts a task nobody awaits.
+     *
+     *   destroying a suspended task destroys its frame, which cancels
+     *   the operation it's waiting for.
+     */
+    template <typename _t = void>
+    class task {
+    private:
+	// promises differ by parameters of the coroutine, so the handle
+	// doesn't tell its type
+	std::coroutine_handle<> m_handle;
+	_task_promise<_t>* m_promise = nullptr;
+
+	template <typename, typename...> friend class _task_frame_promise;
+	friend void spawn(task<void> t);
+
+	task(std::coroutine_handle<> h, _task_promise<_t>& promise) noexcept:
+	    m_handle(h), m_promise(&promise)
+	{}
+
+    public:
+	task(task&& rhs) noexcept:
+	    m_handle(std::exchange(rhs.m_handle, nullptr)),
+	    m_promise(std::exchange(rhs.m_promise, nullptr))
+	{}
+	task(const task&) = delete;
+
+	~task()
+	{
+	    if (m_handle) m_handle.destroy();
+	}
+
+	task&
+	operator=(task&& rhs) noexcept
+	{
+	    if (this == &rhs) return *this;
+
+	    if (m_handle) m_handle.destroy();
+	    m_handle = std::exchange(rhs.m_handle, nullptr);
+	    m_promise = std::exchange(rhs.m_promise, nullptr);
+	    return *this;
+	}
+
+	// start the task and wait for its result
+	auto
+	operator co_await() && noexcept
+	{
+	    struct awaiter {
+		std::coroutine_handle<> h;
+		_task_promise<_t>& promise;
+
+		bool await_ready() noexcept { return false; }
+
+		std::coroutine_handle<>
+		await_suspend(std::coroutine_handle<> caller) noexcept
+		{
+		    promise.set_continuation(caller);
+		    return h;
+		}
+
+		_t await_resume() { return promise.result(); }
+	    };
+
+	    return awaiter { m_handle, *m_promise };
+	}
+    };
+
+    template <typename _t, typename... _args_t> task<_t>
+    _task_frame_promise<_t, _args_t...>::get_return_object() noexcept
+    {
+	return task<_t>(std::coroutine_handle<_task_frame_promise>::from_promise(*this), *this);
+    }
+
+    /** spawn: run a task nobody awaits
+     *   it runs until it first suspends, and its frame is freed once it
+     *   is done. an exception escaping it propagates to whoever resumed
+     *   it last, usually the loop.
+     */
+    inline void
+    spawn(task<void> t)
+    {
+	auto h = std::exchange(t.m_handle, nullptr);
+	t.m_promise->detach();
+	h.resume();
+    }
+
+    class async_fd;
+    class input_buffer;
+
+    /** _io_wait: an operation of a coroutine on an async_fd
+     *   the operation is tried right away, and again on every edge while
+     *   the coroutine is suspended, until it no longer would block.
+     */
+    class _io_wait {
+    protected:
+	friend class async_fd;
+
+	async_fd& m_fd;
+	bool m_write;		// waits for writable edges
+	ssize_t m_ret = 0;
+	std::coroutine_handle<> m_handle;
+	timer_id m_timer = NULL_TIMER;
+
+	/** m_attempt: try the operation
+	 *   @return:
+	 *      false if it would block; otherwise the result is in m_ret
+	 */
+	virtual bool m_attempt() noexcept = 0;
+
+    public:
+	_io_wait(async_fd& fd, bool write) noexcept: m_fd(fd), m_write(write) {}
+	_io_wait(const _io_wait&) = delete;
+	~_io_wait();
+
+	bool await_ready() noexcept { return m_attempt(); }
+	void await_suspend(std::coroutine_handle<> h);
+	ssize_t await_resume() noexcept { return m_ret; }
+    };
+
+    /** async_fd: non-blocking file descriptor for coroutines
+     *   at most one coroutine may read and one may write at a time. the
+     *   kernel is only asked for edges somebody waits for.
+     */
+    class async_fd: public ev_watcher {
+    public:
+	// bytes received ahead of a reader before receiving through the loop pauses
+	constexpr static std::size_t RECEIVE_AHEAD = 64 * 1024;
+
+    private:
+	friend class _io_wait;
+	friend class _edge_wait;
+	friend class _recv_into_wait;
+
+	_io_wait* m_reader = nullptr;
+	_io_wait* m_writer = nullptr;
+	timedelta_ms_t m_timeout = 0;
+
+	// receiving through the loop; see `receive_into`
+	input_buffer* m_sink = nullptr;
+	std::size_t m_received = 0; // appended to m_sink since a reader took them
+	int m_recv_error = 0;	    // -errno once receiving has failed
+	bool m_eof = false;
+	bool m_receiving = false;   // the loop is receiving
+	bool m_pausing = false;	    // and has been asked to stop
+
+	void m_update_interest();
+	void m_update_receiving();
+
+	// whether a reader would find anything, when receiving through the loop
+	bool m_recv_pending() const noexcept { return m_received || m_recv_error || m_eof; }
+
+    public:
+	/** async_fd: watch fd on the loop of current thread
+	 *   @parameters:
+	 *      fd: non-blocking file descriptor; closed by the destructor
+	 */
+	explicit async_fd(int fd);
+	async_fd(const async_fd&) = delete;
+	~async_fd();
+
+	/** set_timeout: limit how long operations wait for an edge
+	 *   an operation waiting longer fails with -ETIMEDOUT
+	 *   @parameters:
+	 *      timeout: in milliseconds; 0 to wait forever, the default
+	 */
+	void set_timeout(timedelta_ms_t timeout) noexcept { m_timeout = timeout; }
+
+	/** receive_into: have the loop receive into in as bytes arrive
+	 *   where the loop can (`ev_loop.recv_multishot`), bytes are appended
+	 *   to in without a syscall, and `async_recv(fd, in)` takes them.
+	 *   receiving pauses while RECEIVE_AHEAD bytes wait in it with no
+	 *   reader, so a reader that's busy holds back the peer. from then
+	 *   on fd is only read by `async_recv(fd, in)` and `async_readable`,
+	 *   which waits for bytes rather than an edge, and `hangup` is set
+	 *   at end of stream. in must outlive receiving, which ends with fd.
+	 *   @return:
+	 *      whether the loop receives; fd is read as before otherwise
+	 */
+	bool receive_into(input_buffer& in);
+
+	bool on_event(bool r, bool w) override;
+	void on_timeout(timer_id id) override;
+	void on_received(byte_buffer& block, ssize_t n, bool more) override;
+    };
+
+    class _recv_wait: public _io_wait {
+    private:
+	void* m_buf;
+	std::size_t m_len;
+
+	bool m_attempt() noexcept override;
+
+    public:
+	_recv_wait(async_fd& fd, void* buf, std::size_t len) noexcept:
+	    _io_wait(fd, false), m_buf(buf), m_len(len)
+	{}
+    };
+
+    class _recv_into_wait: public _io_wait {
+    private:
+	input_buffer& m_in;
+	bool* m_drained;
+
+	bool m_attempt() noexcept override;
+
+    public:
+	_recv_into_wait(async_fd& fd, input_buffer& in, bool* drained) noexcept:
+	    _io_wait(fd, false), m_in(in), m_drained(drained)
+	{}
+    };
+
+    class _send_wait: public _io_wait {
+    private:
+	const char* m_buf;
+	std::size_t m_len;
+	std::size_t m_sent = 0;
+
+	bool m_attempt() noexcept override;
+
+    public:
+	_send_wait(async_fd& fd, const void* buf, std::size_t len) noexcept:
+	    _io_wait(fd, true), m_buf(static_cast<const char*>(buf)), m_len(len)
+	{}
+    };
+
+    class _accept_wait: public _io_wait {
+    private:
+	sockaddr* m_addr;
+	socklen_t* m_addrlen;
+
+	bool m_attempt() noexcept override;
+
+    public:
+	_accept_wait(async_fd& fd, sockaddr* addr, socklen_t* addrlen) noexcept:
+	    _io_wait(fd, false), m_addr(addr), m_addrlen(addrlen)
+	{}
+    };
+
+    class _connect_wait: public _io_wait {
+    private:
+	const sockaddr* m_addr;
+	socklen_t m_addrlen;
+	bool m_started = false;
+
+	bool m_attempt() noexcept override;
+
+    public:
+	_connect_wait(async_fd& fd, const sockaddr* addr, socklen_t addrlen) noexcept:
+	    _io_wait(fd, true), m_addr(addr), m_addrlen(addrlen)
+	{}
+    };
+
+    class _edge_wait: public _io_wait {
+    private:
+	bool m_waited = false;
+
+	bool m_attempt() noexcept override;
+
+    public:
+	_edge_wait(async_fd& fd, bool write) noexcept: _io_wait(fd, write) {}
+    };
+
+    /** async_recv: receive from a socket
+     *   @return:
+     *      awaitable of bytes received, 0 at end of stream, or -errno
+     */
+    inline _recv_wait
+    async_recv(async_fd& fd, void* buf, std::size_t len) noexcept
+    {
+	return _recv_wait(fd, buf, len);
+    }
+
+    /** async_recv: receive from a socket into an input_buffer
+     *   with fd receiving into in through the loop, this takes what has
+     *   arrived since last time, waiting if nothing has.
+     *   @parameters:
+     *      drained: set to whether everything that had arrived has been
+     *               taken, so that another call would wait for more
+     *   @return:
+     *      awaitable of bytes appended to in, 0 at end of stream, or -errno
+     */
+    inline _recv_into_wait
+    async_recv(async_fd& fd, input_buffer& in, bool& drained) noexcept
+    {
+	return _recv_into_wait(fd, in, &drained);
+    }
+
+    inline _recv_into_wait
+    async_recv(async_fd& fd, input_buffer& in) noexcept
+    {
+	return _recv_into_wait(fd, in, nullptr);
+    }
+
+    /** async_send: send every byte to a socket
+     *   @return:
+     *      awaitable of len, or -errno
+     */
+    inline _send_wait
+    async_send(async_fd& fd, const void* buf, std::size_t len) noexcept
+    {
+	return _send_wait(fd, buf, len);
+    }
+
+    /** async_accept: accept a connection
+     *   @parameters:
+     *      addr, addrlen: as those of accept(2)
+     *   @return:
+     *      awaitable of a non-blocking socket, or -errno
+     */
+    inline _accept_wait
+    async_accept(async_fd& fd, sockaddr* addr, socklen_t* addrlen) noexcept
+    {
+	return _accept_wait(fd, addr, addrlen);
+    }
+
+    /** async_connect: connect a socket
+     *   @parameters:
+     *      addr, addrlen: as those of connect(2); must stay valid until
+     *                     the connection is established
+     *   @return:
+     *      awaitable of 0, or -errno
+     */
+    inline _connect_wait
+    async_connect(async_fd& fd, const sockaddr* addr, socklen_t addrlen) noexcept
+    {
+	return _connect_wait(fd, addr, addrlen);
+    }
+
+    /** async_readable, async_writable: wait for next edge of fd
+     *   for callers using syscalls of their own. edges are only reported
+     *   for what arrives later, so await them once a syscall would block,
+     *   or has read less than asked for.
+     *   @return:
+     *      awaitable of 0, or -ETIMEDOUT
+     */
+    inline _edge_wait async_readable(async_fd& fd) noexcept { return _edge_wait(fd, false); }
+    inline _edge_wait async_writable(async_fd& fd) noexcept { return _edge_wait(fd, true); }
+
+    class _sleep_wait: public ev_watcher {
+    private:
+	timedelta_ms_t m_timeout;
+	timer_id m_timer = NULL_TIMER;
+	std::coroutine_handle<> m_handle;
+
+    public:
+	explicit _sleep_wait(timedelta_ms_t timeout) noexcept: ev_watcher(-1), m_timeout(timeout) {}
+	_sleep_wait(const _sleep_wait&) = delete;
+	~_sleep_wait();
+
+	bool await_ready() noexcept { return m_timeout <= 0; }
+	void await_suspend(std::coroutine_handle<> h);
+	void await_resume() noexcept {}
+
+	bool on_event(bool, bool) override { return false; }
+	void on_timeout(timer_id) override;
+    };
+
+    // awaitable resuming after timeout milliseconds
+    inline _sleep_wait sleep_for(timedelta_ms_t timeout) noexcept { return _sleep_wait(timeout); }
+}
+
+// a coroutine returning a task gets the promise of its parameter types
+template <typename _t, typename... _args_t>
+struct std::coroutine_traits<izumo::core::task<_t>, _args_t...> {
+    using promise_type = izumo::core::_task_frame_promise<_t, _args_t...>;
+};
+
+#endif	// IZUMO_CORE_CORO_HH_
@@ -1,24 +1,179 @@
 #ifndef IZUMO_CORE_EV_LOOP_HH_
 #define IZUMO_CORE_EV_LOOP_HH_
 
+#include <atomic>
 #include <cstdint>
+#include <functional>
+#include <string>
+#include <thread>
+#include <vector>
 
 #include <core/ev_watcher.hh>
 #include <core/clock.hh>
 
 namespace izumo::core {
+    /** post_node: a task posted with `ev_loop.post(post_node&)`
+     *   owned by the poster and linked through itself, so posting it
+     *   allocates nothing. it must stay alive until `run` or `drop` is
+     *   called, and not be posted again before that.
+     */
+    class post_node {
+    private:
+	friend class ev_loop;
+	post_node* m_next = nullptr;
+
+    public:
+	virtual ~post_node() = default;
+
+	/** run: the task, called on the thread of the loop */
+	virtual void run() = 0;
+
+	/** drop: called instead of `run` if the loop is destroyed before
+	 *   taking the node over from another thread
+	 */
+	virtual void drop() noexcept {}
+    };
+
     class ev_loop {
+    private:
+	bool m_stopped = false;
+	timestamp_ms_t m_now = clock::now();
+	std::vector<ev_watcher*> m_dirty; // watchers whose interest changed
+
+	// watchers waiting for `on_deferred`, linked through themselves
+	ev_watcher* m_deferred_head = nullptr;
+	ev_watcher** m_deferred_tail = &m_deferred_head;
+
+	// tasks posted; swapped with the other when run, so both keep storage
+	std::vector<std::function<void()>> m_tasks;
+	std::vector<std::function<void()>> m_running_tasks;
+
+	/** remote_watcher: receives tasks posted from other threads
+	 *   posters push onto a lock-free stack and only the one finding it
+	 *   empty writes to the eventfd, so a burst wakes the loop once.
+	 *   the loop takes the whole stack at once, so it never sees ABA.
+	 */
+	class remote_watcher: public ev_watcher {
+	private:
+	    ev_loop& m_loop;
+	    std::atomic<post_node*> m_head {nullptr};
+
+	public:
+	    remote_watcher(ev_loop& loop);
+	    ~remote_watcher();
+
+	    void push(post_node& node) noexcept;
+	    void push(std::function<void()>&& fn);
+	    bool on_event(bool r, bool w) override;
+	};
+
+	std::thread::id m_owner = std::this_thread::get_id();
+	remote_watcher m_remote {*this};
+
+    protected:
+	/** m_update_now: refresh time returned by `now`
+	 *   implementations call this once per `run_once`, right after
+	 *   waiting for events
+	 */
+	void m_update_now() noexcept { m_now = clock::now(); }
+
+	/** m_account: record an iteration of `run_once` in metrics
+	 *   @parameters:
+	 *      events: number of events dispatched
+	 *      timers: number of timers fired
+	 */
+	void m_account(std::size_t events, std::size_t timers);
+
+	/** m_rearm: register a changed interest of a watcher with the kernel
+	 *   called from `m_apply_interest` at most once per watcher
+	 */
+	virtual void m_rearm(ev_watcher& watcher, ev_interest interest) = 0;
+
+	/** m_apply_interest: register interest changed since last call
+	 *   implementations call this right before waiting for events, so
+	 *   that changes back and forth within an iteration cost nothing
+	 */
+	void m_apply_interest();
+
+	// record interest of a watcher being added, which is registered by caller
+	void
+	m_arm(ev_watcher& watcher, ev_interest interest) noexcept
+	{
+	    watcher.m_interest = watcher.m_armed = interest;
+	}
+
+	// drop pending interest change and deferred call of a watcher being removed
+	void m_forget(ev_watcher& watcher) noexcept;
+
+	// queue a watcher for `on_deferred`, unless it is already
+	void
+	m_defer(ev_watcher& watcher) noexcept
+	{
+	    if (watcher.m_deferred) return;
+
+	    watcher.m_deferred = true;
+	    watcher.m_next_deferred = nullptr;
+	    *m_deferred_tail = &watcher;
+	    m_deferred_tail = &watcher.m_next_deferred;
+	}
+
+	/** m_run_pending: call `on_deferred` of queued watchers, then posted tasks
+	 *   implementations call this after dispatching events. tasks posted
+	 *   meanwhile wait for next iteration.
+	 */
+	void m_run_pending();
+
+	/** m_remote_watcher: watcher of tasks posted from other threads
+	 *   implementations add it with EV_READ when constructed
+	 */
+	ev_watcher& m_remote_watcher() noexcept { return m_remote; }
+
+	// whether there's work left, so waiting for events must not block
+	bool m_has_pending() const noexcept { return m_deferred_head || !m_tasks.empty(); }
+
+	// record that the peer of a watcher has hung up
+	static void m_set_hangup(ev_watcher& watcher) noexcept { watcher.m_hangup = true; }
+
     public:
+	ev_loop() = default;
+	ev_loop(const ev_loop&) = delete;
+	virtual ~ev_loop() = default;
+
+	/** instance: get ev_loop of current thread
+	 *   the implementation is chosen by `set_default_impl` the first
+	 *   time a thread calls this
+	 */
 	static ev_loop& instance();
 
+	/** set_default_impl: select ev_loop implementation by name
+	 *   must be called before any thread calls `instance`
+	 *   @parameters:
+	 *      name: name of the implementation, e.g. "epoll" or "uring"
+	 *   @return:
+	 *      false if no implementation of such name is available
+	 */
+	static bool set_default_impl(const std::string& name);
+
     public:
 	/** add_watcher: add a watcher to monitor
 	 *   @parameters:
 	 *      watcher: watcher to be added
+	 *      interest: events to watch for
 	 */
-	virtual void add_watcher(ev_watcher& watcher) = 0;
+	virtual void add_watcher(ev_watcher& watcher, ev_interest interest = EV_READ | EV_WRITE) = 0;
+
+	/** modify_watcher: change events a watcher is interested in
+	 *   takes effect before the loop waits next time; an edge of an
+	 *   event already pending is reported after that. a watcher added
+	 *   with EV_EXCLUSIVE can't be modified.
+	 *   @parameters:
+	 *      watcher: watcher added to this loop
+	 *      interest: events to watch for from now on
+	 */
+	void modify_watcher(ev_watcher& watcher, ev_interest interest);
 
 	/** remove_watcher: stop monitoring a watcher
+	 *   pending timers of the watcher are cancelled as well
 	 *   @parameters:
 	 *      watcher: watcher to be removed
 	 */
@@ -31,13 +186,107 @@ namespace izumo::core {
 	 *   @return:
 	 *      an id for the added timer
 	 */
-	virtual void add_timer(ev_watcher& watcher, timedelta_ms_t timeout) = 0;
+	virtual timer_id add_timer(ev_watcher& watcher, timedelta_ms_t timeout) = 0;
+
+	/** cancel_timer: cancel a pending timer
+	 *   @parameters:
+	 *      id: id returned by `add_timer`
+	 *   @return:
+	 *      false if the timer has already fired or been cancelled
+	 */
+	virtual bool cancel_timer(timer_id id) = 0;
+
+	/** reschedule_timer: restart a pending timer with a new timeout
+	 *   @parameters:
+	 *      id: id returned by `add_timer`
+	 *      timeout: timeout in milliseconds from now; must be larger than 0
+	 *   @return:
+	 *      false if the timer has already fired or been cancelled
+	 */
+	virtual bool reschedule_timer(timer_id id, timedelta_ms_t timeout) = 0;
+
+	/** accept_multishot: accept connections of a listening socket in the loop
+	 *   each one is handed to `on_accepted` of the watcher without its
+	 *   address, until the watcher is removed, so accepting takes no
+	 *   syscall of its own. the watcher must have been added, and be
+	 *   interested in no edges.
+	 *   @return:
+	 *      false if the loop can't; the watcher accepts on readable edges then
+	 */
+	virtual bool accept_multishot(ev_watcher&) { return false; }
+
+	/** recv_multishot: receive from a socket in the loop
+	 *   bytes are handed to `on_received` of the watcher as they arrive,
+	 *   each time in a block of input_buffer::BLOCK_SIZE chosen when they
+	 *   do, until the stream ends, receiving fails or is cancelled, or the
+	 *   watcher is removed. the watcher must have been added, and not be
+	 *   receiving already.
+	 *   @return:
+	 *      false if the loop can't; the watcher receives on readable edges then
+	 */
+	virtual bool recv_multishot(ev_watcher&) { return false; }
+
+	/** cancel_recv: stop receiving started by `recv_multishot`
+	 *   bytes the kernel has taken already are still handed over, and
+	 *   the last `on_received` tells that it has stopped
+	 */
+	virtual void cancel_recv(ev_watcher&) {}
+
+	/** now: time of current loop iteration
+	 *   cached when the loop wakes up, so it is free to call from
+	 *   callbacks; timer timeouts are relative to it
+	 *   @return:
+	 *      timestamp from `clock::now` in milliseconds
+	 */
+	timestamp_ms_t now() const noexcept { return m_now; }
+
+	/** post: run a task on this loop
+	 *   tasks run in posting order after events of current iteration
+	 *   have been dispatched; a task posted by a task runs next
+	 *   iteration, which then does not block.
+	 *
+	 *   safe to call from any thread while the loop exists. tasks from
+	 *   another thread wake the loop up, and run in the order each
+	 *   thread posted them. from another thread, this allocates a
+	 *   node for each task; posting a `post_node` doesn't.
+	 *   @parameters:
+	 *      task: the task
+	 */
+	void
+	post(std::function<void()> task)
+	{
+	    if (std::this_thread::get_id() == m_owner) {
+		m_tasks.push_back(std::move(task));
+	    } else {
+		m_remote.push(std::move(task));
+	    }
+	}
+
+	/** post: run a task owned by the caller on this loop
+	 *   same as posting a function, with no allocation on any thread
+	 *   @parameters:
+	 *      node: the task; see `post_node` for its lifetime
+	 */
+	void
+	post(post_node& node)
+	{
+	    if (std::this_thread::get_id() == m_owner) {
+		m_tasks.push_back([&node] { node.run(); });
+	    } else {
+		m_remote.push(node);
+	    }
+	}
 
 	/** run_once: run ev_loop only once */
 	virtual void run_once() = 0;
 
-	/** run_forever(): run ev_loop forever */
+	/** run_forever(): run ev_loop until `stop` is called */
 	void run_forever();
+
+	/** stop: make `run_forever` return after current iteration
+	 *   must be called from the thread running this loop
+	 */
+	void stop() noexcept { m_stopped = true; }
     };
 }
 
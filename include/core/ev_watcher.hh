@@ -3,17 +3,61 @@
 
 #include <cstdint>
 
+#include <sys/types.h>
+
 namespace izumo::core {
+    class byte_buffer;
+
+    using timer_id = uint64_t;	// identifies a timer added by `ev_loop.add_timer`
+    constexpr timer_id NULL_TIMER = 0; // never returned by `ev_loop.add_timer`
+
+    // events a watcher is interested in; a combination of EV_* flags
+    using ev_interest = uint8_t;
+    constexpr ev_interest EV_READ = 1;	 // readable edges
+    constexpr ev_interest EV_WRITE = 2;	 // writable edges
+    constexpr ev_interest EV_RDHUP = 4;	 // peer shutting down its writing side
+    constexpr ev_interest EV_EXCLUSIVE = 8; // wake one of the loops sharing the fd
+
     // base class for a event watcher
     class ev_watcher {
+    private:
+	friend class timer_wheel;
+	friend class ev_loop;
+	uint32_t m_timers = NO_TIMER; // pending timers, managed by timer_wheel
+
+	// managed by ev_loop
+	ev_interest m_interest = 0; // requested interest
+	ev_interest m_armed = 0;    // interest registered with the kernel
+	bool m_hangup = false;
+	bool m_deferred = false;      // queued for `on_deferred`
+	uint32_t m_dirty = NOT_DIRTY; // position in pending interest changes
+	ev_watcher* m_next_deferred = nullptr;
+
     protected:
 	int m_fd; // file descriptor to watch
     public:
+	constexpr static uint32_t NO_TIMER = ~uint32_t(0);
+	constexpr static uint32_t NOT_DIRTY = ~uint32_t(0);
+
 	ev_watcher(int fd): m_fd(fd) {}
 	
 	int fd() { return m_fd; }
+
+	// interest given to `ev_loop.add_watcher` or `ev_loop.modify_watcher`
+	ev_interest interest() const noexcept { return m_interest; }
+
+	/** hangup: whether the peer has shut down its writing side
+	 *   only known with EV_RDHUP interest, or when receiving through
+	 *   `ev_loop.recv_multishot`. it is set before `on_event` of the
+	 *   edge reporting it, or `on_received` of the end of stream, and
+	 *   stays set.
+	 */
+	bool hangup() const noexcept { return m_hangup; }
+
 	/** on_event: edge triggered event callback
-	 *   called each time watcher state is changed
+	 *   called each time watcher state is changed. errors and hang-ups
+	 *   are reported as both readable and writable, so that whoever
+	 *   waits finds out by its next syscall.
 	 *   @parameters:
 	 *      r: readable state
 	 *      w: writable state
@@ -30,9 +74,25 @@ namespace izumo::core {
 	/** on_timeout: timeout callback
 	 *   called when a registered timer is expired
 	 *   @parameters:
-	 *      id: parameter id returned by `ev_loop.add_timer`
+	 *      id: timer id returned by `ev_loop.add_timer`
 	 **/
-	virtual void on_timeout() {};
+	virtual void on_timeout(timer_id) {};
+
+	/** on_accepted: accepted callback
+	 *   called for each connection accepted by `ev_loop.accept_multishot`
+	 *   @parameters:
+	 *      fd: non-blocking socket, or -errno once accepting has stopped
+	 */
+	virtual void on_accepted(int) {}
+
+	/** on_received: received callback
+	 *   called as bytes arrive for `ev_loop.recv_multishot`
+	 *   @parameters:
+	 *      block: holds the bytes at its front; may be taken over
+	 *      n: number of bytes, 0 at end of stream, or -errno
+	 *      more: whether receiving goes on; it has stopped otherwise
+	 */
+	virtual void on_received(byte_buffer&, ssize_t, bool) {}
     };
 }
 
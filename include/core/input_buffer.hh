@@ -0,0 +1,93 @@
+// core/input_buffer.hh -- segmented buffer for received bytes
+#ifndef IZUMO_CORE_INPUT_BUFFER_HH_
+#define IZUMO_CORE_INPUT_BUFFER_HH_
+
+#include <core/byte_buffer.hh>
+
+#include <cstdint>
+#include <vector>
+
+namespace izumo::core {
+    /** input_buffer: received bytes kept in a chain of blocks
+     *   bytes are appended at the back by `prepare` and `commit`, and
+     *   consumed from the front. blocks of BLOCK_SIZE are slab blocks
+     *   recycled by the thread, and an empty buffer holds no block at
+     *   all, so idle connections cost no buffer memory.
+     *
+     *   bytes are only contiguous within a block; `linearize` merges the
+     *   front bytes into one block for consumers such as the parser which
+     *   need them contiguous.
+     */
+    class input_buffer {
+    public:
+	constexpr static std::size_t BLOCK_SIZE = 4096;
+
+    private:
+	struct block {
+	    byte_buffer buf;
+	    std::size_t begin = 0;	// first unconsumed byte
+	    std::size_t end = 0;	// end of received bytes
+	};
+
+	std::vector<block> m_blocks;
+	std::size_t m_size = 0;
+
+	void m_pop_front() noexcept;
+
+    public:
+	input_buffer() = default;
+	input_buffer(const input_buffer&) = delete;
+
+	// number of unconsumed bytes
+	std::size_t size() const noexcept { return m_size; }
+	bool empty() const noexcept { return !m_size; }
+
+	/** prepare: get room for receiving
+	 *   @return:
+	 *      a view of at least one byte right after received bytes
+	 */
+	byte_buffer_view prepare();
+
+	// mark n bytes of the room from `prepare` as received
+	void commit(std::size_t n) noexcept;
+
+	/** append: add n bytes received into the front of block
+	 *   they are copied behind the last bytes if there's room, so bytes
+	 *   arriving in small pieces stay contiguous; block is taken over
+	 *   otherwise.
+	 */
+	void append(byte_buffer& block, std::size_t n);
+
+	// drop n bytes from the front; emptied blocks are released
+	void consume(std::size_t n) noexcept;
+
+	/** front: bytes at the front which are contiguous
+	 *   @return:
+	 *      a view of unconsumed bytes in the first block
+	 */
+	byte_buffer_view front() noexcept;
+
+	/** take_front: take the first n bytes away with their block
+	 *   they stay where they are, so views and pointers to them remain
+	 *   valid; bytes following them in the block are copied to a new
+	 *   one. n must not exceed `front().size()`.
+	 *   @return:
+	 *      the block, which now owns the n bytes
+	 */
+	byte_buffer take_front(std::size_t n);
+
+	/** linearize: make every unconsumed byte contiguous
+	 *   bytes are moved to a new place, so views and pointers to them
+	 *   are invalidated. a buffer larger than a block gets a block of
+	 *   its own.
+	 *   @return:
+	 *      whether bytes have been moved
+	 */
+	bool linearize();
+
+	// give every block back when the buffer is empty
+	void shrink() noexcept;
+    };
+}
+
+#endif	// IZUMO_CORE_INPUT_BUFFER_HH_
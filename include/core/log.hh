@@ -1,13 +1,18 @@
 #ifndef IZUMO_CORE_LOG_HH_
 #define IZUMO_CORE_LOG_HH_
 
+#include <algorithm>
+#include <atomic>
 #include <cassert>
+#include <condition_variable>
 #include <cstdint>
 #include <string>
 #include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
 #include <chrono>
 #include <ctime>
-#include <fmt/chrono.h>
 #include <fmt/format.h>
 
 namespace izumo::core {
@@ -21,6 +26,7 @@ namespace izumo::core {
     
     class log_output {
     public:
+	virtual ~log_output() = default;
 	virtual void out(const char* str, std::size_t len) = 0;
     };
 
@@ -29,6 +35,65 @@ namespace izumo::core {
 	void out(const char* str, std::size_t len) override;
     };
 
+    /** log_output_async: write lines to a file descriptor from a background thread
+     *   every logging thread gets its own single-producer ring, so `out`
+     *   only copies the line and never takes a lock or makes a syscall in
+     *   the common case. one writer thread drains every ring and writes
+     *   batches of lines with `writev`. pending lines are written before
+     *   the output is destructed.
+     */
+    class log_output_async: public log_output {
+    public:
+	// what `out` does when the ring of calling thread is full
+	enum class overflow_policy {
+	    drop,		// discard the line and count it
+	    block		// wait for the writer to make room
+	};
+
+	constexpr static std::size_t DEFAULT_RING_SIZE = 64 * 1024;
+
+    private:
+	struct ring;
+
+	uint64_t m_serial;		// tells instances apart in per-thread caches
+	int m_fd;
+	overflow_policy m_policy;
+	std::size_t m_ring_size;
+
+	std::mutex m_mutex;		// guards m_rings and sleeping/waking
+	std::condition_variable m_writer_cv;
+	std::condition_variable m_space_cv;
+	std::vector<std::unique_ptr<ring>> m_rings;
+	std::atomic<bool> m_writer_idle {false};
+	std::atomic<std::size_t> m_blocked {0}; // producers waiting for room
+	std::atomic<uint64_t> m_dropped {0};
+	bool m_stopping = false;
+
+	std::thread m_writer;
+
+	ring& m_get_ring();
+	bool m_drain();
+	bool m_pending() const noexcept;
+	void m_writer_main();
+	void m_wake_writer();
+
+    public:
+	/** @parameters:
+	 *      fd: where lines are written to; not closed by the output
+	 *      policy: behaviour when a ring is full
+	 *      ring_size: bytes of each per-thread ring; a power of two
+	 */
+	log_output_async(int fd, overflow_policy policy = overflow_policy::drop,
+			 std::size_t ring_size = DEFAULT_RING_SIZE);
+	log_output_async(const log_output_async&) = delete;
+	~log_output_async();
+
+	void out(const char* str, std::size_t len) override;
+
+	// number of lines discarded because a ring was full
+	uint64_t dropped() const noexcept { return m_dropped.load(std::memory_order_relaxed); }
+    };
+
     class logger {
     public:
 	static logger& get();
@@ -42,9 +107,14 @@ namespace izumo::core {
 
 	log_level m_min_level = log_level::info;
 
+	// local time of last logged second, formatted
+	std::time_t m_time_cached = -1;
+	char m_time_str[32];
+
 	logger() = default;
 
 	log_output& m_get_output() { return m_output ? *m_output : *default_output; }
+	const char* m_time_string(std::time_t now) noexcept;
     public:
 	void set_name(std::string name);
 	void set_output(std::unique_ptr<log_output> output);
@@ -58,16 +128,19 @@ namespace izumo::core {
 	    char buf[BUFSIZE];
 	    const char* level_chars = "VDIWEF";
 
-	    auto now = std::time(nullptr);
-	    auto ret = fmt::format_to_n(buf, BUFSIZE, "{:%Y-%m-%d %H:%M:%S} {} {}{}",
-					*std::localtime(&now), level_chars[static_cast<std::size_t>(level)], m_name, m_name.size() ? " " : "");
+	    auto ret = fmt::format_to_n(buf, BUFSIZE, "{} {} {}{}",
+					m_time_string(std::time(nullptr)),
+					level_chars[static_cast<std::size_t>(level)],
+					m_name, m_name.size() ? " " : "");
 	    
 	    // XXX: boundary check. should not be necessary
 	    assert(ret.size < BUFSIZE);
 
 	    auto size = ret.size;
-	    ret = fmt::format_to_n(buf + size, BUFSIZE - size, fmt, std::forward<_args_t>(args)...);
-	    size += ret.size;
+	    // the format string is forwarded, so it can't be checked at compile time
+	    ret = fmt::format_to_n(buf + size, BUFSIZE - size, fmt::runtime(fmt),
+				   std::forward<_args_t>(args)...);
+	    size = std::min(size + ret.size, BUFSIZE);
 
 	    m_get_output().out(buf, size);
 	}
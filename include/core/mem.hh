@@ -3,6 +3,7 @@
 
 #include <cstdlib>
 #include <cstddef>
+#include <cstdint>
 #include <memory>
 
 namespace izumo::core {
@@ -29,7 +30,18 @@ namespace izumo::core {
     template <typename _t>
     using mp_unique_ptr = std::unique_ptr<_t, _mem_pool_delete<_t>>;
 
-    /** mem_pool: simple memory pool implementation */
+    // statistics of the chunk cache of current thread
+    struct mem_pool_cache_stats {
+	uint64_t hits = 0;	       // chunks taken from cache
+	uint64_t misses = 0;	       // chunks allocated because cache was empty
+	std::size_t retained_bytes = 0; // bytes of chunks kept in cache
+    };
+
+    /** mem_pool: simple memory pool implementation
+     *   released chunks are kept in a per-thread cache up to a limit and
+     *   handed to the next pool needing one on the same thread, so
+     *   short-lived pools rarely reach the system allocator.
+     */
     class mem_pool {
     private:
 	_mem_chunk_header *m_chunk_p = nullptr;
@@ -37,16 +49,36 @@ namespace izumo::core {
 
 	bool m_alloc_chunk() noexcept;
 	_mem_large_meta* m_alloc_large(std::size_t size, std::size_t alignment) noexcept;
+	void m_release() noexcept;
 	
     public:
-	constexpr inline static std::size_t CHUNK_SIZE = 4096;
+	constexpr inline static std::size_t CHUNK_SIZE = 4096; // a slab class
 	constexpr inline static std::size_t LARGE_THRESHOLD = CHUNK_SIZE / 2;
+	constexpr inline static std::size_t DEFAULT_CACHE_LIMIT = 256; // in chunks
 	
 	mem_pool() noexcept = default;
 	mem_pool(const mem_pool&) = delete;
 	mem_pool(mem_pool&&);
 	~mem_pool();	
 
+	// release memory of this pool and take over rhs's
+	mem_pool& operator=(mem_pool&& rhs) noexcept;
+
+	/** reset: release every allocation at once
+	 *   the first chunk is kept for reuse, so a pool reset between
+	 *   requests of the same size never allocates again. objects
+	 *   allocated from the pool must be destructed beforehand.
+	 */
+	void reset() noexcept;
+
+	/** set_cache_limit: set how many released chunks current thread keeps
+	 *   chunks beyond the limit are freed immediately
+	 */
+	static void set_cache_limit(std::size_t chunks) noexcept;
+
+	// statistics of chunk cache of current thread
+	static mem_pool_cache_stats cache_stats() noexcept;
+
 	/** allocate, try_allocate: allocate a chunk of raw memory
 	 *    `allocate` calls `std::abort` on allocation failure
 	 *    use `try_allocate` if such behaviour is undesired
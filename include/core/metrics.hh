@@ -0,0 +1,167 @@
+// core/metrics.hh -- counters, gauges and histograms
+#ifndef IZUMO_CORE_METRICS_HH_
+#define IZUMO_CORE_METRICS_HH_
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace izumo::core {
+    class counter;
+    class gauge;
+    class histogram;
+
+    /** metrics_registry: process-wide set of metrics
+     *   every thread updating a metric gets its own shard of cells, so
+     *   updates are plain stores to memory nobody else writes, with no
+     *   lock and no atomic read-modify-write. shards are summed up only
+     *   when metrics are read. shards of exited threads are kept so that
+     *   counters never go backwards.
+     *
+     *   metrics are registered once, usually at static initialization,
+     *   and live as long as the process.
+     */
+    class metrics_registry {
+    public:
+	using cell_t = std::atomic<uint64_t>;
+
+	constexpr static std::size_t MAX_CELLS = 4096; // cells in each shard
+
+    private:
+	enum class kind { counter, gauge, histogram };
+
+	struct entry {
+	    kind type;
+	    std::string name;
+	    std::string help;
+	    uint32_t offset;	// first cell in shards
+	};
+
+	mutable std::mutex m_mutex; // guards everything below; never taken by updates
+	std::vector<entry> m_entries;
+	std::vector<std::unique_ptr<cell_t[]>> m_shards;
+	uint32_t m_cells = 0;
+
+	metrics_registry() = default;
+
+	uint32_t m_add(kind type, std::string name, std::string help, uint32_t ncells);
+	uint64_t m_sum(uint32_t cell) const noexcept;
+	cell_t* m_new_shard();
+
+    public:
+	static metrics_registry& instance();
+
+	metrics_registry(const metrics_registry&) = delete;
+
+	/** add_counter, add_gauge, add_histogram: register a metric
+	 *   @parameters:
+	 *      name: metric name; must be unique and follow Prometheus rules
+	 *      help: one-line description
+	 *   @exception:
+	 *      std::length_error if shards have run out of cells
+	 */
+	counter add_counter(std::string name, std::string help);
+	gauge add_gauge(std::string name, std::string help);
+	histogram add_histogram(std::string name, std::string help);
+
+	/** expose: render every metric in Prometheus text format
+	 *   @parameters:
+	 *      out: where text is appended to
+	 */
+	void expose(std::string& out) const;
+
+	// shard of current thread, created on first use
+	static cell_t*
+	shard()
+	{
+	    static thread_local cell_t* ret = instance().m_new_shard();
+	    return ret;
+	}
+
+	// add to a cell of current thread; only the owner ever writes it
+	static void
+	add(uint32_t cell, uint64_t n)
+	{
+	    auto& c = shard()[cell];
+	    c.store(c.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+	}
+    };
+
+    /** counter: monotonically increasing value */
+    class counter {
+    private:
+	uint32_t m_cell;
+
+	friend class metrics_registry;
+	explicit counter(uint32_t cell) noexcept: m_cell(cell) {}
+
+    public:
+	void inc(uint64_t n = 1) { metrics_registry::add(m_cell, n); }
+    };
+
+    /** gauge: value going up and down, e.g. number of open connections
+     *   shards hold deltas which wrap around and sum up to the value, so
+     *   a gauge may be raised on one thread and lowered on another.
+     */
+    class gauge {
+    private:
+	uint32_t m_cell;
+
+	friend class metrics_registry;
+	explicit gauge(uint32_t cell) noexcept: m_cell(cell) {}
+
+    public:
+	void add(int64_t n) { metrics_registry::add(m_cell, static_cast<uint64_t>(n)); }
+	void inc() { add(1); }
+	void dec() { add(-1); }
+    };
+
+    /** histogram: log-linear histogram of durations in nanoseconds
+     *   each power of two is split into 4 linear buckets, so a recorded
+     *   value is off by less than 25% over the whole 64-bit range.
+     *   durations are exposed in seconds, as Prometheus expects.
+     */
+    class histogram {
+    public:
+	constexpr static unsigned SUB_BITS = 2;
+	constexpr static unsigned SUBS = 1 << SUB_BITS;
+	constexpr static unsigned BUCKETS = (64 - SUB_BITS + 1) * SUBS;
+
+	// cells of a histogram: buckets, then sum and count
+	constexpr static unsigned CELLS = BUCKETS + 2;
+
+	// index of the bucket holding value
+	static unsigned
+	bucket_of(uint64_t value) noexcept
+	{
+	    if (value < SUBS) return value;
+
+	    unsigned msb = 63 - __builtin_clzll(value);
+	    unsigned sub = (value >> (msb - SUB_BITS)) & (SUBS - 1);
+	    return (msb - SUB_BITS + 1) * SUBS + sub;
+	}
+
+	// largest value in a bucket
+	static uint64_t bucket_max(unsigned bucket) noexcept;
+
+    private:
+	uint32_t m_cell;
+
+	friend class metrics_registry;
+	explicit histogram(uint32_t cell) noexcept: m_cell(cell) {}
+
+    public:
+	void
+	observe(uint64_t ns)
+	{
+	    metrics_registry::add(m_cell + bucket_of(ns), 1);
+	    metrics_registry::add(m_cell + BUCKETS, ns);
+	    metrics_registry::add(m_cell + BUCKETS + 1, 1);
+	}
+    };
+}
+
+#endif	// IZUMO_CORE_METRICS_HH_
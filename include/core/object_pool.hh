@@ -0,0 +1,109 @@
+// core/object_pool.hh -- free-list pool of objects of one type
+#ifndef IZUMO_CORE_OBJECT_POOL_HH_
+#define IZUMO_CORE_OBJECT_POOL_HH_
+
+#include <core/slab.hh>
+
+#include <cstddef>
+#include <new>
+#include <utility>
+#include <vector>
+
+namespace izumo::core {
+    /** object_pool: pool of objects of type T for one thread
+     *   objects are constructed in place in slots carved from slab
+     *   blocks, and their slots are linked into a free list when they are
+     *   destroyed, so a steady number of objects never allocates. slots
+     *   are aligned to alignof(T), and blocks are only given back when
+     *   the pool is destructed.
+     *
+     *   a pool must only be used by the thread that created it.
+     */
+    template <typename _t>
+    class object_pool {
+    public:
+	constexpr static std::size_t BLOCK_SIZE = 16384; // a slab class
+
+    private:
+	union slot {
+	    slot* next;		// while free
+	    alignas(_t) unsigned char storage[sizeof(_t)];
+	};
+
+	constexpr static std::size_t SLOTS_PER_BLOCK = BLOCK_SIZE / sizeof(slot);
+	static_assert(SLOTS_PER_BLOCK > 0, "object too large for a pool block");
+
+	slot* m_free = nullptr;
+	std::vector<void*> m_blocks;
+	std::size_t m_live = 0;
+
+	// link slots of a new block into the free list
+	void
+	m_grow()
+	{
+	    auto mem = slab_allocator::allocate(BLOCK_SIZE);
+	    if (!mem) throw std::bad_alloc();
+
+	    m_blocks.push_back(mem);
+	    auto slots = static_cast<slot*>(mem);
+	    for (auto i = SLOTS_PER_BLOCK; i > 0; --i) {
+		slots[i - 1].next = m_free;
+		m_free = &slots[i - 1];
+	    }
+	}
+
+    public:
+	object_pool() = default;
+	object_pool(const object_pool&) = delete;
+
+	// blocks are kept if any object is still alive, since it may
+	// still be referred to
+	~object_pool()
+	{
+	    if (m_live) return;
+	    for (auto mem: m_blocks) slab_allocator::deallocate(mem, BLOCK_SIZE);
+	}
+
+	/** construct: construct an object in a free slot
+	 *   @parameters:
+	 *      args: arguments to be forwarded to object's constructor
+	 *   @return:
+	 *      pointer to the object; guaranteed to be non-null
+	 */
+	template <typename... _args_t> _t*
+	construct(_args_t&&... args)
+	{
+	    if (!m_free) m_grow();
+
+	    auto s = m_free;
+	    m_free = s->next;
+
+	    try {
+		auto ret = new (s->storage) _t(std::forward<_args_t>(args)...);
+		++m_live;
+		return ret;
+	    } catch (...) {
+		s->next = m_free;
+		m_free = s;
+		throw;
+	    }
+	}
+
+	// destruct an object constructed by this pool and free its slot
+	void
+	destroy(_t* obj) noexcept
+	{
+	    obj->~_t();
+
+	    auto s = reinterpret_cast<slot*>(obj);
+	    s->next = m_free;
+	    m_free = s;
+	    --m_live;
+	}
+
+	// number of objects alive
+	std::size_t live() const noexcept { return m_live; }
+    };
+}
+
+#endif	// IZUMO_CORE_OBJECT_POOL_HH_
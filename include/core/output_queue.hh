@@ -0,0 +1,97 @@
+// core/output_queue.hh -- queue of bytes to be written to a socket
+#ifndef IZUMO_CORE_OUTPUT_QUEUE_HH_
+#define IZUMO_CORE_OUTPUT_QUEUE_HH_
+
+#include <core/byte_buffer.hh>
+
+#include <cstdint>
+#include <memory>
+#include <string_view>
+#include <vector>
+
+#include <sys/types.h>
+
+namespace izumo::core {
+    /** output_queue: chain of segments written to a socket in order
+     *   a segment refers to memory, to a range of a byte_buffer, or to a
+     *   range of a file; nothing is copied. consecutive memory segments
+     *   are written with one `sendmsg`, file segments with `sendfile`.
+     *   a partially written segment is resumed by the next `flush`.
+     *
+     *   memory and files must stay valid until their segment is written.
+     *   an owner may be attached to a segment to keep them alive; it is
+     *   released as soon as the segment is written or the queue cleared.
+     */
+    class output_queue {
+    public:
+	enum class flush_result {
+	    done,		// every segment is written
+	    pending,		// socket would block
+	    error		// socket failed; see errno
+	};
+
+    private:
+	enum class kind: uint8_t { memory, buffer, file };
+
+	struct segment {
+	    kind type;
+	    int fd;			 // file
+	    const byte_t* ptr;		 // memory
+	    const byte_buffer* buf;	 // buffer
+	    std::size_t offset;		 // buffer: offset of first byte; file: position
+	    std::size_t len;
+	    std::shared_ptr<const void> owner;
+	};
+
+	constexpr static std::size_t MAX_IOV = 64; // memory segments per sendmsg
+
+	std::vector<segment> m_segments;
+	std::size_t m_head = 0;		// first segment not completely written
+	std::size_t m_bytes = 0;	// bytes not written yet
+
+	void m_push(segment&& seg);
+	void m_advance(std::size_t n) noexcept;
+
+    public:
+	output_queue() = default;
+	output_queue(const output_queue&) = delete;
+
+	bool empty() const noexcept { return m_head == m_segments.size(); }
+
+	// number of bytes not written yet
+	std::size_t size() const noexcept { return m_bytes; }
+
+	/** push: queue bytes of memory, e.g. a string literal
+	 *   @parameters:
+	 *      bytes: memory to be written
+	 *      owner: released once bytes are written
+	 */
+	void push(std::string_view bytes, std::shared_ptr<const void> owner = {});
+
+	/** push: queue bytes [begin, end) of a byte_buffer
+	 *   the buffer is addressed when bytes are written, so it may be
+	 *   resized in the meantime. a range continuing the previous one of
+	 *   the same buffer is merged into it.
+	 */
+	void push(const byte_buffer& buf, std::size_t begin, std::size_t end);
+
+	/** push_file: queue len bytes of a file starting from offset
+	 *   @parameters:
+	 *      fd: the file; must support `sendfile`
+	 *      owner: released once bytes are written; usually owns fd
+	 */
+	void push_file(int fd, off_t offset, std::size_t len, std::shared_ptr<const void> owner = {});
+
+	/** flush: write as much as the socket takes
+	 *   @parameters:
+	 *      fd: socket to write to
+	 *      written: increased by number of bytes written
+	 */
+	flush_result flush(int fd, std::size_t& written);
+
+	// drop every segment
+	void clear() noexcept;
+    };
+}
+
+#endif	// IZUMO_CORE_OUTPUT_QUEUE_HH_
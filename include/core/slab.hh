@@ -0,0 +1,77 @@
+// core/slab.hh -- per-thread allocator for fixed-size I/O blocks
+#ifndef IZUMO_CORE_SLAB_HH_
+#define IZUMO_CORE_SLAB_HH_
+
+#include <cstddef>
+#include <cstdint>
+
+namespace izumo::core {
+    // statistics of the slabs of current thread
+    struct slab_stats {
+	std::size_t mapped_bytes = 0; // bytes of arenas mapped
+	std::size_t free_bytes = 0;   // bytes of free blocks still resident
+	std::size_t trimmed_bytes = 0; // bytes of free blocks given back to kernel
+    };
+
+    /** slab_allocator: allocator of 4K, 16K and 64K blocks
+     *   blocks are carved from 2M arenas mapped with mmap, which are never
+     *   unmapped. each thread keeps its own free blocks, so allocating
+     *   and freeing take no lock; a block freed on another thread joins
+     *   the free blocks of that thread.
+     *
+     *   freed blocks stay resident for reuse until `trim` is called,
+     *   which gives all but a few of them back to the kernel with
+     *   MADV_DONTNEED. they are still reused afterwards, and faulted in
+     *   again on first touch.
+     */
+    class slab_allocator {
+    public:
+	constexpr static std::size_t CLASSES = 3;
+	constexpr static std::size_t CLASS_SIZES[CLASSES] = { 4096, 16384, 65536 };
+	constexpr static std::size_t ARENA_SIZE = 2 * 1024 * 1024;
+	constexpr static std::size_t DEFAULT_TRIM_KEEP = 64; // in blocks per class
+
+	/** class_size: size of the smallest class fitting n bytes
+	 *   @return:
+	 *      the size, or 0 if n is larger than any class
+	 */
+	static std::size_t
+	class_size(std::size_t n) noexcept
+	{
+	    for (auto size: CLASS_SIZES) {
+		if (n <= size) return size;
+	    }
+
+	    return 0;
+	}
+
+	/** allocate: allocate a block
+	 *   @parameters:
+	 *      size: one of CLASS_SIZES
+	 *   @return:
+	 *      the block, or nullptr if memory can't be mapped
+	 */
+	static void* allocate(std::size_t size) noexcept;
+
+	// free a block allocated with the same size
+	static void deallocate(void* ptr, std::size_t size) noexcept;
+
+	/** trim: give free blocks of current thread back to the kernel
+	 *   @parameters:
+	 *      keep: number of recently freed blocks to keep resident per class
+	 *   @return:
+	 *      number of bytes given back
+	 */
+	static std::size_t trim(std::size_t keep = DEFAULT_TRIM_KEEP) noexcept;
+
+	/** set_huge_pages: back arenas mapped from now on with transparent huge pages
+	 *   trimming then splits huge pages as needed
+	 */
+	static void set_huge_pages(bool enabled) noexcept;
+
+	// statistics of current thread
+	static slab_stats stats() noexcept;
+    };
+}
+
+#endif	// IZUMO_CORE_SLAB_HH_
@@ -0,0 +1,100 @@
+// core/timer_wheel.hh -- hierarchical timing wheel
+#ifndef IZUMO_CORE_TIMER_WHEEL_HH_
+#define IZUMO_CORE_TIMER_WHEEL_HH_
+
+#include <core/clock.hh>
+#include <core/ev_watcher.hh>
+
+#include <cstdint>
+#include <vector>
+
+namespace izumo::core {
+    /** timer_wheel: hierarchical timing wheel with millisecond ticks
+     *   4 levels of 256 slots each cover deadlines up to ~49 days ahead;
+     *   farther deadlines are parked in the last level and re-filed when
+     *   cascaded. add, cancel and reschedule are O(1); timers sharing a
+     *   tick are fired together by `expire`.
+     *
+     *   timers live in an index-linked node array, so ids stay valid
+     *   across growth; an id carries a generation to detect reuse.
+     */
+    class timer_wheel {
+    private:
+	constexpr static unsigned LEVEL_BITS = 8;
+	constexpr static unsigned LEVELS = 4;
+	constexpr static unsigned SLOTS = 1 << LEVEL_BITS;
+	constexpr static uint64_t SLOT_MASK = SLOTS - 1;
+	constexpr static uint32_t NIL = ev_watcher::NO_TIMER;
+
+	struct node {
+	    timestamp_ms_t deadline;
+	    ev_watcher* watcher;
+	    uint32_t generation = 1;
+	    uint32_t prev, next;	// links in slot list, or free list
+	    uint32_t w_prev, w_next;	// links in owner's timer list
+	    uint16_t level, slot;
+	};
+
+	std::vector<node> m_nodes;
+	uint32_t m_free = NIL;
+	std::size_t m_count = 0;
+
+	uint32_t m_slots[LEVELS][SLOTS];
+	uint64_t m_bitmap[LEVELS][SLOTS / 64]; // non-empty slots
+
+	timestamp_ms_t m_now;	// every timer due at or before this tick has fired
+
+	node* m_get(timer_id id) noexcept;
+	void m_insert(uint32_t index) noexcept;
+	void m_link(uint32_t index, unsigned level, unsigned slot) noexcept;
+	void m_unlink(uint32_t index) noexcept;
+	void m_release(uint32_t index) noexcept;
+	void m_cascade(unsigned level, unsigned slot) noexcept;
+	std::size_t m_fire(unsigned slot);
+	timestamp_ms_t m_next_tick() const noexcept;
+
+    public:
+	timer_wheel(timestamp_ms_t now) noexcept;
+	timer_wheel(const timer_wheel&) = delete;
+
+	std::size_t size() const noexcept { return m_count; }
+
+	/** add: add a timer
+	 *   @parameters:
+	 *      watcher: the owner of timer; its `on_timeout` is called on expiry
+	 *      deadline: absolute time to fire at
+	 *   @return:
+	 *      an id for the added timer
+	 */
+	timer_id add(ev_watcher& watcher, timestamp_ms_t deadline);
+
+	/** cancel: remove a pending timer
+	 *   @return:
+	 *      false if the timer has already fired or been cancelled
+	 */
+	bool cancel(timer_id id) noexcept;
+
+	/** reschedule: move a pending timer to a new deadline
+	 *   @return:
+	 *      false if the timer has already fired or been cancelled
+	 */
+	bool reschedule(timer_id id, timestamp_ms_t deadline) noexcept;
+
+	/** cancel_all: remove every pending timer owned by watcher */
+	void cancel_all(ev_watcher& watcher) noexcept;
+
+	/** next_timeout: time until the wheel needs to be advanced again
+	 *   @return:
+	 *      milliseconds from now, or -1 if there's no pending timer
+	 */
+	timedelta_ms_t next_timeout(timestamp_ms_t now) const noexcept;
+
+	/** expire: advance the wheel to now and fire every expired timer
+	 *   @return:
+	 *      number of timers fired
+	 */
+	std::size_t expire(timestamp_ms_t now);
+    };
+}
+
+#endif	// IZUMO_CORE_TIMER_WHEEL_HH_
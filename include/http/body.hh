@@ -0,0 +1,100 @@
+// http/body.hh -- message body framing
+#ifndef IZUMO_HTTP_BODY_HH_
+#define IZUMO_HTTP_BODY_HH_
+
+#include <http/parser.hh>
+#include <http/types.hh>
+#include <core/byte_buffer.hh>
+
+#include <cstdint>
+
+namespace izumo::http {
+    // how the end of a body is found
+    enum class body_framing {
+	none,			// there is no body
+	length,			// Content-Length bytes
+	chunked,		// chunked transfer coding
+	until_close		// the connection is closed; responses only
+    };
+
+    /** body_decoder: incremental body decoder
+     *   finds body bytes among the bytes received after the header, and
+     *   where the body ends. bytes are never copied; body data is given
+     *   out as views of the received bytes. chunk extensions and trailer
+     *   fields are skipped.
+     */
+    class body_decoder {
+    private:
+	enum class chunk_state {
+	    size,
+	    size_ws,		// BWS after the size, before ';'
+	    ext,		// chunk extensions up to CR
+	    size_lf,
+	    data,
+	    data_cr,
+	    data_lf,
+	    trailer,		// start of a trailer line, or of the last CRLF
+	    trailer_line,
+	    trailer_lf,
+	    end_lf,
+	    done,
+	    error
+	};
+
+	body_framing m_framing = body_framing::none;
+	chunk_state m_chunk = chunk_state::size;
+	uint64_t m_remaining = 0; // of body, or of current chunk
+	uint64_t m_size = 0;	  // body bytes decoded
+	unsigned m_digits = 0;	  // of current chunk size
+
+	parse_result m_decode_chunked(const core::byte_buffer_view& in,
+				      core::byte_buffer_view& data, std::size_t& consumed) noexcept;
+
+    public:
+	/** start: get ready to decode a body
+	 *   @parameters:
+	 *      length: Content-Length; only used with `body_framing::length`
+	 */
+	void start(body_framing framing, uint64_t length = 0) noexcept;
+
+	/** start_request: get ready to decode body of req (RFC 7230 3.3.3)
+	 *   @return:
+	 *      false if the framing of req is malformed or ambiguous, i.e. it
+	 *      has both Transfer-Encoding and Content-Length, or a coding
+	 *      other than chunked last
+	 */
+	bool start_request(const request& req) noexcept;
+
+	/** start_response: get ready to decode body of res (RFC 7230 3.3.3)
+	 *   @parameters:
+	 *      head_request: res answers a HEAD request, so has no body
+	 *   @return:
+	 *      false if the framing of res is malformed
+	 */
+	bool start_response(const response& res, bool head_request) noexcept;
+
+	/** decode: take the next piece of body from received bytes
+	 *   call again with the rest of `in` as long as something is
+	 *   consumed; once nothing is, more bytes have to be received.
+	 *   @parameters:
+	 *      in: received bytes following those consumed so far
+	 *      data: set to body bytes found in `in`; may be empty
+	 *      consumed: set to number of bytes taken from `in`, including data
+	 *   @return:
+	 *      `done` once the body has ended, `incomplete` if it goes on, or
+	 *      `error` if it is malformed
+	 */
+	parse_result decode(const core::byte_buffer_view& in, core::byte_buffer_view& data,
+			    std::size_t& consumed) noexcept;
+
+	body_framing framing() const noexcept { return m_framing; }
+
+	// number of body bytes decoded so far
+	uint64_t size() const noexcept { return m_size; }
+
+	// number of body bytes still to come with `body_framing::length`
+	uint64_t remaining() const noexcept { return m_remaining; }
+    };
+}
+
+#endif	// IZUMO_HTTP_BODY_HH_
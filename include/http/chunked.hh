@@ -0,0 +1,94 @@
+// http/chunked.hh -- body sent in chunks as it is produced
+#ifndef IZUMO_HTTP_CHUNKED_HH_
+#define IZUMO_HTTP_CHUNKED_HH_
+
+#include <core/coro.hh>
+#include <core/mem.hh>
+#include <core/output_queue.hh>
+
+#include <memory>
+#include <string_view>
+
+namespace izumo::http {
+    /** chunked_stream: a body of unknown length, sent with chunked coding
+     *   every write makes a chunk. its size line and CRLF are queued as
+     *   segments of their own around the data, so the data is never
+     *   copied; the write is done once the socket has taken all of it,
+     *   so the data only needs to live until then, and a slow peer holds
+     *   back the producer instead of growing the queue.
+     *
+     *   the header, queued before `start`, is sent right away but held in
+     *   a TCP_CORK until the first chunk joins it, so both leave in the
+     *   same packet; or after 200 ms when the first chunk is slow, so the
+     *   peer still learns of the response soon. the last chunk is sent
+     *   with TCP_NODELAY, so it isn't held by Nagle's algorithm waiting
+     *   for the previous one to be acked; it is unset again once the
+     *   last chunk has been taken, so later messages of the connection
+     *   are sent as before. either fails harmlessly on sockets other than
+     *   TCP.
+     *
+     *   a write that fails, or is destroyed before it's done, clears the
+     *   queue, since segments left there may refer to the stream.
+     */
+    class chunked_stream {
+    private:
+	core::output_queue& m_queue;
+	core::async_fd& m_sock;
+	bool m_corked = false;
+	bool m_queued = false;	// segments of a chunk are in the queue
+	std::size_t m_written = 0;
+	char m_size_line[24];	// of the chunk being written
+
+	core::task<int> m_drain(core::mem_pool& pool);
+	void m_uncork() noexcept;
+
+    public:
+	/** chunked_stream: stream a body to sock
+	 *   @parameters:
+	 *      queue: queue of sock, holding the header of the message
+	 *             which must ask for chunked coding; it is otherwise
+	 *             not used while streaming
+	 */
+	chunked_stream(core::output_queue& queue, core::async_fd& sock) noexcept:
+	    m_queue(queue), m_sock(sock)
+	{}
+	chunked_stream(const chunked_stream&) = delete;
+	~chunked_stream()
+	{
+	    // a write cut short leaves segments referring to this
+	    if (m_queued) m_queue.clear();
+	    m_uncork();
+	}
+
+	/** start: send what has been queued, without waiting
+	 *   @return:
+	 *      0, or -errno
+	 */
+	int start() noexcept;
+
+	/** write: send data as a chunk
+	 *   nothing is sent for empty data, which would end the body.
+	 *   @parameters:
+	 *      pool: where the coroutine frame is allocated
+	 *      owner: released once data is written
+	 *   @return:
+	 *      awaitable of 0, or -errno
+	 */
+	core::task<int> write(core::mem_pool& pool, std::string_view data,
+			      std::shared_ptr<const void> owner = {});
+
+	/** finish: send the last chunk, ending the body
+	 *   @parameters:
+	 *      trailers: trailer fields, each ending with CRLF; must stay
+	 *                valid until done
+	 *   @return:
+	 *      awaitable of 0, or -errno
+	 */
+	core::task<int> finish(core::mem_pool& pool, std::string_view trailers = {});
+
+	// number of bytes written to the socket so far
+	std::size_t written() const noexcept { return m_written; }
+    };
+}
+
+#endif	// IZUMO_HTTP_CHUNKED_HH_
@@ -0,0 +1,125 @@
+// http/header.hh -- header fields container
+#ifndef IZUMO_HTTP_HEADER_HH_
+#define IZUMO_HTTP_HEADER_HH_
+
+#include <core/mem.hh>
+
+#include <cstdint>
+#include <string_view>
+
+namespace izumo::http {
+    // header fields the server cares about; looked up in O(1)
+    enum class header_id: uint8_t {
+	other = 0,
+	host,
+	connection,
+	content_length,
+	content_type,
+	transfer_encoding,
+	te,
+	trailer,
+	upgrade,
+	expect,
+	keep_alive,
+	date,
+	server,
+	range,
+	if_range,
+	if_modified_since,
+	last_modified,
+	x_forwarded_for,
+	count_			// number of ids; not a header
+    };
+
+    /** header_id_of: classify a field name, ignoring case
+     *   @return:
+     *      id of the field, or `header_id::other` if it is not well-known
+     */
+    header_id header_id_of(std::string_view name) noexcept;
+
+    // case-insensitive hash of a field name
+    uint32_t header_hash(std::string_view name) noexcept;
+
+    /** header: header fields of a message
+     *   fields are kept in receiving order in a contiguous array allocated
+     *   from a mem_pool. name lookup ignores case and compares hashes
+     *   first; well-known fields are found through an index by id.
+     *   names and values are not copied and must outlive the container.
+     */
+    class header {
+    public:
+	struct entry {
+	    std::string_view name;
+	    std::string_view value;
+	    uint32_t hash;	// `header_hash` of name
+	    header_id id;
+	};
+
+	using const_iterator = const entry*;
+
+    private:
+	constexpr static uint32_t INITIAL_CAPACITY = 16;
+	constexpr static uint16_t NOT_FOUND = 0;
+
+	core::mem_pool* m_pool;
+	entry* m_entries = nullptr;
+	uint32_t m_size = 0;
+	uint32_t m_capacity = 0;
+
+	// 1 + position of first field of each id, or NOT_FOUND
+	uint16_t m_index[static_cast<std::size_t>(header_id::count_)] = {};
+
+	void m_grow();
+
+    public:
+	header(core::mem_pool& pool) noexcept: m_pool(&pool) {}
+	header(const header&) = delete;
+
+	/** emplace: append a field
+	 *   @parameters:
+	 *      name, value: the field; not copied
+	 */
+	void emplace(std::string_view name, std::string_view value);
+
+	/** find: first field of given name or id
+	 *   @return:
+	 *      pointer to the field, or nullptr if there is none
+	 */
+	const entry* find(header_id id) const noexcept;
+	const entry* find(std::string_view name) const noexcept;
+
+	/** find_next: next field after `prev` sharing its name
+	 *   @return:
+	 *      pointer to the field, or nullptr if there is none
+	 */
+	const entry* find_next(const entry* prev) const noexcept;
+
+	/** get: value of first field of given name or id
+	 *   @return:
+	 *      the value, or an empty string_view if there is none
+	 */
+	std::string_view
+	get(header_id id) const noexcept
+	{
+	    auto e = find(id);
+	    return e ? e->value : std::string_view();
+	}
+
+	std::string_view
+	get(std::string_view name) const noexcept
+	{
+	    auto e = find(name);
+	    return e ? e->value : std::string_view();
+	}
+
+	std::size_t size() const noexcept { return m_size; }
+	const_iterator begin() const noexcept { return m_entries; }
+	const_iterator end() const noexcept { return m_entries + m_size; }
+
+	// remove every field and forget the storage, so that the pool
+	// may be released or reset afterwards
+	void clear() noexcept;
+    };
+}
+
+#endif	// IZUMO_HTTP_HEADER_HH_
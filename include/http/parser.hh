@@ -11,12 +11,105 @@
 namespace izumo::http {
     // which way is better, exception or return value?
     struct bad_request: std::runtime_error { bad_request(): std::runtime_error("bad_request") {} };
+    struct bad_response: std::runtime_error { bad_response(): std::runtime_error("bad_response") {} };
     
+    enum class parse_result {
+	incomplete,		// more bytes are needed
+	done,			// header is completely parsed
+	error			// malformed header
+    };
+
+    // header parsing shared by request_parser and response_parser
+    class _header_parser {
+    protected:
+	enum class state {
+	    method,
+	    target,
+	    version,		// HTTP-version and CRLF of request-line
+	    status,		// HTTP-version and status code of status-line
+	    status_end,		// SP before reason phrase, or CR if there is none
+	    reason,
+	    reason_lf,
+	    field_name,
+	    field_ows,		// spaces between colon and field value
+	    field_value,
+	    field_lf,
+	    header_end,		// CRLF of the empty line
+	    done,
+	    error
+	};
+
+	state m_state;
+	std::size_t m_pos = 0;	     // offset of the next byte to examine
+	std::size_t m_mark = 0;	     // offset where current element begins
+	std::size_t m_name_end = 0;  // field name is [m_mark, m_name_end)
+	std::size_t m_value_begin = 0;
+	std::size_t m_value_end = 0;
+
+	_header_parser(state initial) noexcept: m_state(initial) {}
+
+	parse_result m_fail() noexcept;
+
+	/** m_parse_fields: go on parsing from start of field lines
+	 *   @parameters:
+	 *      p: where parsing of the start line stopped
+	 */
+	parse_result m_parse_fields(header& headers, const core::byte_buffer_view& view,
+				    unsigned char* p);
+
+    public:
+	// length of the header; valid once `parse` returns `done`
+	std::size_t consumed() const noexcept { return m_pos; }
+    };
+
+    /** request_parser: incremental request header parser
+     *   keeps its position between calls, so every byte is examined once
+     *   no matter how many pieces the header arrives in. fields of the
+     *   request are filled as soon as they are parsed and refer to the
+     *   buffer, which thus must not move until the request is served.
+     */
+    class request_parser: public _header_parser {
+    public:
+	request_parser() noexcept: _header_parser(state::method) {}
+
+	/** parse: continue parsing with more bytes received
+	 *   @parameters:
+	 *      req: request to fill
+	 *      view: bytes received so far, starting at the request-line;
+	 *            must extend the view of previous calls
+	 *   @return:
+	 *      the state of parsing
+	 */
+	parse_result parse(request& req, const core::byte_buffer_view& view);
+
+	// prepare for parsing another request
+	void reset() noexcept;
+    };
+
+    // response_parser: incremental response header parser; see request_parser
+    class response_parser: public _header_parser {
+    public:
+	response_parser() noexcept: _header_parser(state::status) {}
+
+	/** parse: continue parsing with more bytes received
+	 *   @parameters:
+	 *      res: response to fill
+	 *      view: bytes received so far, starting at the status-line;
+	 *            must extend the view of previous calls
+	 *   @return:
+	 *      the state of parsing
+	 */
+	parse_result parse(response& res, const core::byte_buffer_view& view);
+
+	// prepare for parsing another response
+	void reset() noexcept;
+    };
+
     // check if http header is completely received 
     // return the length of the header if completed, or 0 if incomplete
     std::size_t header_completed(const core::byte_buffer_view& view) noexcept;
     
-    // parse request or response
+    // parse request or response in one go
     // call these functions after `header_completed`
     void parse_request(request& req, const core::byte_buffer_view& view);
     void parse_response(response& res, const core::byte_buffer_view& view);
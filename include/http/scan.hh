@@ -0,0 +1,52 @@
+// http/scan.hh -- byte scanning kernels for http parsing
+#ifndef IZUMO_HTTP_SCAN_HH_
+#define IZUMO_HTTP_SCAN_HH_
+
+#include <cstddef>
+#include <vector>
+
+namespace izumo::http::scan {
+    using byte_t = unsigned char;
+
+    /** kernels: a set of scanning functions
+     *   each function returns pointer to the first byte in [begin, end)
+     *   matching its condition, or `end` if there is none.
+     *   vectorized kernels never read outside [begin, end).
+     */
+    struct kernels {
+	const char* name;
+
+	// first byte equal to c
+	byte_t* (*equal)(byte_t* begin, byte_t* end, byte_t c);
+	// first byte not equal to c
+	byte_t* (*not_equal)(byte_t* begin, byte_t* end, byte_t c);
+	// first byte in [lo, hi]
+	byte_t* (*in_range)(byte_t* begin, byte_t* end, byte_t lo, byte_t hi);
+	// first byte which is not a tchar (RFC 7230 3.2.6)
+	byte_t* (*not_token)(byte_t* begin, byte_t* end);
+	// first byte of "\r\n\r\n"
+	byte_t* (*header_end)(byte_t* begin, byte_t* end);
+    };
+
+    // portable implementation
+    extern const kernels scalar;
+
+    /** active: implementation the parser uses
+     *   chosen at startup among those current cpu supports, per scan by
+     *   how fast the parser runs; benchmarks may point it to another
+     *   one to compare them
+     */
+    extern const kernels* active;
+
+    /** supported: implementations supported by current cpu
+     *   for comparing them, e.g. in benchmarks
+     *   @return:
+     *      them from scalar, first, to the one `active` is chosen as, last
+     */
+    std::vector<const kernels*> supported();
+
+    // whether c is a tchar
+    bool is_tchar(byte_t c) noexcept;
+}
+
+#endif	// IZUMO_HTTP_SCAN_HH_
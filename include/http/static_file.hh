@@ -0,0 +1,132 @@
+// http/static_file.hh -- serving files from a document root
+#ifndef IZUMO_HTTP_STATIC_FILE_HH_
+#define IZUMO_HTTP_STATIC_FILE_HH_
+
+#include <core/ev_watcher.hh>
+
+#include <cstdint>
+#include <ctime>
+#include <list>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+
+namespace izumo::http {
+    /** cached_file: an opened regular file and its metadata
+     *   the fd is closed when the last reference is dropped, so a file
+     *   being sent stays usable after it is evicted or invalidated.
+     */
+    struct cached_file {
+	int fd;
+	uint64_t size;
+	std::time_t mtime;
+	std::string_view content_type;
+	char last_modified[32];	// mtime as an HTTP-date
+
+	cached_file(int fd) noexcept: fd(fd) {}
+	cached_file(const cached_file&) = delete;
+	~cached_file();
+    };
+
+    /** file_cache: LRU cache of opened files under a document root
+     *   a hit costs neither `open` nor `stat`. every cached file is
+     *   watched with inotify and dropped as soon as it is modified,
+     *   replaced or removed; the cache must be added to the ev_loop of
+     *   its thread for that to happen. a cache belongs to one thread.
+     */
+    class file_cache: public core::ev_watcher {
+    public:
+	constexpr static std::size_t DEFAULT_CAPACITY = 1024;
+
+    private:
+	struct entry {
+	    std::string path;
+	    int wd;		// inotify watch descriptor
+	    std::shared_ptr<const cached_file> file;
+	};
+
+	using lru_list = std::list<entry>;
+
+	std::string m_root;	// ends with a slash
+	std::size_t m_capacity;
+	lru_list m_lru;		// most recently used first
+	std::unordered_map<std::string_view, lru_list::iterator> m_by_path;
+	std::unordered_multimap<int, lru_list::iterator> m_by_wd;
+	std::string m_path;	// scratch space for resolving targets; also the key
+
+	bool m_resolve(std::string_view target);
+	int m_open(std::shared_ptr<const cached_file>& out);
+	void m_erase(lru_list::iterator it);
+
+    public:
+	/** @parameters:
+	 *      root: directory files are served from
+	 *      capacity: maximum number of files kept open
+	 *   @exception:
+	 *      osexception if root cannot be opened
+	 */
+	file_cache(const std::string& root, std::size_t capacity = DEFAULT_CAPACITY);
+	file_cache(const file_cache&) = delete;
+	~file_cache();
+
+	std::size_t size() const noexcept { return m_lru.size(); }
+
+	/** lookup: find the file a request target refers to
+	 *   the query is ignored and percent-encoding is decoded. targets
+	 *   ending with a slash refer to index.html of the directory.
+	 *   @parameters:
+	 *      target: request-target in origin-form
+	 *      out: set to the file on success
+	 *   @return:
+	 *      0 on success, otherwise an errno value: EINVAL for a
+	 *      malformed target or one leaving the root, EACCES for
+	 *      anything other than a regular file, or what `open` failed with
+	 */
+	int lookup(std::string_view target, std::shared_ptr<const cached_file>& out);
+
+	// drain inotify events and drop changed files
+	bool on_event(bool r, bool w) override;
+    };
+
+    // a byte range of a representation, both ends inclusive
+    struct byte_range {
+	uint64_t first;
+	uint64_t last;
+    };
+
+    enum class range_result {
+	none,			// no usable range; serve the whole representation
+	ok,
+	unsatisfiable
+    };
+
+    /** parse_range: parse a Range header value
+     *   only a single range is honored; a set of ranges is ignored,
+     *   which the RFC allows.
+     *   @parameters:
+     *      value: the header value
+     *      size: size of the representation
+     *      out: set to the range when `ok` is returned
+     */
+    range_result parse_range(std::string_view value, uint64_t size, byte_range& out) noexcept;
+
+    /** format_http_date: format a time as an IMF-fixdate
+     *   @parameters:
+     *      buf: at least 30 bytes
+     *   @return:
+     *      length of the date, not counting the terminating NUL
+     */
+    std::size_t format_http_date(std::time_t t, char* buf) noexcept;
+
+    /** parse_http_date: parse an IMF-fixdate
+     *   @return:
+     *      the time, or -1 if value is not an IMF-fixdate
+     */
+    std::time_t parse_http_date(std::string_view value) noexcept;
+
+    // media type for a path, guessed from its extension
+    std::string_view content_type_of(std::string_view path) noexcept;
+}
+
+#endif	// IZUMO_HTTP_STATIC_FILE_HH_
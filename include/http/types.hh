@@ -2,17 +2,11 @@
 #define IZUMO_HTTP_TYPES_HH_
 
 #include <core/mem.hh>
+#include <http/header.hh>
 
-#include <map>
+#include <string_view>
 
 namespace izumo::http {
-    using header = std::multimap<
-	std::string_view,
-	std::string_view,
-	std::less<std::string_view>,
-	core::mem_pool_allocator<
-	    std::pair<const std::string_view, std::string_view>>>;
-
     struct request {
 	std::string_view method;
 	std::string_view target;
@@ -20,22 +14,58 @@ namespace izumo::http {
 
 	header headers;
 
-	request(core::mem_pool& pool):
-	    headers(core::mem_pool_allocator<header::value_type>(pool))
-	{}
+	request(core::mem_pool& pool): headers(pool) {}
+
+	// forget every parsed field so the request can be parsed into again
+	void
+	clear() noexcept
+	{
+	    method = target = std::string_view();
+	    httpver_major = httpver_minor = 0;
+	    headers.clear();
+	}
     };
 
     struct response {
-	int status_code;
-	std::string_view status_message;
-	int httpver_major, httpver_minor;
+	int status_code = 200;
+	std::string_view status_message; // empty for the standard reason phrase
+	int httpver_major = 1, httpver_minor = 1;
 
 	header headers;
 
-	response(core::mem_pool& pool):
-	    headers(core::mem_pool_allocator<header::value_type>(pool))
-	{}
+	response(core::mem_pool& pool): headers(pool) {}
+
+	// forget every parsed field so the response can be parsed into again
+	void
+	clear() noexcept
+	{
+	    status_code = 200;
+	    status_message = std::string_view();
+	    httpver_major = 1;
+	    httpver_minor = 1;
+	    headers.clear();
+	}
     };
+
+    // whether the connection should persist after serving req,
+    // according to its HTTP version and `Connection` header
+    bool keep_alive(const request& req) noexcept;
+
+    // whether the connection may be reused after receiving res; see above
+    bool keep_alive(const response& res) noexcept;
+
+    /** hop_by_hop: whether a field only concerns the connection it came by
+     *   such fields are not forwarded by proxies (RFC 7230 6.1).
+     *   Content-Length and Host are kept even if named in Connection, as
+     *   dropping them would desynchronize the next hop.
+     *   @parameters:
+     *      headers: all fields of the message, for the Connection field
+     *      e: a field of headers
+     */
+    bool hop_by_hop(const header& headers, const header::entry& e) noexcept;
+
+    // whether sending a request of method twice has the effect of once
+    bool idempotent(std::string_view method) noexcept;
 }
 
 #endif	// IZUMO_HTTP_TYPES_HH_
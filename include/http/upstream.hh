@@ -0,0 +1,179 @@
+// http/upstream.hh -- HTTP/1.1 client of upstream servers
+#ifndef IZUMO_HTTP_UPSTREAM_HH_
+#define IZUMO_HTTP_UPSTREAM_HH_
+
+#include <http/parser.hh>
+#include <http/types.hh>
+#include <core/byte_buffer.hh>
+#include <core/clock.hh>
+#include <core/coro.hh>
+#include <core/ev_watcher.hh>
+#include <core/mem.hh>
+#include <core/object_pool.hh>
+
+#include <string>
+#include <string_view>
+
+#include <sys/socket.h>
+
+namespace izumo::http {
+    // where an upstream server listens
+    struct upstream_address {
+	sockaddr_storage addr;
+	socklen_t len = 0;
+    };
+
+    /** parse_upstream_address: parse where an upstream server listens
+     *   given as "unix:/path", "[v6 address]:port" or "host:port". host
+     *   names are resolved with getaddrinfo, which blocks, so it is meant
+     *   to be called on startup.
+     *   @return:
+     *      false if text is malformed or cannot be resolved
+     */
+    bool parse_upstream_address(std::string_view text, upstream_address& addr);
+
+    /** upstream_connection: a connection to an upstream server
+     *   taken by `upstream::acquire`, and given back by `upstream::release`
+     */
+    class upstream_connection {
+    public:
+	constexpr static std::size_t INITIAL_HEADER_SIZE = 4096;
+	constexpr static std::size_t MAX_HEADER_SIZE = 64 * 1024;
+
+    private:
+	friend class upstream;
+
+	core::async_fd m_sock;
+	upstream_connection* m_prev = nullptr; // idle list
+	upstream_connection* m_next = nullptr; // or in closed list
+	core::timestamp_ms_t m_idle_since = 0;
+	bool m_reused = false;
+
+    public:
+	explicit upstream_connection(int fd): m_sock(fd) {}
+
+	core::async_fd& socket() noexcept { return m_sock; }
+
+	// whether it has been idle in the pool, so upstream may have
+	// closed it meanwhile without it being noticed yet
+	bool reused() const noexcept { return m_reused; }
+
+	/** receive_head: receive a response header
+	 *   interim responses are skipped. bytes following the header are
+	 *   left in buf after `parser.consumed()`.
+	 *   @parameters:
+	 *      pool: where the coroutine frame is allocated
+	 *      res: filled with the response; fields refer to buf
+	 *      buf: receives the bytes; grown as needed
+	 *      received: set to number of bytes in buf
+	 *   @return:
+	 *      awaitable of 0, or -errno; -ECONNRESET if the connection is
+	 *      closed before anything is received
+	 */
+	core::task<int> receive_head(core::mem_pool& pool, response_parser& parser, response& res,
+				     core::byte_buffer& buf, std::size_t& received);
+    };
+
+    // a response received by `upstream::fetch`
+    struct upstream_response {
+	response res;		// fields refer to head
+	core::byte_buffer head;	// header as received
+	std::string body;	// decoded body
+
+	upstream_response(core::mem_pool& pool): res(pool) {}
+    };
+
+    /** upstream: HTTP/1.1 client of an upstream server for one thread
+     *   connections are kept alive between requests. idle ones are
+     *   reused most recent first, and closed once idle for longer than
+     *   `idle_timeout` or beyond `max_idle`, so a busy upstream rarely
+     *   costs a connect per request, and a quiet one holds no sockets.
+     *
+     *   coroutine frames of its operations come from the mem_pool given
+     *   to them; a pool reset per request, e.g. that of the request
+     *   being served, keeps them from piling up.
+     *
+     *   must only be used by the thread that created it, and every
+     *   acquired connection must be released before it is destructed.
+     *   closed connections are freed by a task posted to the loop, as the
+     *   batch being dispatched may still hold events of theirs, so it must
+     *   outlive the loop iteration in which it was last used.
+     */
+    class upstream: public core::ev_watcher {
+    public:
+	struct options {
+	    std::size_t max_idle = 32;			// idle connections kept
+	    core::timedelta_ms_t idle_timeout = 60000; // before an idle one is closed
+	    core::timedelta_ms_t timeout = 30000;	// of every wait for upstream
+	};
+
+    private:
+	struct exchange_result {
+	    int error;		// 0 or -errno
+	    bool keep_alive;	// connection may serve another request
+	    bool nothing_back;	// failed before any byte of response
+	};
+
+	upstream_address m_addr;
+	options m_options;
+	core::object_pool<upstream_connection> m_conns;
+
+	upstream_connection* m_idle = nullptr; // most recently released
+	upstream_connection* m_idle_tail = nullptr;
+	std::size_t m_idle_count = 0;
+	core::timer_id m_timer = core::NULL_TIMER; // closes expired idle ones
+
+	upstream_connection* m_closed = nullptr; // to be freed by a posted task
+	bool m_reap_posted = false;
+
+	void m_unlink(upstream_connection* c) noexcept;
+	void m_close(upstream_connection* c);
+	void m_reap() noexcept;
+	core::task<exchange_result> m_exchange(core::mem_pool& pool, upstream_connection& c,
+					       std::string_view request, upstream_response& out);
+
+    public:
+	explicit upstream(const upstream_address& addr): upstream(addr, options()) {}
+	upstream(const upstream_address& addr, const options& opts);
+	upstream(const upstream&) = delete;
+	~upstream();
+
+	/** acquire: take an idle connection, or connect a new one
+	 *   @parameters:
+	 *      pool: where the coroutine frame is allocated
+	 *      conn: set to the connection on success
+	 *   @return:
+	 *      awaitable of 0, or -errno
+	 */
+	core::task<int> acquire(core::mem_pool& pool, upstream_connection*& conn);
+
+	/** release: give back a connection taken by `acquire`
+	 *   @parameters:
+	 *      reusable: whether a whole response has been received and
+	 *                the connection persists; it is closed otherwise
+	 */
+	void release(upstream_connection* conn, bool reusable);
+
+	/** fetch: send a request and receive its whole response
+	 *   interim responses are skipped. if a reused connection turns out
+	 *   to be closed before anything is received, an idempotent request
+	 *   is sent again on a new connection.
+	 *   @parameters:
+	 *      pool: where coroutine frames are allocated
+	 *      request: serialized request, e.g. by request_writer; must
+	 *               stay valid until done
+	 *      out: receives the response
+	 *   @return:
+	 *      awaitable of 0, or -errno; -EPROTO if the response is malformed
+	 */
+	core::task<int> fetch(core::mem_pool& pool, std::string_view request, upstream_response& out);
+
+	// number of idle connections
+	std::size_t idle() const noexcept { return m_idle_count; }
+
+	bool on_event(bool, bool) override { return false; }
+	void on_timeout(core::timer_id) override;
+    };
+}
+
+#endif	// IZUMO_HTTP_UPSTREAM_HH_
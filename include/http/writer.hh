@@ -0,0 +1,88 @@
+// http/writer.hh -- response serializer
+#ifndef IZUMO_HTTP_WRITER_HH_
+#define IZUMO_HTTP_WRITER_HH_
+
+#include <http/types.hh>
+#include <core/byte_buffer.hh>
+
+#include <cstdint>
+#include <string_view>
+
+namespace izumo::http {
+    // header fields which never change, ready to be copied as a whole
+    namespace static_header {
+	constexpr std::string_view server = "Server: Izumo\r\n";
+	constexpr std::string_view content_type_text = "Content-Type: text/plain\r\n";
+	constexpr std::string_view connection_close = "Connection: close\r\n";
+	constexpr std::string_view connection_keep_alive = "Connection: keep-alive\r\n";
+	constexpr std::string_view transfer_encoding_chunked = "Transfer-Encoding: chunked\r\n";
+    }
+
+    // reason phrase of a status code, or an empty string_view if unknown
+    std::string_view reason_phrase(int status_code) noexcept;
+
+    /** message_writer: serialize a message into a byte_buffer
+     *   bytes are appended right after `pos` in place; the buffer is grown
+     *   by doubling whenever it is full, so nothing is allocated once it
+     *   has reached its working size. the buffer must not be touched by
+     *   anyone else while being written.
+     */
+    class message_writer {
+    private:
+	core::byte_buffer& m_buf;
+	std::size_t m_pos;
+
+    protected:
+	// make room for n more bytes and return where they go
+	char* m_reserve(std::size_t n);
+
+    public:
+	message_writer(core::byte_buffer& buf, std::size_t pos = 0) noexcept:
+	    m_buf(buf), m_pos(pos)
+	{}
+	message_writer(const message_writer&) = delete;
+
+	// end of written bytes in buffer
+	std::size_t size() const noexcept { return m_pos; }
+
+	// append raw bytes, e.g. a static header block or body
+	void write(std::string_view bytes);
+
+	// append a header field
+	void header(std::string_view name, std::string_view value);
+	void header(std::string_view name, uint64_t value);
+
+	// append every field of headers
+	void fields(const http::header& headers);
+
+	// append the empty line ending the header
+	void end_head() { write("\r\n"); }
+    };
+
+    // response_writer: serialize a response; see message_writer
+    class response_writer: public message_writer {
+    public:
+	using message_writer::message_writer;
+
+	// append status line of res; common ones are copied as a whole
+	void status_line(const response& res);
+
+	// append status line and every header field of res
+	void head(const response& res);
+    };
+
+    // request_writer: serialize a request; see message_writer
+    class request_writer: public message_writer {
+    public:
+	using message_writer::message_writer;
+
+	// append request line of req; always of HTTP/1.1, whose
+	// connections persist by default
+	void request_line(const request& req);
+
+	// append request line and every header field of req
+	void head(const request& req);
+    };
+}
+
+#endif	// IZUMO_HTTP_WRITER_HH_
@@ -1,15 +1,48 @@
 #include <core/byte_buffer.hh>
 #include <core/exception.hh>
+#include <core/slab.hh>
 
 #include <cstdlib>
 #include <cstring>
 #include <cassert>
 
 namespace izumo::core {
+    // allocate memory for at least size bytes
+    // return nullptr and leave capacity untouched on failure
+    static byte_t*
+    buffer_alloc(std::size_t size, std::size_t& capacity) noexcept
+    {
+	if (!size) {
+	    capacity = 0;
+	    return nullptr;
+	}
+
+	auto cls = slab_allocator::class_size(size);
+	auto ret = cls ? slab_allocator::allocate(cls) : std::malloc(size);
+	if (!ret) return nullptr;
+
+	capacity = cls ? cls : size;
+	return static_cast<byte_t*>(ret);
+    }
+
+    // malloc is only used above the largest class, so a capacity of a
+    // class size always means a slab block
+    static void
+    buffer_free(byte_t* ptr, std::size_t capacity) noexcept
+    {
+	if (!ptr) return;
+
+	if (slab_allocator::class_size(capacity) == capacity) {
+	    slab_allocator::deallocate(ptr, capacity);
+	} else {
+	    std::free(ptr);
+	}
+    }
+
     byte_buffer::byte_buffer(std::size_t initial_size)
     {
-	m_ptr = static_cast<byte_t*>(std::malloc(initial_size));
-	if (!m_ptr) throw std::bad_alloc();
+	m_ptr = buffer_alloc(initial_size, m_capacity);
+	if (!m_ptr && initial_size) throw std::bad_alloc();
 	
 	m_size = initial_size;
     }
@@ -17,26 +50,61 @@ namespace izumo::core {
     byte_buffer::byte_buffer(const byte_buffer& rhs)
     {
 	// TODO: COW
-	m_ptr = static_cast<byte_t*>(std::malloc(rhs.m_size));
-	if (!m_ptr) throw std::bad_alloc();
+	m_ptr = buffer_alloc(rhs.m_size, m_capacity);
+	if (!m_ptr && rhs.m_size) throw std::bad_alloc();
 
 	m_size = rhs.m_size;
-	std::memcpy(m_ptr, rhs.m_ptr, m_size);
+	if (m_size) std::memcpy(m_ptr, rhs.m_ptr, m_size);
     }
 
     byte_buffer::~byte_buffer()
     {
-	free(m_ptr);
+	buffer_free(m_ptr, m_capacity);
+    }
+
+    byte_buffer&
+    byte_buffer::operator=(byte_buffer&& rhs) noexcept
+    {
+	if (this == &rhs) return *this;
+
+	buffer_free(m_ptr, m_capacity);
+	m_ptr = rhs.m_ptr;
+	m_size = rhs.m_size;
+	m_capacity = rhs.m_capacity;
+	rhs.m_ptr = nullptr;
+	rhs.m_size = rhs.m_capacity = 0;
+	return *this;
     }
 
     bool
     byte_buffer::try_resize(std::size_t n) noexcept
     {
-	auto newptr = realloc(m_ptr, n);
+	if (n <= m_capacity) {
+	    m_size = n;
+	    return true;
+	}
+
+	// both large: realloc may grow in place
+	if (m_ptr && !slab_allocator::class_size(n)
+	    && slab_allocator::class_size(m_capacity) != m_capacity) {
+	    auto newptr = std::realloc(m_ptr, n);
+	    if (!newptr) return false;
+
+	    m_ptr = static_cast<byte_t*>(newptr);
+	    m_size = m_capacity = n;
+	    return true;
+	}
+
+	std::size_t capacity;
+	auto newptr = buffer_alloc(n, capacity);
 	if (!newptr) return false;
 
+	if (m_size) std::memcpy(newptr, m_ptr, m_size);
+	buffer_free(m_ptr, m_capacity);
+
+	m_ptr = newptr;
 	m_size = n;
-	m_ptr = static_cast<byte_t*>(newptr);
+	m_capacity = capacity;
 	return true;
     }
 
@@ -88,6 +156,6 @@ namespace izumo::core {
     byte_buffer_view::operator std::string_view() const noexcept
     {
 	auto ptr = static_cast<std::string_view::value_type*>(data());
-	return std::string_view(ptr, m_end);
+	return std::string_view(ptr, size());
     }
 }
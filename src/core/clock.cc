@@ -1,13 +1,29 @@
 #include <core/clock.hh>
 
-#include <chrono>
+#include <time.h>
 
 namespace izumo::core {
+    // clock_gettime of CLOCK_MONOTONIC is served by the vDSO without a
+    // syscall. CLOCK_MONOTONIC_COARSE is cheaper still, but lags by up
+    // to a jiffy, which makes a loop wake up before its timers are due
+    // and spin until the clock catches up
+    static inline timestamp_ns_t
+    monotonic_ns() noexcept
+    {
+	timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return static_cast<timestamp_ns_t>(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+    }
+
     timestamp_ms_t
-    clock::now()
+    clock::now() noexcept
+    {
+	return monotonic_ns() / 1000000;
+    }
+
+    timestamp_ns_t
+    clock::now_ns() noexcept
     {
-	auto stdnow = std::chrono::high_resolution_clock::now();
-	auto ts = stdnow.time_since_epoch();
-	return std::chrono::duration_cast<std::chrono::milliseconds>(ts).count();
+	return monotonic_ns();
     }
 }
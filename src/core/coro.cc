@@ -0,0 +1,307 @@
+#include <core/coro.hh>
+#include <core/input_buffer.hh>
+
+#include <cassert>
+#include <cerrno>
+#include <new>
+
+#include <unistd.h>
+
+namespace izumo::core {
+    _io_wait::~_io_wait()
+    {
+	// destroyed while suspended, along with the frame of its coroutine
+	if (!m_handle) return;
+
+	auto& slot = m_write ? m_fd.m_writer : m_fd.m_reader;
+	if (slot != this) return;
+
+	slot = nullptr;
+	if (m_timer != NULL_TIMER) ev_loop::instance().cancel_timer(m_timer);
+	m_fd.m_update_interest();
+    }
+
+    void
+    _io_wait::await_suspend(std::coroutine_handle<> h)
+    {
+	auto& slot = m_write ? m_fd.m_writer : m_fd.m_reader;
+	assert(!slot);
+
+	m_handle = h;
+	slot = this;
+	if (m_fd.m_timeout > 0) m_timer = ev_loop::instance().add_timer(m_fd, m_fd.m_timeout);
+	m_fd.m_update_interest();
+    }
+
+    async_fd::async_fd(int fd): ev_watcher(fd)
+    {
+	ev_loop::instance().add_watcher(*this, EV_RDHUP);
+    }
+
+    async_fd::~async_fd()
+    {
+	ev_loop::instance().remove_watcher(*this);
+	close(m_fd);
+    }
+
+    void
+    async_fd::m_update_interest()
+    {
+	// receiving through the loop, readers wait for bytes, and the end
+	// of stream comes after them rather than with an edge of its own
+	ev_interest interest = m_sink ? 0 : EV_RDHUP;
+	if (m_reader && !m_sink) interest |= EV_READ;
+	if (m_writer) interest |= EV_WRITE;
+	ev_loop::instance().modify_watcher(*this, interest);
+
+	m_update_receiving();
+    }
+
+    void
+    async_fd::m_update_receiving()
+    {
+	if (!m_sink || m_eof || m_recv_error) return;
+
+	auto wanted = m_reader || m_sink->size() < RECEIVE_AHEAD;
+	if (wanted && !m_receiving) {
+	    m_receiving = ev_loop::instance().recv_multishot(*this);
+	} else if (!wanted && m_receiving && !m_pausing) {
+	    m_pausing = true;
+	    ev_loop::instance().cancel_recv(*this);
+	}
+    }
+
+    bool
+    async_fd::receive_into(input_buffer& in)
+    {
+	m_sink = &in;
+	m_update_receiving();
+	if (!m_receiving) {
+	    m_sink = nullptr;
+	    return false;
+	}
+
+	m_update_interest();
+	return true;
+    }
+
+    bool
+    async_fd::on_event(bool r, bool w)
+    {
+	// a resumed coroutine may destroy this, so every finished
+	// operation is taken off before any is resumed
+	_io_wait* done[2];
+	std::size_t n = 0;
+	if (r && m_reader && m_reader->m_attempt()) done[n++] = std::exchange(m_reader, nullptr);
+	if (w && m_writer && m_writer->m_attempt()) done[n++] = std::exchange(m_writer, nullptr);
+	if (!n) return false;
+
+	std::coroutine_handle<> handles[2];
+	for (std::size_t i = 0; i < n; ++i) {
+	    if (done[i]->m_timer != NULL_TIMER) ev_loop::instance().cancel_timer(done[i]->m_timer);
+	    handles[i] = std::exchange(done[i]->m_handle, nullptr);
+	}
+	m_update_interest();
+
+	for (std::size_t i = 0; i < n; ++i) handles[i].resume();
+	return false;
+    }
+
+    void
+    async_fd::on_received(byte_buffer& block, ssize_t n, bool more)
+    {
+	if (!more) m_receiving = m_pausing = false;
+
+	// a pause, or the loop running out of blocks for a moment, only
+	// stops receiving until `m_update_receiving` starts it again
+	if (n > 0) {
+	    m_sink->append(block, n);
+	    m_received += n;
+	} else if (n == 0) {
+	    m_eof = true;
+	} else if (n != -ECANCELED && n != -ENOBUFS) {
+	    m_recv_error = n;
+	}
+
+	// resuming the reader may destroy this
+	if (m_reader && m_recv_pending()) {
+	    on_event(true, false);
+	} else {
+	    m_update_receiving();
+	}
+    }
+
+    void
+    async_fd::on_timeout(timer_id id)
+    {
+	_io_wait* wait = nullptr;
+	if (m_reader && m_reader->m_timer == id) {
+	    wait = std::exchange(m_reader, nullptr);
+	} else if (m_writer && m_writer->m_timer == id) {
+	    wait = std::exchange(m_writer, nullptr);
+	} else {
+	    return;
+	}
+
+	wait->m_timer = NULL_TIMER;
+	wait->m_ret = -ETIMEDOUT;
+	m_update_interest();
+	std::exchange(wait->m_handle, nullptr).resume();
+    }
+
+    bool
+    _recv_wait::m_attempt() noexcept
+    {
+	while (true) {
+	    auto ret = recv(m_fd.fd(), m_buf, m_len, 0);
+	    if (ret >= 0) {
+		m_ret = ret;
+		return true;
+	    }
+
+	    if (errno == EINTR) continue;
+	    if (errno == EAGAIN || errno == EWOULDBLOCK) return false;
+
+	    m_ret = -errno;
+	    return true;
+	}
+    }
+
+    bool
+    _recv_into_wait::m_attempt() noexcept
+    {
+	if (m_fd.m_sink) {
+	    assert(m_fd.m_sink == &m_in);
+
+	    if (m_fd.m_received) {
+		m_ret = std::exchange(m_fd.m_received, 0);
+	    } else if (m_fd.m_recv_error) {
+		m_ret = m_fd.m_recv_error;
+	    } else if (m_fd.m_eof) {
+		m_ret = 0;
+	    } else {
+		return false;
+	    }
+
+	    if (m_drained) *m_drained = true;
+	    return true;
+	}
+
+	while (true) {
+	    byte_buffer_view room;
+	    try {
+		room = m_in.prepare();
+	    } catch (const std::bad_alloc&) {
+		m_ret = -ENOMEM;
+		return true;
+	    }
+
+	    auto ret = recv(m_fd.fd(), room.ptr(), room.size(), 0);
+	    if (ret >= 0) {
+		m_in.commit(ret);
+		m_ret = ret;
+		if (m_drained) *m_drained = static_cast<std::size_t>(ret) < room.size();
+		return true;
+	    }
+
+	    if (errno == EINTR) continue;
+	    if (errno == EAGAIN || errno == EWOULDBLOCK) return false;
+
+	    m_ret = -errno;
+	    return true;
+	}
+    }
+
+    bool
+    _send_wait::m_attempt() noexcept
+    {
+	while (m_sent < m_len) {
+	    auto ret = send(m_fd.fd(), m_buf + m_sent, m_len - m_sent, MSG_NOSIGNAL);
+	    if (ret >= 0) {
+		m_sent += ret;
+		continue;
+	    }
+
+	    if (errno == EINTR) continue;
+	    if (errno == EAGAIN || errno == EWOULDBLOCK) return false;
+
+	    m_ret = -errno;
+	    return true;
+	}
+
+	m_ret = m_sent;
+	return true;
+    }
+
+    bool
+    _accept_wait::m_attempt() noexcept
+    {
+	while (true) {
+	    auto ret = accept4(m_fd.fd(), m_addr, m_addrlen, SOCK_NONBLOCK);
+	    if (ret >= 0) {
+		m_ret = ret;
+		return true;
+	    }
+
+	    if (errno == EINTR) continue;
+	    if (errno == EAGAIN || errno == EWOULDBLOCK) return false;
+
+	    m_ret = -errno;
+	    return true;
+	}
+    }
+
+    bool
+    _connect_wait::m_attempt() noexcept
+    {
+	if (!std::exchange(m_started, true)) {
+	    if (connect(m_fd.fd(), m_addr, m_addrlen) == 0) {
+		m_ret = 0;
+		return true;
+	    }
+
+	    // an interrupted connect goes on in background as well
+	    if (errno == EINPROGRESS || errno == EINTR) return false;
+
+	    m_ret = -errno;
+	    return true;
+	}
+
+	// the connection is either established or failed now
+	int err = 0;
+	socklen_t len = sizeof(err);
+	if (getsockopt(m_fd.fd(), SOL_SOCKET, SO_ERROR, &err, &len) < 0) err = errno;
+
+	m_ret = -err;
+	return true;
+    }
+
+    bool
+    _edge_wait::m_attempt() noexcept
+    {
+	// receiving through the loop, bytes having arrived are the edge
+	if (!m_write && m_fd.m_sink) return m_fd.m_recv_pending();
+
+	// first called before suspending, then on the edge
+	return std::exchange(m_waited, true);
+    }
+
+    _sleep_wait::~_sleep_wait()
+    {
+	if (m_timer != NULL_TIMER) ev_loop::instance().cancel_timer(m_timer);
+    }
+
+    void
+    _sleep_wait::await_suspend(std::coroutine_handle<> h)
+    {
+	m_handle = h;
+	m_timer = ev_loop::instance().add_timer(*this, m_timeout);
+    }
+
+    void
+    _sleep_wait::on_timeout(timer_id)
+    {
+	m_timer = NULL_TIMER;
+	m_handle.resume();
+    }
+}
@@ -1,10 +1,13 @@
 #include <core/ev_loop.hh>
 #include <core/exception.hh>
 #include <core/clock.hh>
+#include <core/metrics.hh>
 
 #include <sys/epoll.h>
+#include <sys/eventfd.h>
 #include <errno.h>
 #include <unistd.h>
+#include <memory>
 #include <vector>
 #include <queue>
 #include <cassert>
@@ -14,11 +17,184 @@
 
 IMPL_MAP_DEF;
 
+static std::string _ev_loop_default_impl = IZM_EVLOOP_DEFAULT_IMPL;
+
 namespace izumo::core {
+    static auto _ev_loop_iterations = metrics_registry::instance().add_counter(
+	"izumo_loop_iterations_total", "Iterations of every ev_loop");
+    static auto _ev_loop_events = metrics_registry::instance().add_counter(
+	"izumo_loop_events_total", "I/O events dispatched to watchers");
+    static auto _ev_loop_timers = metrics_registry::instance().add_counter(
+	"izumo_loop_timers_fired_total", "Timers fired");
+
+    void
+    ev_loop::m_account(std::size_t events, std::size_t timers)
+    {
+	_ev_loop_iterations.inc();
+	if (events) _ev_loop_events.inc(events);
+	if (timers) _ev_loop_timers.inc(timers);
+    }
+
+    ev_loop::remote_watcher::remote_watcher(ev_loop& loop):
+	ev_watcher(eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)), m_loop(loop)
+    {
+	if (m_fd < 0) throw osexception();
+    }
+
+    ev_loop::remote_watcher::~remote_watcher()
+    {
+	auto t = m_head.exchange(nullptr, std::memory_order_acquire);
+	while (t) {
+	    auto next = t->m_next;
+	    t->drop();
+	    t = next;
+	}
+
+	close(m_fd);
+    }
+
+    void
+    ev_loop::remote_watcher::push(post_node& node) noexcept
+    {
+	node.m_next = m_head.load(std::memory_order_relaxed);
+	while (!m_head.compare_exchange_weak(node.m_next, &node, std::memory_order_release,
+					     std::memory_order_relaxed));
+
+	// the loop is woken already unless the stack was empty
+	if (node.m_next) return;
+
+	std::uint64_t val = 1;
+	auto ret = write(m_fd, &val, sizeof(val));
+	(void)ret;		// can only fail when the counter overflows
+    }
+
+    // a function posted from another thread, in a node of its own
+    class function_node: public post_node {
+    private:
+	std::function<void()> m_fn;
+
+    public:
+	function_node(std::function<void()>&& fn): m_fn(std::move(fn)) {}
+
+	void
+	run() override
+	{
+	    std::unique_ptr<function_node> self(this);
+	    m_fn();
+	}
+
+	void drop() noexcept override { delete this; }
+    };
+
+    void
+    ev_loop::remote_watcher::push(std::function<void()>&& fn)
+    {
+	push(*new function_node(std::move(fn)));
+    }
+
+    bool
+    ev_loop::remote_watcher::on_event(bool r, bool)
+    {
+	if (!r) return false;
+
+	// the counter is reset before taking tasks, so a task pushed
+	// after that wakes the loop again
+	std::uint64_t val;
+	auto ret = read(m_fd, &val, sizeof(val));
+	(void)ret;
+
+	// the stack is newest first; reverse it to posting order
+	post_node* t = nullptr;
+	auto head = m_head.exchange(nullptr, std::memory_order_acquire);
+	while (head) {
+	    auto next = head->m_next;
+	    head->m_next = t;
+	    t = head;
+	    head = next;
+	}
+
+	// a pointer fits in std::function without allocating
+	while (t) {
+	    auto next = t->m_next;
+	    m_loop.m_tasks.push_back([t] { t->run(); });
+	    t = next;
+	}
+
+	return false;
+    }
+
+    void
+    ev_loop::modify_watcher(ev_watcher& watcher, ev_interest interest)
+    {
+	// epoll can't modify exclusive registrations
+	if ((watcher.m_interest | interest) & EV_EXCLUSIVE) throw osexception(EINVAL);
+
+	watcher.m_interest = interest;
+	if (watcher.m_dirty != ev_watcher::NOT_DIRTY) return;
+
+	watcher.m_dirty = m_dirty.size();
+	m_dirty.push_back(&watcher);
+    }
+
+    void
+    ev_loop::m_apply_interest()
+    {
+	for (std::size_t i = 0; i < m_dirty.size(); ++i) {
+	    auto w = m_dirty[i];
+	    if (!w) continue;	// removed since
+
+	    w->m_dirty = ev_watcher::NOT_DIRTY;
+	    if (w->m_interest == w->m_armed) continue;
+
+	    w->m_armed = w->m_interest;
+	    m_rearm(*w, w->m_interest);
+	}
+
+	m_dirty.clear();
+    }
+
+    void
+    ev_loop::m_forget(ev_watcher& watcher) noexcept
+    {
+	if (watcher.m_dirty != ev_watcher::NOT_DIRTY) {
+	    m_dirty[watcher.m_dirty] = nullptr;
+	    watcher.m_dirty = ev_watcher::NOT_DIRTY;
+	}
+
+	if (!watcher.m_deferred) return;
+
+	// rare and the list is short, so it's walked
+	auto p = &m_deferred_head;
+	while (*p != &watcher) p = &(*p)->m_next_deferred;
+	*p = watcher.m_next_deferred;
+	if (m_deferred_tail == &watcher.m_next_deferred) m_deferred_tail = p;
+	watcher.m_deferred = false;
+    }
+
+    void
+    ev_loop::m_run_pending()
+    {
+	while (m_deferred_head) {
+	    auto w = m_deferred_head;
+	    m_deferred_head = w->m_next_deferred;
+	    if (!m_deferred_head) m_deferred_tail = &m_deferred_head;
+
+	    w->m_deferred = false;
+	    w->on_deferred();
+	}
+
+	if (m_tasks.empty()) return;
+
+	m_running_tasks.swap(m_tasks);
+	for (auto& task: m_running_tasks) task();
+	m_running_tasks.clear();
+    }
+
     void
     ev_loop::run_forever()
     {
-	while(true) {
+	m_stopped = false;
+	while(!m_stopped) {
 	    this->run_once();
 	}
     }
@@ -29,6 +205,16 @@ namespace izumo::core {
 #if !defined (IZM_HAVE_EPOLL)
 #error "XXX: only epoll is supported now"
 #endif
-	return _ev_loop_get_impl_instance(IZM_EVLOOP_DEFAULT_IMPL);
+	static thread_local ev_loop& ret = _ev_loop_get_impl_instance(_ev_loop_default_impl);
+	return ret;
+    }
+
+    bool
+    ev_loop::set_default_impl(const std::string& name)
+    {
+	if (_ev_loop_impl_map.find(name) == _ev_loop_impl_map.end()) return false;
+
+	_ev_loop_default_impl = name;
+	return true;
     }
 }
@@ -1,6 +1,7 @@
 #include <core/ev_loop.hh>
 
 #include <cassert>
+#include <string>
 #include <unordered_map>
 
 using _ev_loop_get_impl_t = izumo::core::ev_loop& (*)();
@@ -39,3 +40,4 @@ _ev_loop_get_impl_instance(const std::string& name)
     assert(_ev_loop_impl_map.find(name) != _ev_loop_impl_map.end());
     return _ev_loop_impl_map[name]();
 }
+
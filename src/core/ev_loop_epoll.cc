@@ -1,7 +1,9 @@
 #include <core/ev_loop.hh>
 #include <core/exception.hh>
+#include <core/timer_wheel.hh>
 
-#include <queue>
+#include <climits>
+#include <vector>
 
 #include <unistd.h>
 #include <sys/epoll.h>
@@ -9,34 +11,29 @@
 #include "ev_loop.in.cc"
 
 namespace izumo::core {
-    struct timeout_queue_entry {
-	uint64_t deadline;
-	ev_watcher* watcher;
-    };
-    
-    constexpr static auto timeout_queue_cmp = [](const timeout_queue_entry& a, const timeout_queue_entry& b)
-    {
-	return a.deadline > b.deadline;
-    };
-
-    using timeout_queue_t = std::priority_queue<timeout_queue_entry,
-						std::vector<timeout_queue_entry>,
-						decltype(timeout_queue_cmp)>;
-    
     class ev_loop_epoll : public ev_loop {
+	constexpr static std::size_t MIN_EVENTS = 128;
+	constexpr static std::size_t MAX_EVENTS = 8192;
+
 	int m_epfd;
-	timeout_queue_t m_timeout_queue = timeout_queue_t(timeout_queue_cmp);
-    
-	uint64_t m_next_timer_id = 0;
+	timer_wheel m_timers = timer_wheel(now());
+
+	// grows while epoll_wait keeps filling it
+	std::vector<epoll_event> m_events = std::vector<epoll_event>(MIN_EVENTS);
+
+    protected:
+	void m_rearm(ev_watcher &watcher, ev_interest interest) override;
   
     public:
 	ev_loop_epoll();
 	~ev_loop_epoll();
   
-	void add_watcher(ev_watcher &watcher) override;
+	void add_watcher(ev_watcher &watcher, ev_interest interest) override;
 	void remove_watcher(ev_watcher &watcher) override;
     
-	void add_timer(ev_watcher &watcher, timedelta_ms_t timeout) override;
+	timer_id add_timer(ev_watcher &watcher, timedelta_ms_t timeout) override;
+	bool cancel_timer(timer_id id) override;
+	bool reschedule_timer(timer_id id, timedelta_ms_t timeout) override;
 
 	void run_once() override;
     };
@@ -48,21 +45,45 @@ namespace izumo::core {
 	}
 
 	m_epfd = epfd;
+	add_watcher(m_remote_watcher(), EV_READ);
     }
 
     ev_loop_epoll::~ev_loop_epoll() { close(m_epfd); }
 
-    void ev_loop_epoll::add_watcher(ev_watcher &watcher) {
+    static uint32_t epoll_events_of(ev_interest interest) {
+	uint32_t ret = EPOLLET;
+	if (interest & EV_READ) ret |= EPOLLIN;
+	if (interest & EV_WRITE) ret |= EPOLLOUT;
+	if (interest & EV_RDHUP) ret |= EPOLLRDHUP;
+	if (interest & EV_EXCLUSIVE) ret |= EPOLLEXCLUSIVE;
+	return ret;
+    }
+
+    void ev_loop_epoll::add_watcher(ev_watcher &watcher, ev_interest interest) {
 	epoll_event ev;
-	ev.events = EPOLLIN | EPOLLOUT | EPOLLET;
+	ev.events = epoll_events_of(interest);
 	ev.data.ptr = &watcher;
 
 	if (epoll_ctl(m_epfd, EPOLL_CTL_ADD, watcher.fd(), &ev) < 0) {
 	    throw osexception();
 	}
+	m_arm(watcher, interest);
+    }
+
+    void ev_loop_epoll::m_rearm(ev_watcher &watcher, ev_interest interest) {
+	epoll_event ev;
+	ev.events = epoll_events_of(interest);
+	ev.data.ptr = &watcher;
+
+	if (epoll_ctl(m_epfd, EPOLL_CTL_MOD, watcher.fd(), &ev) < 0) {
+	    throw osexception();
+	}
     }
 
     void ev_loop_epoll::remove_watcher(ev_watcher &watcher) {
+	m_timers.cancel_all(watcher);
+	m_forget(watcher);
+
 	// for portability before 2.6.9
 	epoll_event ev;
 
@@ -73,57 +94,55 @@ namespace izumo::core {
 	}
     }
 
-    void ev_loop_epoll::add_timer(ev_watcher &watcher, timedelta_ms_t timeout) {
-	timeout_queue_entry entry;
-	entry.deadline = clock::now() + timeout;
-	entry.watcher = &watcher;
+    timer_id ev_loop_epoll::add_timer(ev_watcher &watcher, timedelta_ms_t timeout) {
+	return m_timers.add(watcher, now() + timeout);
+    }
+
+    bool ev_loop_epoll::cancel_timer(timer_id id) {
+	return m_timers.cancel(id);
+    }
 
-	this->m_timeout_queue.push(entry);
+    bool ev_loop_epoll::reschedule_timer(timer_id id, timedelta_ms_t timeout) {
+	return m_timers.reschedule(id, now() + timeout);
     }
 
     void ev_loop_epoll::run_once() {
-	epoll_event evs[128];
-
-	int timeout = -1;
-	if (m_timeout_queue.size() != 0) {
-	    auto now = clock::now();
-	    timeout = std::max(static_cast<int>(m_timeout_queue.top().deadline) -
-			       static_cast<int>(now),
-			       0);
-	}
-    
-	int ret = epoll_wait(m_epfd, evs, 128, timeout);
+	// timeout is -1 or non-negative; clamp it before narrowing to int
+	auto timeout = m_has_pending() ? 0 : m_timers.next_timeout(now());
+	if (timeout > INT_MAX) timeout = INT_MAX;
+
+	m_apply_interest();
+	int ret = epoll_wait(m_epfd, m_events.data(), m_events.size(), static_cast<int>(timeout));
+	m_update_now();
 
 	if (ret < 0) {
 	    if (errno != EINTR)
 		throw osexception();
+	    m_account(0, 0);
 	    return;
 	}
 
 	// timer events
-	auto now = clock::now();
-	while (m_timeout_queue.size() && m_timeout_queue.top().deadline <= now) {
-	    auto &top = m_timeout_queue.top();
-	    top.watcher->on_timeout();
-	    m_timeout_queue.pop();
-	}
-
-	ev_watcher *defers[128];
-	std::size_t defers_count = 0;
+	auto fired = m_timers.expire(now());
+	m_account(ret, fired);
 
 	for (int i = 0; i < ret; ++i) {
-	    auto &ev = evs[i];
+	    auto &ev = m_events[i];
 	    auto w = static_cast<ev_watcher *>(ev.data.ptr);
-	    auto do_defer = w->on_event(ev.events & EPOLLIN, ev.events & EPOLLOUT);
+	    if (ev.events & EPOLLRDHUP) m_set_hangup(*w);
 
-	    if (do_defer) {
-		defers[defers_count++] = w;
+	    // e.g. a refused connect reports no EPOLLOUT
+	    auto failed = ev.events & (EPOLLERR | EPOLLHUP);
+	    if (w->on_event((ev.events & EPOLLIN) || failed, (ev.events & EPOLLOUT) || failed)) {
+		m_defer(*w);
 	    }
 	}
 
-	for (std::size_t i = 0; i < defers_count; ++i) {
-	    auto w = defers[i];
-	    w->on_deferred();
+	m_run_pending();
+
+	// a full batch means more events may be waiting
+	if (static_cast<std::size_t>(ret) == m_events.size() && m_events.size() < MAX_EVENTS) {
+	    m_events.resize(m_events.size() * 2);
 	}
     }
 }
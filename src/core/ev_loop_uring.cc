@@ -0,0 +1,658 @@
+#include <buildconfig.h>
+
+#if defined (IZM_HAVE_IO_URING)
+
+#include <core/ev_loop.hh>
+#include <core/byte_buffer.hh>
+#include <core/exception.hh>
+#include <core/input_buffer.hh>
+#include <core/timer_wheel.hh>
+
+#include <cerrno>
+#include <cstring>
+#include <vector>
+
+#include <poll.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+
+// defined by linux/fs.h, which clashes with input_buffer::BLOCK_SIZE
+#undef BLOCK_SIZE
+
+#include "ev_loop.in.cc"
+
+namespace izumo::core {
+    // glibc provides no wrapper for io_uring syscalls
+    static int
+    sys_io_uring_setup(unsigned entries, io_uring_params* p)
+    {
+	return syscall(__NR_io_uring_setup, entries, p);
+    }
+
+    static int
+    sys_io_uring_enter(int fd, unsigned to_submit, unsigned min_complete,
+		       unsigned flags, void* arg, std::size_t argsz)
+    {
+	return syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, arg, argsz);
+    }
+
+    static int
+    sys_io_uring_register(int fd, unsigned opcode, void* arg, unsigned nr_args)
+    {
+	return syscall(__NR_io_uring_register, fd, opcode, arg, nr_args);
+    }
+
+    /* ev_loop_uring: io_uring based ev_loop
+     *   every watcher is armed once with a multishot poll, which posts a
+     *   completion on each state change just like EPOLLET. all pending
+     *   submissions of an iteration are flushed by the same io_uring_enter
+     *   that waits for completions, so an iteration costs one syscall.
+     *
+     *   listening sockets accept with a multishot accept, and sockets
+     *   receive with a multishot recv, so that connections and requests
+     *   arrive with that io_uring_enter and no syscall of their own;
+     *   answering a request takes the sendmsg of its writer. bytes are
+     *   received into blocks of a provided buffer ring, which the kernel
+     *   picks from once they arrive. a block is handed over to the
+     *   watcher and replaced in the ring by a new one, so the kernel never
+     *   writes to memory of a watcher, however long it waits or wherever
+     *   it has gone. both need linux 6.0; before that, watchers accept
+     *   and receive on readable edges as with epoll.
+     *
+     *   completions carry a token of (generation << 32 | op << 30 | slot)
+     *   instead of the watcher pointer, so that completions of a removed
+     *   watcher still in flight are recognized and dropped, and blocks
+     *   they carry put back into the ring. changing interest replaces the
+     *   poll under a new generation the same way.
+     *
+     *   polls can't be exclusive, so EV_EXCLUSIVE is ignored.
+     */
+    class ev_loop_uring : public ev_loop {
+	constexpr static unsigned QUEUE_DEPTH = 256;
+	constexpr static unsigned COMPLETION_DEPTH = 4096; // multishot ops post many
+	constexpr static unsigned RECV_BLOCKS = 512;	   // in the buffer ring; a power of 2
+	constexpr static uint16_t RECV_GROUP = 0;	   // buffer group of the ring
+	constexpr static uint64_t NULL_TOKEN = ~uint64_t(0);
+	constexpr static uint32_t MAX_SLOTS = uint32_t(1) << 30;
+
+	// operations of a watcher, each with a generation of its own
+	enum op: uint32_t { OP_POLL, OP_ACCEPT, OP_RECV, OPS };
+
+	struct slot {
+	    ev_watcher* watcher = nullptr;
+	    uint32_t generations[OPS] = {};
+	    uint32_t events = 0; // poll events to arm with
+	    bool accepting = false;
+	    bool receiving = false;
+	};
+
+	int m_ring_fd;
+
+	// submission queue
+	void* m_sq_ring = nullptr;
+	std::size_t m_sq_ring_size = 0;
+	unsigned* m_sq_head;
+	unsigned* m_sq_tail;
+	unsigned m_sq_mask;
+	unsigned* m_sq_array;
+	io_uring_sqe* m_sqes = nullptr;
+	std::size_t m_sqes_size = 0;
+	unsigned m_sq_pending = 0; // sqes filled but not yet submitted
+
+	// completion queue
+	void* m_cq_ring = nullptr;
+	std::size_t m_cq_ring_size = 0;
+	unsigned* m_cq_head;
+	unsigned* m_cq_tail;
+	unsigned m_cq_mask;
+	io_uring_cqe* m_cqes;
+
+	// provided buffer ring; null if multishot accept and recv can't be used
+	io_uring_buf_ring* m_buf_ring = nullptr;
+	std::size_t m_buf_ring_size = 0;
+	uint16_t m_buf_tail = 0;
+	std::vector<byte_buffer> m_blocks; // by buffer id
+
+	std::vector<slot> m_slots;
+	std::vector<uint32_t> m_free_slots;
+	std::unordered_map<ev_watcher*, uint32_t> m_slot_of;
+
+	timer_wheel m_timers = timer_wheel(now());
+
+	io_uring_sqe* m_get_sqe();
+	void m_submit(unsigned wait_nr, timedelta_ms_t timeout);
+	void m_setup_buffers();
+	void m_provide(uint16_t bid) noexcept;
+	void m_arm_poll(uint32_t index);
+	void m_remove_poll(uint32_t index);
+	void m_arm_accept(uint32_t index);
+	void m_arm_recv(uint32_t index);
+	void m_cancel(uint32_t index, op o);
+	bool m_complete_poll(uint32_t index, const io_uring_cqe& cqe);
+	bool m_complete_accept(uint32_t index, const io_uring_cqe& cqe);
+	bool m_complete_recv(uint32_t index, const io_uring_cqe& cqe);
+
+	static uint32_t
+	m_poll_events(ev_interest interest) noexcept
+	{
+	    uint32_t ret = 0;
+	    if (interest & EV_READ) ret |= POLLIN;
+	    if (interest & EV_WRITE) ret |= POLLOUT;
+	    if (interest & EV_RDHUP) ret |= POLLRDHUP;
+	    return ret;
+	}
+
+	// whether an operation failing with err may succeed if retried
+	static bool
+	m_transient(int err) noexcept
+	{
+	    return err == -ECANCELED || err == -EAGAIN || err == -EINTR || err == -ENOMEM;
+	}
+
+	uint64_t
+	m_token(uint32_t index, op o) const noexcept
+	{
+	    return (static_cast<uint64_t>(m_slots[index].generations[o]) << 32)
+		| (static_cast<uint64_t>(o) << 30) | index;
+	}
+
+    protected:
+	void m_rearm(ev_watcher &watcher, ev_interest interest) override;
+
+    public:
+	ev_loop_uring();
+	~ev_loop_uring();
+
+	void add_watcher(ev_watcher &watcher, ev_interest interest) override;
+	void remove_watcher(ev_watcher &watcher) override;
+
+	bool accept_multishot(ev_watcher& watcher) override;
+	bool recv_multishot(ev_watcher& watcher) override;
+	void cancel_recv(ev_watcher& watcher) override;
+
+	timer_id add_timer(ev_watcher &watcher, timedelta_ms_t timeout) override;
+	bool cancel_timer(timer_id id) override;
+	bool reschedule_timer(timer_id id, timedelta_ms_t timeout) override;
+
+	void run_once() override;
+    };
+
+    ev_loop_uring::ev_loop_uring()
+    {
+	io_uring_params params;
+	std::memset(&params, 0, sizeof(params));
+	params.flags = IORING_SETUP_CQSIZE;
+	params.cq_entries = COMPLETION_DEPTH;
+
+	int fd = sys_io_uring_setup(QUEUE_DEPTH, &params);
+	if (fd < 0) throw osexception();
+	m_ring_fd = fd;
+
+	// a single io_uring_enter both submitting and waiting with a
+	// timeout requires IORING_FEAT_EXT_ARG (linux 5.11)
+	if (!(params.features & IORING_FEAT_EXT_ARG)) {
+	    close(m_ring_fd);
+	    throw osexception(ENOSYS);
+	}
+
+	m_sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+	m_cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+	if (params.features & IORING_FEAT_SINGLE_MMAP) {
+	    m_sq_ring_size = m_cq_ring_size = std::max(m_sq_ring_size, m_cq_ring_size);
+	}
+
+	m_sq_ring = mmap(nullptr, m_sq_ring_size, PROT_READ | PROT_WRITE,
+			 MAP_SHARED | MAP_POPULATE, m_ring_fd, IORING_OFF_SQ_RING);
+	if (m_sq_ring == MAP_FAILED) {
+	    int errsv = errno;
+	    close(m_ring_fd);
+	    throw osexception(errsv);
+	}
+
+	if (params.features & IORING_FEAT_SINGLE_MMAP) {
+	    m_cq_ring = m_sq_ring;
+	} else {
+	    m_cq_ring = mmap(nullptr, m_cq_ring_size, PROT_READ | PROT_WRITE,
+			     MAP_SHARED | MAP_POPULATE, m_ring_fd, IORING_OFF_CQ_RING);
+	    if (m_cq_ring == MAP_FAILED) {
+		int errsv = errno;
+		munmap(m_sq_ring, m_sq_ring_size);
+		close(m_ring_fd);
+		throw osexception(errsv);
+	    }
+	}
+
+	m_sqes_size = params.sq_entries * sizeof(io_uring_sqe);
+	auto sqes = mmap(nullptr, m_sqes_size, PROT_READ | PROT_WRITE,
+			 MAP_SHARED | MAP_POPULATE, m_ring_fd, IORING_OFF_SQES);
+	if (sqes == MAP_FAILED) {
+	    int errsv = errno;
+	    if (m_cq_ring != m_sq_ring) munmap(m_cq_ring, m_cq_ring_size);
+	    munmap(m_sq_ring, m_sq_ring_size);
+	    close(m_ring_fd);
+	    throw osexception(errsv);
+	}
+	m_sqes = static_cast<io_uring_sqe*>(sqes);
+
+	auto sq = static_cast<char*>(m_sq_ring);
+	m_sq_head = reinterpret_cast<unsigned*>(sq + params.sq_off.head);
+	m_sq_tail = reinterpret_cast<unsigned*>(sq + params.sq_off.tail);
+	m_sq_mask = *reinterpret_cast<unsigned*>(sq + params.sq_off.ring_mask);
+	m_sq_array = reinterpret_cast<unsigned*>(sq + params.sq_off.array);
+
+	auto cq = static_cast<char*>(m_cq_ring);
+	m_cq_head = reinterpret_cast<unsigned*>(cq + params.cq_off.head);
+	m_cq_tail = reinterpret_cast<unsigned*>(cq + params.cq_off.tail);
+	m_cq_mask = *reinterpret_cast<unsigned*>(cq + params.cq_off.ring_mask);
+	m_cqes = reinterpret_cast<io_uring_cqe*>(cq + params.cq_off.cqes);
+
+	m_setup_buffers();
+	add_watcher(m_remote_watcher(), EV_READ);
+    }
+
+    ev_loop_uring::~ev_loop_uring()
+    {
+	munmap(m_sqes, m_sqes_size);
+	if (m_cq_ring != m_sq_ring) munmap(m_cq_ring, m_cq_ring_size);
+	munmap(m_sq_ring, m_sq_ring_size);
+	close(m_ring_fd);
+	if (m_buf_ring) munmap(m_buf_ring, m_buf_ring_size);
+    }
+
+    // register the buffer ring, where multishot accept and recv work
+    void
+    ev_loop_uring::m_setup_buffers()
+    {
+#if defined (IZM_HAVE_IO_URING_RECV_MULTISHOT)
+	// multishot recv came with linux 6.0 and has no feature flag; it
+	// came along with IORING_OP_SEND_ZC though, which can be probed
+	constexpr unsigned PROBE_OPS = 256;
+	alignas(io_uring_probe) char probe_mem[sizeof(io_uring_probe) + PROBE_OPS * sizeof(io_uring_probe_op)] = {};
+	auto probe = reinterpret_cast<io_uring_probe*>(probe_mem);
+	if (sys_io_uring_register(m_ring_fd, IORING_REGISTER_PROBE, probe, PROBE_OPS) < 0) return;
+	if (probe->last_op < IORING_OP_SEND_ZC) return;
+
+	m_buf_ring_size = RECV_BLOCKS * sizeof(io_uring_buf);
+	auto mem = mmap(nullptr, m_buf_ring_size, PROT_READ | PROT_WRITE,
+			MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (mem == MAP_FAILED) return;
+
+	io_uring_buf_reg reg;
+	std::memset(&reg, 0, sizeof(reg));
+	reg.ring_addr = reinterpret_cast<uint64_t>(mem);
+	reg.ring_entries = RECV_BLOCKS;
+	reg.bgid = RECV_GROUP;
+	if (sys_io_uring_register(m_ring_fd, IORING_REGISTER_PBUF_RING, &reg, 1) < 0) {
+	    munmap(mem, m_buf_ring_size);
+	    return;
+	}
+
+	m_buf_ring = static_cast<io_uring_buf_ring*>(mem);
+	m_blocks.reserve(RECV_BLOCKS);
+	for (unsigned i = 0; i < RECV_BLOCKS; ++i) {
+	    m_blocks.emplace_back(input_buffer::BLOCK_SIZE);
+	    m_provide(i);
+	}
+#endif
+    }
+
+    // put block bid back at the tail of the buffer ring
+    void
+    ev_loop_uring::m_provide(uint16_t bid) noexcept
+    {
+	// not m_buf_ring->bufs: with older linux headers, C++ places it
+	// 8 bytes past the ring, where the kernel doesn't look
+	auto& b = reinterpret_cast<io_uring_buf*>(m_buf_ring)[m_buf_tail & (RECV_BLOCKS - 1)];
+	b.addr = reinterpret_cast<uint64_t>(m_blocks[bid].ptr());
+	b.len = m_blocks[bid].size();
+	b.bid = bid;
+	__atomic_store_n(&m_buf_ring->tail, ++m_buf_tail, __ATOMIC_RELEASE);
+    }
+
+    // get a free sqe, flushing pending submissions if the queue is full
+    io_uring_sqe*
+    ev_loop_uring::m_get_sqe()
+    {
+	auto head = __atomic_load_n(m_sq_head, __ATOMIC_ACQUIRE);
+	auto tail = *m_sq_tail;
+	if (tail - head > m_sq_mask) {
+	    m_submit(0, 0);
+	}
+
+	tail = *m_sq_tail;
+	auto index = tail & m_sq_mask;
+	auto sqe = &m_sqes[index];
+	std::memset(sqe, 0, sizeof(*sqe));
+
+	m_sq_array[index] = index;
+	__atomic_store_n(m_sq_tail, tail + 1, __ATOMIC_RELEASE);
+	++m_sq_pending;
+	return sqe;
+    }
+
+    // submit pending sqes and wait for at least `wait_nr` completions
+    // timeout is ignored if `wait_nr` is 0; negative timeout waits forever
+    void
+    ev_loop_uring::m_submit(unsigned wait_nr, timedelta_ms_t timeout)
+    {
+	unsigned flags = 0;
+	io_uring_getevents_arg arg;
+	__kernel_timespec ts;
+
+	std::memset(&arg, 0, sizeof(arg));
+	if (wait_nr) {
+	    flags |= IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG;
+	    if (timeout >= 0) {
+		ts.tv_sec = timeout / 1000;
+		ts.tv_nsec = (timeout % 1000) * 1000000;
+		arg.ts = reinterpret_cast<uint64_t>(&ts);
+	    }
+	}
+
+	int ret = sys_io_uring_enter(m_ring_fd, m_sq_pending, wait_nr, flags,
+				     wait_nr ? &arg : nullptr, wait_nr ? sizeof(arg) : 0);
+	if (ret >= 0) {
+	    m_sq_pending -= ret;
+	    return;
+	}
+
+	// ETIME: waiting timed out, which is fine
+	// EINTR: interrupted; treated like epoll_wait does
+	// EBUSY/EAGAIN: completion queue is overcommitted; pending sqes
+	//   are submitted again after completions are reaped
+	if (errno == ETIME || errno == EINTR || errno == EBUSY || errno == EAGAIN) return;
+
+	throw osexception();
+    }
+
+    void
+    ev_loop_uring::m_arm_poll(uint32_t index)
+    {
+	auto& s = m_slots[index];
+	auto sqe = m_get_sqe();
+	sqe->opcode = IORING_OP_POLL_ADD;
+	sqe->fd = s.watcher->fd();
+	sqe->len = IORING_POLL_ADD_MULTI;
+	sqe->poll32_events = s.events;
+	sqe->user_data = m_token(index, OP_POLL);
+    }
+
+    // cancel the poll of a slot; completions still in flight will not
+    // match the new generation
+    void
+    ev_loop_uring::m_remove_poll(uint32_t index)
+    {
+	auto sqe = m_get_sqe();
+	sqe->opcode = IORING_OP_POLL_REMOVE;
+	sqe->fd = -1;
+	sqe->addr = m_token(index, OP_POLL);
+	sqe->user_data = NULL_TOKEN;
+
+	++m_slots[index].generations[OP_POLL];
+    }
+
+    void
+    ev_loop_uring::m_arm_accept(uint32_t index)
+    {
+	auto sqe = m_get_sqe();
+	sqe->opcode = IORING_OP_ACCEPT;
+	sqe->fd = m_slots[index].watcher->fd();
+	sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+	sqe->accept_flags = SOCK_NONBLOCK;
+	sqe->user_data = m_token(index, OP_ACCEPT);
+	m_slots[index].accepting = true;
+    }
+
+    void
+    ev_loop_uring::m_arm_recv(uint32_t index)
+    {
+	auto sqe = m_get_sqe();
+	sqe->opcode = IORING_OP_RECV;
+	sqe->fd = m_slots[index].watcher->fd();
+	sqe->ioprio = IORING_RECV_MULTISHOT;
+	sqe->flags = IOSQE_BUFFER_SELECT;
+	sqe->buf_group = RECV_GROUP;
+	sqe->user_data = m_token(index, OP_RECV);
+	m_slots[index].receiving = true;
+    }
+
+    // cancel an operation of a slot; it completes once more, without
+    // IORING_CQE_F_MORE
+    void
+    ev_loop_uring::m_cancel(uint32_t index, op o)
+    {
+	auto sqe = m_get_sqe();
+	sqe->opcode = IORING_OP_ASYNC_CANCEL;
+	sqe->fd = -1;
+	sqe->addr = m_token(index, o);
+	sqe->user_data = NULL_TOKEN;
+    }
+
+    void
+    ev_loop_uring::add_watcher(ev_watcher& watcher, ev_interest interest)
+    {
+	uint32_t index;
+	if (m_free_slots.size()) {
+	    index = m_free_slots.back();
+	    m_free_slots.pop_back();
+	} else {
+	    if (m_slots.size() == MAX_SLOTS) throw osexception(EMFILE);
+	    index = m_slots.size();
+	    m_slots.emplace_back();
+	}
+
+	m_slots[index].watcher = &watcher;
+	m_slots[index].events = m_poll_events(interest);
+	m_slot_of[&watcher] = index;
+	m_arm_poll(index);
+	m_arm(watcher, interest);
+    }
+
+    void
+    ev_loop_uring::m_rearm(ev_watcher& watcher, ev_interest interest)
+    {
+	auto index = m_slot_of.at(&watcher);
+	m_remove_poll(index);
+	m_slots[index].events = m_poll_events(interest);
+	m_arm_poll(index);
+    }
+
+    void
+    ev_loop_uring::remove_watcher(ev_watcher& watcher)
+    {
+	m_timers.cancel_all(watcher);
+	m_forget(watcher);
+
+	auto it = m_slot_of.find(&watcher);
+	if (it == m_slot_of.end()) return;
+
+	auto index = it->second;
+	auto& s = m_slots[index];
+	m_remove_poll(index);
+
+	// what they complete with from now on is dropped
+	if (s.accepting) m_cancel(index, OP_ACCEPT);
+	if (s.receiving) m_cancel(index, OP_RECV);
+	++s.generations[OP_ACCEPT];
+	++s.generations[OP_RECV];
+	s.accepting = s.receiving = false;
+
+	s.watcher = nullptr;
+	m_free_slots.push_back(index);
+	m_slot_of.erase(it);
+    }
+
+    bool
+    ev_loop_uring::accept_multishot(ev_watcher& watcher)
+    {
+	if (!m_buf_ring) return false;
+
+	m_arm_accept(m_slot_of.at(&watcher));
+	return true;
+    }
+
+    bool
+    ev_loop_uring::recv_multishot(ev_watcher& watcher)
+    {
+	if (!m_buf_ring) return false;
+
+	m_arm_recv(m_slot_of.at(&watcher));
+	return true;
+    }
+
+    void
+    ev_loop_uring::cancel_recv(ev_watcher& watcher)
+    {
+	auto it = m_slot_of.find(&watcher);
+	if (it != m_slot_of.end() && m_slots[it->second].receiving) m_cancel(it->second, OP_RECV);
+    }
+
+    timer_id
+    ev_loop_uring::add_timer(ev_watcher& watcher, timedelta_ms_t timeout)
+    {
+	return m_timers.add(watcher, now() + timeout);
+    }
+
+    bool
+    ev_loop_uring::cancel_timer(timer_id id)
+    {
+	return m_timers.cancel(id);
+    }
+
+    bool
+    ev_loop_uring::reschedule_timer(timer_id id, timedelta_ms_t timeout)
+    {
+	return m_timers.reschedule(id, now() + timeout);
+    }
+
+    // handle a completion of the poll of a slot
+    // @return: whether it has been dispatched to the watcher
+    bool
+    ev_loop_uring::m_complete_poll(uint32_t index, const io_uring_cqe& cqe)
+    {
+	auto w = m_slots[index].watcher;
+	if (cqe.res < 0) {
+	    // a poll the kernel gave up for now, e.g. cancelled when the
+	    // ring was short of memory, is armed again; any other error
+	    // would come back at once, so it's reported instead, and the
+	    // syscall of whoever waits finds out
+	    if (cqe.flags & IORING_CQE_F_MORE) return false;
+	    if (m_transient(cqe.res)) {
+		m_arm_poll(index);
+		return false;
+	    }
+
+	    if (w->on_event(true, true)) m_defer(*w);
+	    return true;
+	}
+
+	// multishot poll was terminated by kernel; re-arm it
+	if (!(cqe.flags & IORING_CQE_F_MORE)) m_arm_poll(index);
+
+	if (cqe.res & POLLRDHUP) m_set_hangup(*w);
+
+	auto failed = cqe.res & (POLLERR | POLLHUP);
+	if (w->on_event((cqe.res & POLLIN) || failed, (cqe.res & POLLOUT) || failed)) {
+	    m_defer(*w);
+	}
+	return true;
+    }
+
+    bool
+    ev_loop_uring::m_complete_accept(uint32_t index, const io_uring_cqe& cqe)
+    {
+	auto& s = m_slots[index];
+	auto w = s.watcher;
+
+	// accepting stops at any error. it goes on after one of a single
+	// connection or one that passes; others are reported
+	if (!(cqe.flags & IORING_CQE_F_MORE)) {
+	    if (cqe.res >= 0 || cqe.res == -ECONNABORTED || m_transient(cqe.res)) {
+		m_arm_accept(index);
+	    } else {
+		s.accepting = false;
+	    }
+	}
+	if (cqe.res < 0 && s.accepting) return false;
+
+	w->on_accepted(cqe.res);
+	return true;
+    }
+
+    bool
+    ev_loop_uring::m_complete_recv(uint32_t index, const io_uring_cqe& cqe)
+    {
+	auto& s = m_slots[index];
+	auto w = s.watcher;
+	bool more = cqe.flags & IORING_CQE_F_MORE;
+	if (!more) s.receiving = false;
+	if (cqe.res == 0) m_set_hangup(*w);
+
+	// the block goes to the watcher, and a new one takes its place
+	byte_buffer block;
+	if (cqe.flags & IORING_CQE_F_BUFFER) {
+	    auto bid = cqe.flags >> IORING_CQE_BUFFER_SHIFT;
+	    block = std::move(m_blocks[bid]);
+	    m_blocks[bid] = byte_buffer(input_buffer::BLOCK_SIZE);
+	    m_provide(bid);
+	}
+
+	w->on_received(block, cqe.res, more);
+	return true;
+    }
+
+    void
+    ev_loop_uring::run_once()
+    {
+	auto timeout = m_timers.next_timeout(now());
+	m_apply_interest();
+	m_submit(m_has_pending() ? 0 : 1, timeout);
+	m_update_now();
+
+	// timer events
+	auto fired = m_timers.expire(now());
+
+	std::size_t events = 0;
+
+	auto head = *m_cq_head;
+	auto tail = __atomic_load_n(m_cq_tail, __ATOMIC_ACQUIRE);
+	while (head != tail) {
+	    // taken off first, so a callback throwing doesn't see it again
+	    auto cqe = m_cqes[head & m_cq_mask];
+	    __atomic_store_n(m_cq_head, ++head, __ATOMIC_RELEASE);
+	    if (cqe.user_data == NULL_TOKEN) continue;
+
+	    auto index = static_cast<uint32_t>(cqe.user_data) & (MAX_SLOTS - 1);
+	    auto o = static_cast<op>(static_cast<uint32_t>(cqe.user_data) >> 30);
+	    auto generation = static_cast<uint32_t>(cqe.user_data >> 32);
+	    if (index >= m_slots.size() || o >= OPS || !m_slots[index].watcher ||
+		m_slots[index].generations[o] != generation) {
+		// stale; a block the kernel has picked for it goes back
+		if (cqe.flags & IORING_CQE_F_BUFFER) m_provide(cqe.flags >> IORING_CQE_BUFFER_SHIFT);
+		continue;
+	    }
+
+	    // callbacks may add watchers and move the slots, so none is held
+	    // across them
+	    bool dispatched = false;
+	    switch (o) {
+	    case OP_POLL: dispatched = m_complete_poll(index, cqe); break;
+	    case OP_ACCEPT: dispatched = m_complete_accept(index, cqe); break;
+	    case OP_RECV: dispatched = m_complete_recv(index, cqe); break;
+	    default: break;
+	    }
+	    if (dispatched) ++events;
+	}
+	m_account(events, fired);
+
+	m_run_pending();
+    }
+}
+
+DEFINE_IMPL(uring, izumo::core::ev_loop_uring);
+
+#endif	// IZM_HAVE_IO_URING
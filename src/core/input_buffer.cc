@@ -0,0 +1,152 @@
+#include <core/input_buffer.hh>
+
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+
+namespace izumo::core {
+    static byte_buffer
+    alloc_block()
+    {
+	return byte_buffer(input_buffer::BLOCK_SIZE);
+    }
+
+    void
+    input_buffer::m_pop_front() noexcept
+    {
+	m_blocks.erase(m_blocks.begin());
+    }
+
+    byte_buffer_view
+    input_buffer::prepare()
+    {
+	if (m_blocks.empty() || m_blocks.back().end == m_blocks.back().buf.size()) {
+	    m_blocks.push_back({ alloc_block() });
+	}
+
+	auto& b = m_blocks.back();
+	return byte_buffer_view(b.buf, b.end, b.buf.size());
+    }
+
+    void
+    input_buffer::commit(std::size_t n) noexcept
+    {
+	auto& b = m_blocks.back();
+	assert(b.end + n <= b.buf.size());
+
+	b.end += n;
+	m_size += n;
+    }
+
+    void
+    input_buffer::append(byte_buffer& block, std::size_t n)
+    {
+	if (!m_blocks.empty()) {
+	    auto& b = m_blocks.back();
+	    if (b.begin == b.end) {
+		// only kept for `prepare`
+		m_blocks.pop_back();
+	    } else if (b.buf.size() - b.end >= n) {
+		std::memcpy(b.buf.ptr() + b.end, block.ptr(), n);
+		b.end += n;
+		m_size += n;
+		return;
+	    }
+	}
+
+	m_blocks.push_back({ std::move(block), 0, n });
+	m_size += n;
+    }
+
+    void
+    input_buffer::consume(std::size_t n) noexcept
+    {
+	assert(n <= m_size);
+
+	m_size -= n;
+	while (n) {
+	    auto& b = m_blocks.front();
+	    auto step = std::min(n, b.end - b.begin);
+	    b.begin += step;
+	    n -= step;
+
+	    // the last block is kept for receiving into, unless it's full
+	    if (b.begin == b.end && (m_blocks.size() > 1 || b.end == b.buf.size())) {
+		m_pop_front();
+	    }
+	}
+
+	if (m_blocks.size() == 1 && !m_size) m_blocks.front().begin = m_blocks.front().end = 0;
+    }
+
+    byte_buffer_view
+    input_buffer::front() noexcept
+    {
+	if (m_blocks.empty()) return byte_buffer_view();
+
+	auto& b = m_blocks.front();
+	return byte_buffer_view(b.buf, b.begin, b.end);
+    }
+
+    byte_buffer
+    input_buffer::take_front(std::size_t n)
+    {
+	auto& first = m_blocks.front();
+	assert(n <= first.end - first.begin);
+
+	auto ret = std::move(first.buf);
+	auto rest = ret.ptr() + first.begin + n;
+	auto left = first.end - first.begin - n;
+	m_size -= n;
+
+	if (left) {
+	    first.buf = byte_buffer(std::max(BLOCK_SIZE, left));
+	    std::memcpy(first.buf.ptr(), rest, left);
+	    first.begin = 0;
+	    first.end = left;
+	} else {
+	    m_pop_front();
+	}
+
+	return ret;
+    }
+
+    bool
+    input_buffer::linearize()
+    {
+	if (m_blocks.empty()) return false;
+
+	auto& first = m_blocks.front();
+	if (first.end - first.begin == m_size) return false;
+
+	// bytes fit in a block: move them to the start of the first one,
+	// otherwise gather them into a block large enough
+	block merged;
+	if (m_size <= BLOCK_SIZE) {
+	    merged.buf = std::move(first.buf);
+	    std::memmove(merged.buf.ptr(), merged.buf.ptr() + first.begin, first.end - first.begin);
+	    merged.end = first.end - first.begin;
+	} else {
+	    auto size = BLOCK_SIZE;
+	    while (size < m_size) size *= 2;
+	    merged.buf = byte_buffer(size);
+	}
+
+	for (auto& b: m_blocks) {
+	    if (!b.buf.ptr()) continue; // first block taken over above
+	    std::memcpy(merged.buf.ptr() + merged.end, b.buf.ptr() + b.begin, b.end - b.begin);
+	    merged.end += b.end - b.begin;
+	}
+
+	m_blocks.clear();
+	m_blocks.push_back(std::move(merged));
+	return true;
+    }
+
+    void
+    input_buffer::shrink() noexcept
+    {
+	if (m_size) return;
+	while (!m_blocks.empty()) m_pop_front();
+    }
+}
@@ -1,20 +1,40 @@
 #include <core/ev_watcher.hh>
 #include <core/ev_loop.hh>
 #include <core/byte_buffer.hh>
+#include <core/input_buffer.hh>
 #include <core/clock.hh>
+#include <core/coro.hh>
 #include <core/mem.hh>
 #include <core/exception.hh>
 #include <core/log.hh>
+#include <core/metrics.hh>
+#include <core/object_pool.hh>
+#include <core/output_queue.hh>
+#include <core/slab.hh>
 
+#include <http/body.hh>
+#include <http/chunked.hh>
 #include <http/parser.hh>
+#include <http/static_file.hh>
+#include <http/upstream.hh>
+#include <http/writer.hh>
 
-#include <array>
 #include <iostream>
+#include <climits>
 #include <cstring>
+#include <future>
+#include <memory>
+#include <thread>
+#include <vector>
 
 #include <fmt/printf.h>
 
+#include <strings.h>
 #include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sched.h>
+#include <signal.h>
 #include <sys/socket.h>
 #include <netinet/ip.h>
 #include <arpa/inet.h>
@@ -25,22 +45,45 @@
 
 static struct {
     std::uint16_t port_h = 12345; // port number in host byte order
+    unsigned threads = 1;	  // number of worker threads; 0 for one per CPU
+    bool pin_cpus = false;	  // pin each worker thread to its own CPU
+    bool huge_pages = false;	  // back I/O buffers with transparent huge pages
+    const char* evloop = nullptr; // ev_loop implementation; nullptr for build default
+    const char* root = nullptr;	  // document root to serve files from; nullptr for demo responses
+    std::vector<izumo::http::upstream_address> upstreams; // servers to forward requests to, if any
+    uint64_t max_body = 1024 * 1024; // largest request body taken
 } cmdargs;
 
 static void
 usage(const char* cmdname = "izumo")
 {
-    fmt::print("Usage: {} [-p, --port port]\n", cmdname);
+    fmt::print("Usage: {} [-p, --port port] [-t, --threads n] [-a, --affinity] [-e, --evloop impl] [-r, --root dir] [-u, --upstream addr] [-b, --max-body bytes] [-H, --huge-pages]\n", cmdname);
     fmt::print("\t-p, --port port: port number for demo server to listen to\n");
+    fmt::print("\t-t, --threads n: number of worker threads; 0 for one per CPU (default 1)\n");
+    fmt::print("\t-a, --affinity: pin each worker thread to a CPU\n");
+    fmt::print("\t-e, --evloop impl: ev_loop implementation to use, e.g. epoll or uring\n");
+    fmt::print("\t-r, --root dir: serve files under dir instead of echoing requests\n");
+    fmt::print("\t-u, --upstream addr: forward requests to addr, as host:port or unix:/path; may be\n"
+	       "\t\tgiven again to take turns between servers\n");
+    fmt::print("\t-b, --max-body bytes: largest request body taken (default 1048576)\n");
+    fmt::print("\t-H, --huge-pages: back I/O buffers with transparent huge pages\n");
 }
 
 static void
 parse_opts(int argc, char *argv[])
 {
-    const char* opts = "p:";
+    const char* opts = "p:t:ae:r:u:b:H";
 
     option longopts[] = {
-	{ .name = "port", .has_arg = true, .flag = nullptr, .val = 'p' }
+	{ .name = "port", .has_arg = true, .flag = nullptr, .val = 'p' },
+	{ .name = "threads", .has_arg = true, .flag = nullptr, .val = 't' },
+	{ .name = "affinity", .has_arg = false, .flag = nullptr, .val = 'a' },
+	{ .name = "evloop", .has_arg = true, .flag = nullptr, .val = 'e' },
+	{ .name = "root", .has_arg = true, .flag = nullptr, .val = 'r' },
+	{ .name = "upstream", .has_arg = true, .flag = nullptr, .val = 'u' },
+	{ .name = "max-body", .has_arg = true, .flag = nullptr, .val = 'b' },
+	{ .name = "huge-pages", .has_arg = false, .flag = nullptr, .val = 'H' },
+	{}
     };
 
     auto running = true;
@@ -50,6 +93,33 @@ parse_opts(int argc, char *argv[])
 	case 'p':
 	    cmdargs.port_h = std::stoul(optarg);
 	    break;
+	case 't':
+	    cmdargs.threads = std::stoul(optarg);
+	    break;
+	case 'a':
+	    cmdargs.pin_cpus = true;
+	    break;
+	case 'e':
+	    cmdargs.evloop = optarg;
+	    break;
+	case 'r':
+	    cmdargs.root = optarg;
+	    break;
+	case 'u': {
+	    izumo::http::upstream_address addr;
+	    if (!izumo::http::parse_upstream_address(optarg, addr)) {
+		fmt::print("Invalid upstream address: {}\n", optarg);
+		std::exit(-1);
+	    }
+	    cmdargs.upstreams.push_back(addr);
+	    break;
+	}
+	case 'b':
+	    cmdargs.max_body = std::stoull(optarg);
+	    break;
+	case 'H':
+	    cmdargs.huge_pages = true;
+	    break;
 	case -1:
 	    running = false;
 	    break;
@@ -68,17 +138,54 @@ struct izm_sockaddr {
     socklen_t len;
 };
 
-const char* RESPONSE_HEADER =
-    "HTTP/1.1 200 OK\r\n"
-    "Server: Izumo\r\n"
-    "Content-Type: text/plain\r\n\r\n";
-const char* RESPONSE_400 =
+constexpr std::string_view RESPONSE_400 =
     "HTTP/1.1 400 Bad Request\r\n"
     "Server: Izumo\r\n"
     "Content-Type: text/plain\r\n"
-    "Content-Length 15\r\n\r\n"
+    "Content-Length: 15\r\n"
+    "Connection: close\r\n\r\n"
     "400 Bad Request";
 
+constexpr std::string_view RESPONSE_413 =
+    "HTTP/1.1 413 Payload Too Large\r\n"
+    "Server: Izumo\r\n"
+    "Content-Type: text/plain\r\n"
+    "Content-Length: 21\r\n"
+    "Connection: close\r\n\r\n"
+    "413 Payload Too Large";
+
+constexpr std::string_view RESPONSE_431 =
+    "HTTP/1.1 431 Request Header Fields Too Large\r\n"
+    "Server: Izumo\r\n"
+    "Content-Type: text/plain\r\n"
+    "Content-Length: 35\r\n"
+    "Connection: close\r\n\r\n"
+    "431 Request Header Fields Too Large";
+
+constexpr std::string_view RESPONSE_100 = "HTTP/1.1 100 Continue\r\n\r\n";
+
+// requests for this path are answered with metrics instead of the demo response
+constexpr std::string_view METRICS_PATH = "/metrics";
+
+static struct {
+    izumo::core::counter accepted = izumo::core::metrics_registry::instance().add_counter(
+	"izumo_connections_accepted_total", "Client connections accepted");
+    izumo::core::gauge open = izumo::core::metrics_registry::instance().add_gauge(
+	"izumo_connections_open", "Client connections currently open");
+    izumo::core::counter bytes_in = izumo::core::metrics_registry::instance().add_counter(
+	"izumo_bytes_received_total", "Bytes received from clients");
+    izumo::core::counter bytes_out = izumo::core::metrics_registry::instance().add_counter(
+	"izumo_bytes_sent_total", "Bytes sent to clients");
+    izumo::core::counter bad_requests = izumo::core::metrics_registry::instance().add_counter(
+	"izumo_bad_requests_total", "Requests rejected as malformed or too large");
+    izumo::core::histogram request_duration = izumo::core::metrics_registry::instance().add_histogram(
+	"izumo_request_duration_seconds", "Time from parsing a request to queueing its response");
+    izumo::core::counter proxied = izumo::core::metrics_registry::instance().add_counter(
+	"izumo_proxied_requests_total", "Requests forwarded to upstream servers");
+    izumo::core::counter upstream_errors = izumo::core::metrics_registry::instance().add_counter(
+	"izumo_upstream_errors_total", "Forwarded requests failed by upstream servers");
+} metrics;
+
 int
 bind_listen_sock(uint16_t port)
 {
@@ -88,6 +195,12 @@ bind_listen_sock(uint16_t port)
     int val = 1;
     setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, &val, sizeof(val));
 
+    // every worker binds its own listening socket to the same port;
+    // the kernel balances incoming connections between them
+    if (setsockopt(sock, SOL_SOCKET, SO_REUSEPORT, &val, sizeof(val)) < 0) {
+	throw izumo::core::osexception();
+    }
+
     sockaddr_in addr;
     std::memset(&addr, 0, sizeof(addr));
     addr.sin_addr.s_addr = INADDR_ANY;
@@ -98,112 +211,969 @@ bind_listen_sock(uint16_t port)
 	throw izumo::core::osexception();
     }
 
-    listen(sock, 128);
+    if (listen(sock, SOMAXCONN) < 0) throw izumo::core::osexception();
     return sock;
 }
 
-class client: public izumo::core::ev_watcher {
+// upstream servers of a worker, taking turns; upstream is bound to the
+// thread which created it
+class upstream_set {
 private:
-    constexpr static std::size_t BUFSIZE = 4096;
-    std::size_t m_bytes_read = 0;
-    bool m_writing = false;
+    std::vector<std::unique_ptr<izumo::http::upstream>> m_upstreams;
+    std::size_t m_next = 0;
 
-    izumo::core::byte_buffer m_buffer;
-    izumo::core::byte_buffer_view m_write_view;
-    izumo::core::mem_pool m_pool;
-    izumo::core::mp_unique_ptr<izm_sockaddr> m_addr;
+public:
+    explicit upstream_set(const std::vector<izumo::http::upstream_address>& addrs)
+    {
+	for (auto& addr: addrs) m_upstreams.push_back(std::make_unique<izumo::http::upstream>(addr));
+    }
+
+    izumo::http::upstream&
+    pick() noexcept
+    {
+	auto& ret = *m_upstreams[m_next];
+	m_next = (m_next + 1) % m_upstreams.size();
+	return ret;
+    }
+};
+
+/** drain: write a queue to a socket until it is empty
+ *   @parameters:
+ *      written: increased by number of bytes written
+ *   @return:
+ *      awaitable of 0, or -errno
+ */
+static izumo::core::task<int>
+drain(izumo::core::mem_pool&, izumo::core::output_queue& q, izumo::core::async_fd& sock,
+      std::size_t& written)
+{
+    while (true) {
+	auto ret = q.flush(sock.fd(), written);
+	if (ret == izumo::core::output_queue::flush_result::error) co_return -errno;
+	if (ret == izumo::core::output_queue::flush_result::done) co_return 0;
+
+	auto err = co_await izumo::core::async_writable(sock);
+	if (err < 0) co_return err;
+    }
+}
 
+/** queue_head: queue a parsed header without some of its fields
+ *   fields are lines following the start line in receiving order, so
+ *   the rest is queued as it is, in place. the empty line ending the
+ *   header is left out, for fields to be added after.
+ *   @parameters:
+ *      head: the header as received; fields of headers refer to it
+ *      drop: whether a field is left out
+ */
+template <typename _pred_t>
+static void
+queue_head(izumo::core::output_queue& q, std::string_view head, const izumo::http::header& headers,
+	   _pred_t drop)
+{
+    auto begin = head.data();
+    auto end = head.data() + head.size() - 2;
+
+    for (auto& e: headers) {
+	if (!drop(e)) continue;
+
+	auto value_end = e.value.data() + e.value.size();
+	auto lf = static_cast<const char*>(std::memchr(value_end, '\n', end - value_end));
+	if (e.name.data() > begin) q.push(std::string_view(begin, e.name.data() - begin));
+	begin = lf + 1;
+    }
+
+    if (end > begin) q.push(std::string_view(begin, end - begin));
+}
+
+/** queue_body: queue body bytes found in received bytes
+ *   @parameters:
+ *      in: bytes received after those given before
+ *      dechunk: queue only data of a chunked body; it is queued as it is
+ *               otherwise
+ *      used: set to number of bytes of in belonging to the body
+ */
+static izumo::http::parse_result
+queue_body(izumo::http::body_decoder& decoder, const izumo::core::byte_buffer_view& in,
+	   izumo::core::output_queue& q, bool dechunk, std::size_t& used)
+{
+    used = 0;
+    while (true) {
+	izumo::core::byte_buffer_view data;
+	std::size_t consumed;
+	auto ret = decoder.decode(in.slice(used, in.size()), data, consumed);
+	if (dechunk && data.size()) q.push(data);
+	used += consumed;
+
+	if (ret != izumo::http::parse_result::incomplete || !consumed) {
+	    if (!dechunk && used) q.push(in.slice(used));
+	    return ret;
+	}
+    }
+}
+
+// whether the client waits to be told before sending the body of req
+static bool
+expects_continue(const izumo::http::request& req) noexcept
+{
+    auto value = req.headers.get(izumo::http::header_id::expect);
+    return req.httpver_minor >= 1 && value.size() == 12
+	&& strncasecmp(value.data(), "100-continue", 12) == 0;
+}
+
+class client;
+using client_pool = izumo::core::object_pool<client>;
+
+// fields touched on every resumption come first, so that with the
+// socket they share the first cache line
+class alignas(64) client {
+private:
+    constexpr static std::size_t MAX_HEADER_SIZE = 64 * 1024;
+    constexpr static izumo::core::timedelta_ms_t IDLE_TIMEOUT = 5000;
+    constexpr static std::size_t RUN_FRAME_SIZE = 448; // frame of `run` and its header
+
+    izumo::core::async_fd m_sock;
+    bool m_closing = false;	  // close once queued responses are sent
+    bool m_forwarding = false;	  // request being parsed goes to upstream
+    bool m_body_pending = false;  // body of request being parsed is still to be read
+    izumo::core::input_buffer m_in; // starts at the request being parsed
+
+    std::size_t m_out_size = 0;	  // bytes of m_out in use until queue drains
+    izumo::core::output_queue m_queue;
+    izumo::core::byte_buffer m_out; // serialized heads and small bodies
+    izumo::http::file_cache* m_files; // nullptr when not serving files
+    upstream_set* m_upstreams;	      // nullptr when not forwarding
+    int m_pipe[2] = { -1, -1 };	      // bodies spliced from upstream; made on first use
+
+    // request being parsed
+    izumo::core::mem_pool m_req_pool;
+    izumo::http::request m_req;
+    izumo::http::request_parser m_parser;
+    izumo::http::body_decoder m_body;
+    izumo::core::byte_buffer m_head; // header taken from m_in once its body is read
+    std::size_t m_body_used = 0;      // bytes of m_in given out as body, not consumed yet
+
+    izumo::core::frame_slot<RUN_FRAME_SIZE> m_frame; // of `run`, which lasts as long
+    client_pool& m_owner;
+    izm_sockaddr m_addr;
+
+    // queue what w has written to m_out since last call
     void
-    stop()
+    commit(const izumo::http::response_writer& w)
     {
-	izumo::core::ev_loop::instance().remove_watcher(*this);
-	shutdown(m_fd, SHUT_RDWR);
-	close(m_fd);
-	delete this;
+	m_queue.push(m_out, m_out_size, w.size());
+	m_out_size = w.size();
     }
-    
-public:
-    client(int fd, izumo::core::mp_unique_ptr<izm_sockaddr> addr,
-	   izumo::core::mem_pool p):
-	ev_watcher(fd), m_addr(std::move(addr)),
-	m_buffer(BUFSIZE),
-	m_pool(std::move(p))
+
+    // answer with a static error response and close
+    void
+    reject(std::string_view response)
     {
-	izumo::core::log::info("New client: {}:{}",
-			       inet_ntoa(m_addr->ipv4.sin_addr),
-			       ntohs(m_addr->ipv4.sin_port));
+	m_queue.push(response);
+	m_closing = true;
+	metrics.bad_requests.inc();
     }
 
+    // write status line of res and fields every response carries
+    void
+    begin_head(izumo::http::response_writer& w, const izumo::http::request& req,
+	       const izumo::http::response& res)
+    {
+	namespace static_header = izumo::http::static_header;
+
+	w.head(res);
+	w.write(static_header::server);
+	if (m_closing) {
+	    w.write(static_header::connection_close);
+	} else if (req.httpver_minor == 0) {
+	    w.write(static_header::connection_keep_alive);
+	}
+    }
+
+    // answer with a status code and its reason phrase as body
+    void
+    respond_status(const izumo::http::request& req, int status_code)
+    {
+	izumo::http::response res(m_req_pool);
+	res.status_code = status_code;
+	izumo::http::response_writer w(m_out, m_out_size);
+
+	char body[64];
+	auto len = fmt::format_to_n(body, sizeof(body), "{} {}", status_code,
+				    izumo::http::reason_phrase(status_code)).size;
+
+	begin_head(w, req, res);
+	w.write(izumo::http::static_header::content_type_text);
+	w.header("Content-Length", len);
+	if (status_code == 405) w.header("Allow", "GET, HEAD");
+	w.end_head();
+	if (req.method != "HEAD") w.write(std::string_view(body, len));
+
+	commit(w);
+    }
+
+    // answer a scrape with every metric; rendering takes a lock, but
+    // only against other scrapes and metric registration
+    void
+    respond_metrics(const izumo::http::request& req)
+    {
+	auto body = std::make_shared<std::string>();
+	izumo::core::metrics_registry::instance().expose(*body);
+
+	izumo::http::response res(m_req_pool);
+	izumo::http::response_writer w(m_out, m_out_size);
+
+	begin_head(w, req, res);
+	w.header("Content-Type", "text/plain; version=0.0.4");
+	w.header("Content-Length", body->size());
+	w.end_head();
+	commit(w);
+
+	// the body is queued as it is, and freed once sent
+	if (req.method != "HEAD") m_queue.push(*body, body);
+    }
+
+    // answer with a file under document root; the body is sent
+    // straight from the file with sendfile
+    void
+    respond_file(const izumo::http::request& req)
+    {
+	using izumo::http::header_id;
+
+	auto head_only = req.method == "HEAD";
+	if (!head_only && req.method != "GET") {
+	    respond_status(req, 405);
+	    return;
+	}
+
+	std::shared_ptr<const izumo::http::cached_file> file;
+	switch (m_files->lookup(req.target, file)) {
+	case 0:
+	    break;
+	case EINVAL:
+	    respond_status(req, 400);
+	    return;
+	case ENOENT:
+	case ENOTDIR:
+	case ENAMETOOLONG:
+	    respond_status(req, 404);
+	    return;
+	case EACCES:
+	case EPERM:
+	case ELOOP:
+	    respond_status(req, 403);
+	    return;
+	default:
+	    respond_status(req, 500);
+	    return;
+	}
+
+	izumo::http::response res(m_req_pool);
+	izumo::http::response_writer w(m_out, m_out_size);
+
+	char buf[64];		// Content-Range value
+
+	auto since = req.headers.get(header_id::if_modified_since);
+	if (since.size()) {
+	    auto t = izumo::http::parse_http_date(since);
+	    if (t >= 0 && file->mtime <= t) {
+		res.status_code = 304;
+		begin_head(w, req, res);
+		w.header("Last-Modified", file->last_modified);
+		w.end_head();
+		commit(w);
+		return;
+	    }
+	}
+
+	// If-Range only carries dates here since no ETag is ever sent
+	izumo::http::byte_range range { 0, file->size - 1 };
+	auto range_value = req.headers.get(header_id::range);
+	auto if_range = req.headers.get(header_id::if_range);
+	if (range_value.size() && (if_range.empty() || if_range == file->last_modified)) {
+	    switch (izumo::http::parse_range(range_value, file->size, range)) {
+	    case izumo::http::range_result::none:
+		range = { 0, file->size - 1 };
+		break;
+
+	    case izumo::http::range_result::ok:
+		res.status_code = 206;
+		break;
+
+	    case izumo::http::range_result::unsatisfiable:
+		res.status_code = 416;
+		begin_head(w, req, res);
+		auto len = fmt::format_to_n(buf, sizeof(buf), "bytes */{}", file->size).size;
+		w.header("Content-Range", std::string_view(buf, len));
+		w.header("Content-Length", uint64_t(0));
+		w.end_head();
+		commit(w);
+		return;
+	    }
+	}
+
+	// range.last wraps around for an empty file, so length is 0
+	auto length = range.last + 1 - range.first;
+
+	begin_head(w, req, res);
+	w.header("Content-Type", file->content_type);
+	w.header("Content-Length", length);
+	w.header("Last-Modified", file->last_modified);
+	w.write("Accept-Ranges: bytes\r\n");
+	if (res.status_code == 206) {
+	    auto len = fmt::format_to_n(buf, sizeof(buf), "bytes {}-{}/{}",
+					range.first, range.last, file->size).size;
+	    w.header("Content-Range", std::string_view(buf, len));
+	}
+	w.end_head();
+	commit(w);
+
+	// the file stays open until its body is sent
+	if (!head_only) m_queue.push_file(file->fd, range.first, length, file);
+    }
+
+    // whether req is answered by upstream
     bool
-    on_event(bool r, bool w) override
+    forwarded(const izumo::http::request& req) const noexcept
     {
-	if (!m_writing && !r) return false;
-	if (m_writing && !w) return false;
+	return m_upstreams && req.target != METRICS_PATH;
+    }
 
-	izumo::core::byte_buffer_view read_view;
-	while (true) {
-	    auto ret = recv(m_fd, m_buffer.ptr() + m_bytes_read, m_buffer.size() - m_bytes_read, MSG_NOSIGNAL);
-	    if (ret < 0) {
-		if (errno != EAGAIN && errno != EWOULDBLOCK) {
-		    throw izumo::core::osexception();
+    void
+    respond(const izumo::http::request& req)
+    {
+	namespace static_header = izumo::http::static_header;
+
+	if (!izumo::http::keep_alive(req)) m_closing = true;
+
+	if (req.target == METRICS_PATH) {
+	    respond_metrics(req);
+	    return;
+	}
+
+	// forwarding takes waits, so it is left to `run`
+	if (forwarded(req)) {
+	    m_forwarding = true;
+	    return;
+	}
+
+	if (m_files) {
+	    respond_file(req);
+	    return;
+	}
+
+	izumo::http::response res(m_req_pool);
+	izumo::http::response_writer w(m_out, m_out_size);
+
+	begin_head(w, req, res);
+	w.write(static_header::content_type_text);
+	w.header("Content-Length", req.method.size() + 2 + req.target.size());
+	w.end_head();
+
+	// copied since the input buffer may be compacted before sending
+	w.write(req.method);
+	w.write(": ");
+	w.write(req.target);
+
+	commit(w);
+    }
+
+    // get ready to parse next request
+    void
+    reset_request() noexcept
+    {
+	m_parser.reset();
+	m_req.clear();
+	m_req_pool.reset();
+	m_head = izumo::core::byte_buffer();
+	m_body_pending = false;
+	m_body_used = 0;
+    }
+
+    // drop the request served from input and get ready for next one
+    void
+    finish_request() noexcept
+    {
+	// the header has gone with its block if the body has been read
+	if (!m_head.ptr()) m_in.consume(m_parser.consumed());
+	reset_request();
+    }
+
+    // serve every complete request in buffer and queue their responses
+    void
+    process()
+    {
+	while (!m_closing && !m_in.empty()) {
+	    auto begin = izumo::core::clock::now_ns();
+	    auto result = m_parser.parse(m_req, m_in.front());
+
+	    if (result == izumo::http::parse_result::incomplete) {
+		if (m_in.size() > MAX_HEADER_SIZE) {
+		    reject(RESPONSE_431);
+		    break;
 		}
-		return false;
-	    }
-	    
-	    if (ret == 0) {
-		stop();
-		return false;
+
+		// wait for more unless the rest has gone to later blocks
+		if (m_in.front().size() == m_in.size()) break;
+
+		// parsed fields refer to the old location, so it is parsed
+		// again from the start
+		if (m_in.linearize()) reset_request();
+		continue;
 	    }
-	    
-	    m_bytes_read += ret;
-	    read_view = izumo::core::byte_buffer_view(m_buffer, m_bytes_read);
-	    
-	    if (izumo::http::header_completed(read_view)) {
+
+	    if (result == izumo::http::parse_result::error || !m_body.start_request(m_req)) {
+		reject(RESPONSE_400);
 		break;
 	    }
 
-	    if (m_bytes_read == m_buffer.size()) {
+	    auto framing = m_body.framing();
+	    if (framing == izumo::http::body_framing::length && m_body.remaining() > cmdargs.max_body) {
+		reject(RESPONSE_413);
 		break;
 	    }
+	    m_body_pending = framing != izumo::http::body_framing::none;
+
+	    // the body is of no use to local handlers, but has to be read
+	    // past to get to the next request; a client waiting to be told
+	    // to send it is spared that by closing
+	    if (m_body_pending && !forwarded(m_req) && expects_continue(m_req)) m_closing = true;
+
+	    respond(m_req);
+	    if (m_forwarding) break;
+	    metrics.request_duration.observe(izumo::core::clock::now_ns() - begin);
+
+	    // the body is read past by `run`
+	    if (m_body_pending) break;
+
+	    finish_request();
 	}
+    }
 
-	m_writing = true;
-	try {
-	    izumo::http::request req(m_pool);
-	    izumo::http::parse_request(req, read_view);
-	    
-	    auto response = fmt::format("{}{}: {}", RESPONSE_HEADER, req.method, req.target);
-	    assert(response.size() < m_buffer.size());
-	    m_write_view = izumo::core::byte_buffer_view(m_buffer, response.size());
-	    std::memcpy(m_write_view.data(), response.data(), response.size());
-	} catch(const izumo::http::bad_request&) {
-	    m_write_view = izumo::core::byte_buffer_view(m_buffer, std::strlen(RESPONSE_400));
-	    std::memcpy(m_write_view.data(), RESPONSE_400, std::strlen(RESPONSE_400));
+    /** read_body: take the next piece of body of the request parsed
+     *   pieces are views of the input buffer, valid until the next call.
+     *   the header is taken out of the input buffer on first call, so
+     *   every piece is consumed once given out, and memory stays the same
+     *   however large the body is. a client waiting for 100 Continue
+     *   is sent one then.
+     *   @parameters:
+     *      data: set to the piece
+     *   @return:
+     *      awaitable of 1 with a piece, 0 once the body has ended, or
+     *      -errno; -EPROTO if it's malformed, -EMSGSIZE if it's larger than
+     *      allowed
+     */
+    izumo::core::task<int>
+    read_body(izumo::core::mem_pool& pool, izumo::core::byte_buffer_view& data)
+    {
+	if (!m_body_pending) co_return 0;
+
+	if (!m_head.ptr()) {
+	    m_head = m_in.take_front(m_parser.consumed());
+	    if (m_in.empty() && expects_continue(m_req)) {
+		m_queue.push(RESPONSE_100);
+		if (!co_await flush(pool)) co_return -EPIPE;
+	    }
 	}
 
-	
+	m_in.consume(m_body_used);
+	m_body_used = 0;
+
+	while (true) {
+	    std::size_t consumed;
+	    auto ret = m_body.decode(m_in.front(), data, consumed);
+	    if (ret == izumo::http::parse_result::error) co_return -EPROTO;
+	    if (m_body.size() > cmdargs.max_body) co_return -EMSGSIZE;
+
+	    if (data.size()) {
+		// consumed on next call, as data refers to them
+		m_body_used = consumed;
+		co_return 1;
+	    }
+
+	    m_in.consume(consumed);
+	    if (ret == izumo::http::parse_result::done) {
+		m_body_pending = false;
+		co_return 0;
+	    }
+	    if (consumed) continue;
+
+	    auto n = co_await izumo::core::async_recv(m_sock, m_in);
+	    if (n < 0) co_return n;
+	    if (n == 0) co_return -ECONNRESET;
+
+	    metrics.bytes_in.inc(n);
+	}
+    }
+
+    /** skip_body: read past the rest of the body of the request parsed
+     *   @return:
+     *      awaitable of false if the connection has to be closed at once
+     */
+    izumo::core::task<bool>
+    skip_body(izumo::core::mem_pool&)
+    {
+	// a frame for every piece; see `send_body`
+	izumo::core::mem_pool piece_pool;
 	while (true) {
-	    auto ret = send(m_fd, m_write_view.data(), m_write_view.size(), MSG_NOSIGNAL);
+	    piece_pool.reset();
+
+	    izumo::core::byte_buffer_view data;
+	    auto ret = co_await read_body(piece_pool, data);
+	    if (ret == 0) co_return true;
+	    if (ret == -EPROTO || ret == -EMSGSIZE) {
+		// where the next request starts is unknown, but a response
+		// may have been queued already
+		m_closing = true;
+		metrics.bad_requests.inc();
+		co_return true;
+	    }
+	    if (ret < 0) co_return false;
+	}
+    }
+
+    /** flush: send queued responses
+     *   its frame is taken from the request pool, which is not reset
+     *   before the next request is processed
+     *   @return:
+     *      awaitable of false if the connection has failed
+     */
+    izumo::core::task<bool>
+    flush(izumo::core::mem_pool& pool)
+    {
+	std::size_t written = 0;
+	auto ret = co_await drain(pool, m_queue, m_sock, written);
+	metrics.bytes_out.inc(written);
+	if (ret < 0) co_return false;
+
+	// an idle connection keeps no output block
+	m_out_size = 0;
+	m_out = izumo::core::byte_buffer();
+	co_return true;
+    }
+
+    /** splice_body: relay body bytes from upstream to the client
+     *   bytes move through m_pipe with splice, so they never enter user
+     *   space. the pipe only takes what the client falls behind by, so
+     *   upstream is read no faster than the client reads.
+     *   @parameters:
+     *      length: number of bytes; UINT64_MAX for until upstream closes
+     *   @return:
+     *      awaitable of 0, or -errno; -EPROTO if upstream closes early
+     */
+    izumo::core::task<int>
+    splice_body(izumo::core::mem_pool&, izumo::core::async_fd& up, uint64_t length)
+    {
+	constexpr auto flags = SPLICE_F_MOVE | SPLICE_F_NONBLOCK;
+
+	if (m_pipe[0] < 0 && pipe2(m_pipe, O_NONBLOCK | O_CLOEXEC) < 0) co_return -errno;
+
+	auto until_close = length == UINT64_MAX;
+	std::size_t in_pipe = 0;
+
+	while (length || in_pipe) {
+	    auto moved = false;
+
+	    if (length) {
+		auto n = splice(up.fd(), nullptr, m_pipe[1], nullptr,
+				std::min<uint64_t>(length, SSIZE_MAX), flags);
+		if (n > 0) {
+		    in_pipe += n;
+		    if (!until_close) length -= n;
+		    moved = true;
+		} else if (n == 0) {
+		    if (!until_close) co_return -EPROTO;
+		    length = 0;
+		    moved = true;
+		} else if (errno != EAGAIN && errno != EINTR) {
+		    co_return -errno;
+		}
+	    }
+
+	    if (in_pipe) {
+		auto n = splice(m_pipe[0], nullptr, m_sock.fd(), nullptr, in_pipe, flags);
+		if (n > 0) {
+		    in_pipe -= n;
+		    metrics.bytes_out.inc(n);
+		    moved = true;
+		} else if (n < 0 && errno != EAGAIN && errno != EINTR) {
+		    co_return -errno;
+		}
+	    }
+
+	    if (moved) continue;
+
+	    // upstream can only be held up by a full pipe, which means the
+	    // client is the one to wait for
+	    auto ret = in_pipe ? co_await izumo::core::async_writable(m_sock)
+		: co_await izumo::core::async_readable(up);
+	    if (ret < 0) co_return ret;
+	}
+
+	co_return 0;
+    }
+
+    /** send_body: send a request header, and the body of the request
+     *   parsed as it arrives
+     *   a chunked body is chunked again, a chunk for every piece received,
+     *   without trailer fields.
+     *   @parameters:
+     *      q: holding the header
+     *      up: upstream socket
+     *      client_error: set to the error if reading the body has failed
+     *   @return:
+     *      awaitable of 0, or -errno
+     */
+    izumo::core::task<int>
+    send_body(izumo::core::mem_pool& pool, izumo::core::output_queue& q, izumo::core::async_fd& up,
+	      int& client_error)
+    {
+	auto chunked = m_body.framing() == izumo::http::body_framing::chunked;
+	izumo::http::chunked_stream stream(q, up);
+	std::size_t written = 0;
+
+	auto ret = chunked ? stream.start() : co_await drain(pool, q, up, written);
+	if (ret < 0) co_return ret;
+
+	// frames awaited for every piece go to a pool of their own, so
+	// they don't pile up however many pieces there are
+	izumo::core::mem_pool piece_pool;
+	while (true) {
+	    piece_pool.reset();
+
+	    izumo::core::byte_buffer_view data;
+	    ret = co_await read_body(piece_pool, data);
 	    if (ret < 0) {
-		if (errno != EAGAIN && errno != EWOULDBLOCK) {
-		    throw izumo::core::osexception();
+		client_error = ret;
+		co_return ret;
+	    }
+	    if (ret == 0) break;
+
+	    if (chunked) {
+		ret = co_await stream.write(piece_pool, data);
+	    } else {
+		q.push(data);
+		ret = co_await drain(piece_pool, q, up, written);
+	    }
+	    if (ret < 0) co_return ret;
+	}
+
+	// GCC 12 evaluates a co_await in either arm of a conditional
+	// operator after co_return, so it's kept out of one
+	if (!chunked) co_return 0;
+	co_return co_await stream.finish(pool);
+    }
+
+    /** stream_body: relay a body lasting until upstream closes in chunks
+     *   so that the client connection outlives it
+     *   @parameters:
+     *      rest: body bytes received along with the header
+     *   @return:
+     *      awaitable of false if it has failed
+     */
+    izumo::core::task<bool>
+    stream_body(izumo::core::mem_pool& pool, izumo::core::async_fd& up,
+		izumo::core::byte_buffer_view rest)
+    {
+	izumo::http::chunked_stream stream(m_queue, m_sock);
+	auto ok = !stream.start() && !co_await stream.write(pool, rest);
+
+	// a frame for every piece; see `send_body`
+	izumo::core::byte_buffer buf(16384);
+	izumo::core::mem_pool piece_pool;
+	while (ok) {
+	    piece_pool.reset();
+
+	    auto n = co_await izumo::core::async_recv(up, buf.ptr(), buf.size());
+	    if (n < 0) {
+		ok = false;
+	    } else if (n == 0) {
+		ok = !co_await stream.finish(piece_pool);
+		break;
+	    } else {
+		ok = !co_await stream.write(piece_pool, izumo::core::byte_buffer_view(buf, n));
+	    }
+	}
+
+	metrics.bytes_out.inc(stream.written());
+	co_return ok;
+    }
+
+    /** forward: relay the request parsed to an upstream server, and its
+     *   response back
+     *   the request header goes out as received, apart from its version
+     *   patched in place and hop-by-hop fields left out; so does the
+     *   response header. the request body is streamed as it arrives, and
+     *   response bodies are spliced unless chunked, or of unknown length
+     *   for a client which could take them chunked.
+     *   @return:
+     *      awaitable of false if the connection has to be closed at once
+     */
+    izumo::core::task<bool>
+    forward(izumo::core::mem_pool& pool)
+    {
+	using izumo::http::header_id;
+	using izumo::http::parse_result;
+
+	auto& req = m_req;
+
+	// responses to pipelined requests before this one go first
+	if (!m_queue.empty() && !co_await flush(pool)) co_return false;
+
+	auto in = m_in.front().slice(m_parser.consumed());
+	std::string_view head = in;
+
+	// "HTTP/1.x" follows the target; upstream is spoken to in 1.1
+	auto target_end = req.target.data() + req.target.size() - head.data();
+	in[target_end + 8] = '1';
+
+	// the client address is appended to those of proxies before
+	char addr[INET_ADDRSTRLEN];
+	inet_ntop(AF_INET, &m_addr.ipv4.sin_addr, addr, sizeof(addr));
+	std::string forwarded_for = "X-Forwarded-For: ";
+	for (auto e = req.headers.find(header_id::x_forwarded_for); e; e = req.headers.find_next(e)) {
+	    forwarded_for.append(e->value).append(", ");
+	}
+	forwarded_for.append(addr).append("\r\n\r\n");
+
+	izumo::http::response res(pool);
+	izumo::http::response_parser parser;
+	izumo::core::byte_buffer res_head;
+	std::size_t received = 0;
+
+	auto& up = m_upstreams->pick();
+	izumo::http::upstream_connection* conn = nullptr;
+	int ret;
+	int client_error = 0;
+	while (true) {
+	    ret = co_await up.acquire(pool, conn);
+	    if (ret < 0) break;
+
+	    // 100 Continue is up to this end, as is the framing of the body
+	    izumo::core::output_queue q;
+	    queue_head(q, head, req.headers, [&req](auto& e) {
+		return e.id == header_id::x_forwarded_for || e.id == header_id::expect
+		    || izumo::http::hop_by_hop(req.headers, e);
+	    });
+	    if (m_body.framing() == izumo::http::body_framing::chunked) {
+		q.push(izumo::http::static_header::transfer_encoding_chunked);
+	    }
+	    q.push(forwarded_for);
+
+	    std::size_t written = 0;
+	    received = 0;
+	    if (m_body_pending) {
+		ret = co_await send_body(pool, q, conn->socket(), client_error);
+		if (client_error) break;
+	    } else {
+		ret = co_await drain(pool, q, conn->socket(), written);
+	    }
+	    if (!ret) ret = co_await conn->receive_head(pool, parser, res, res_head, received);
+	    if (!ret && res.status_code == 101) ret = -EPROTO; // never asked for
+	    if (!ret) break;
+
+	    // upstream may have closed it while idle, unnoticed so far; a
+	    // body once read cannot be sent again
+	    auto retry = conn->reused() && !received && izumo::http::idempotent(req.method)
+		&& !m_head.ptr();
+	    up.release(conn, false);
+	    conn = nullptr;
+	    if (!retry) break;
+
+	    parser.reset();
+	    res.clear();
+	}
+
+	if (client_error) {
+	    if (conn) up.release(conn, false);
+	    if (client_error == -EPROTO) {
+		reject(RESPONSE_400);
+	    } else if (client_error == -EMSGSIZE) {
+		reject(RESPONSE_413);
+	    } else {
+		co_return false;
+	    }
+	    co_return true;
+	}
+
+	izumo::http::body_decoder decoder;
+	if (!ret && !decoder.start_response(res, req.method == "HEAD")) ret = -EPROTO;
+
+	if (ret < 0) {
+	    metrics.upstream_errors.inc();
+	    izumo::core::log::warn("Upstream failed: {}", izumo::core::osexception(-ret).what());
+	    if (conn) up.release(conn, false);
+	    respond_status(req, ret == -ETIMEDOUT ? 504 : 502);
+	    co_return true;
+	}
+	metrics.proxied.inc();
+
+	// a client of HTTP/1.0 knows no chunks, so it learns where a body
+	// ends, unless by length, from the connection being closed; those
+	// of 1.1 are sent bodies lasting until close in chunks instead
+	auto framing = decoder.framing();
+	auto until_close = framing == izumo::http::body_framing::until_close;
+	auto dechunk = framing == izumo::http::body_framing::chunked && req.httpver_minor == 0;
+	auto rechunk = until_close && req.httpver_minor >= 1;
+	if (dechunk || (until_close && !rechunk)) m_closing = true;
+
+	auto head_size = parser.consumed();
+	res_head.ptr()[7] = '1';
+	queue_head(m_queue, izumo::core::byte_buffer_view(res_head, head_size), res.headers,
+		   [&res, dechunk](auto& e) {
+		       // framing of the body is kept as it is
+		       if (e.id == header_id::transfer_encoding) return dechunk;
+		       return izumo::http::hop_by_hop(res.headers, e);
+		   });
+	if (rechunk) m_queue.push(izumo::http::static_header::transfer_encoding_chunked);
+	if (m_closing) {
+	    m_queue.push(izumo::http::static_header::connection_close);
+	} else if (req.httpver_minor == 0) {
+	    m_queue.push(izumo::http::static_header::connection_keep_alive);
+	}
+	m_queue.push("\r\n");
+
+	// then the body, starting with what has come along with the header
+	auto rest = izumo::core::byte_buffer_view(res_head, head_size, received);
+	if (rechunk) {
+	    auto ok = co_await stream_body(pool, conn->socket(), rest);
+	    up.release(conn, false);
+	    co_return ok;
+	}
+
+	std::size_t used;
+	auto result = queue_body(decoder, rest, m_queue, dechunk, used);
+
+	// bytes after the response mean upstream is out of step
+	auto persist = used == rest.size() && izumo::http::keep_alive(res) && !until_close;
+
+	auto ok = co_await flush(pool);
+	if (ok && result == parse_result::incomplete) {
+	    if (framing == izumo::http::body_framing::chunked) {
+		// a frame for every piece; see `send_body`
+		izumo::core::byte_buffer buf(16384);
+		izumo::core::mem_pool piece_pool;
+		while (ok && result == parse_result::incomplete) {
+		    piece_pool.reset();
+		    auto n = co_await izumo::core::async_recv(conn->socket(), buf.ptr(), buf.size());
+		    if (n <= 0) {
+			ok = false;
+			break;
+		    }
+
+		    result = queue_body(decoder, izumo::core::byte_buffer_view(buf, n), m_queue,
+					dechunk, used);
+		    if (used < static_cast<std::size_t>(n)) persist = false;
+		    ok = co_await flush(piece_pool);
 		}
-		return false;
+		ok = ok && result == parse_result::done;
+	    } else {
+		auto length = framing == izumo::http::body_framing::length ? decoder.remaining() : UINT64_MAX;
+		ok = co_await splice_body(pool, conn->socket(), length) == 0;
 	    }
+	} else if (result == parse_result::error) {
+	    ok = false;
+	}
+
+	up.release(conn, ok && persist);
+
+	// the client cannot tell a response cut short from a whole one
+	// but by the connection being closed
+	co_return ok;
+    }
 
-	    if (ret == 0) {
-		stop();
-		return false;
+    // serve requests until the connection is closed, then destroy this
+    izumo::core::task<>
+    run(izumo::core::frame_slot<RUN_FRAME_SIZE>&)
+    {
+	// where the loop can, bytes are received as they arrive with no
+	// syscall, and there's no edge to wait for before receiving
+	m_sock.receive_into(m_in);
+
+	// nothing has been read, so the first edge is still to come
+	auto drained = true;
+
+	while (true) {
+	    if (drained && m_in.empty()) {
+		// an idle connection keeps no input block, nor the chunk of
+		// a request pool
+		m_in.shrink();
+		m_req_pool = izumo::core::mem_pool();
+		if (co_await izumo::core::async_readable(m_sock) < 0) break;
 	    }
 
-	    if (ret == m_write_view.size()) {
-		stop();
-		return false;
+	    auto ret = co_await izumo::core::async_recv(m_sock, m_in, drained);
+	    if (ret <= 0) break;
+
+	    metrics.bytes_in.inc(ret);
+
+	    // every pipelined request received so far is answered by one
+	    // sendmsg, apart from file bodies
+	    process();
+
+	    // serving stops at a request to be forwarded, or with a body,
+	    // until it's done
+	    auto alive = true;
+	    while (m_forwarding || m_body_pending) {
+		if (m_forwarding) {
+		    m_forwarding = false;
+		    if (!(alive = co_await forward(m_req_pool))) break;
+		}
+		if (m_body_pending && !m_closing) {
+		    // the response need not wait for a body it doesn't use
+		    if (!m_queue.empty() && !(alive = co_await flush(m_req_pool))) break;
+		    if (!(alive = co_await skip_body(m_req_pool))) break;
+		}
+
+		finish_request();
+		process();
 	    }
-	    
-	    m_write_view = m_write_view.slice(ret, m_write_view.size());
+	    if (!alive) break;
+
+	    // the peer has shut down writing and everything it sent is read
+	    // and answered, so the recv which would return 0 is saved. bytes
+	    // received by the loop meanwhile are still to be answered
+	    if (m_sock.hangup() && drained && m_in.empty()) m_closing = true;
+
+	    if (!m_queue.empty() && !co_await flush(m_req_pool)) break;
+	    if (m_closing) break;
+	}
+
+	shutdown(m_sock.fd(), SHUT_RDWR);
+	metrics.open.dec();
+
+	// the frame is in m_frame, so this is destroyed once it's done
+	izumo::core::ev_loop::instance().post([this] { m_owner.destroy(this); });
+    }
+
+public:
+    client(int fd, const izm_sockaddr& addr, client_pool& owner, izumo::http::file_cache* files,
+	   upstream_set* upstreams):
+	m_sock(fd),
+	m_files(files),
+	m_upstreams(upstreams),
+	m_req(m_req_pool),
+	m_owner(owner),
+	m_addr(addr)
+    {
+	izumo::core::log::info("New client: {}:{}",
+			       inet_ntoa(m_addr.ipv4.sin_addr),
+			       ntohs(m_addr.ipv4.sin_port));
+
+	// a connection waiting longer for anything is closed
+	m_sock.set_timeout(IDLE_TIMEOUT);
+	metrics.open.inc();
+    }
+
+    ~client()
+    {
+	if (m_pipe[0] >= 0) {
+	    close(m_pipe[0]);
+	    close(m_pipe[1]);
 	}
     }
+
+    // start serving the connection on the loop of current thread
+    void start() { izumo::core::spawn(run(m_frame)); }
 };
 
 class acceptor: public izumo::core::ev_watcher {
@@ -212,23 +1182,46 @@ private:
 	int fd;
 	izm_sockaddr addr;
     };
-    std::array<queue_entry, 128> m_queue;
-    std::size_t m_qp = 0;
+    // connections accepted in current iteration; storage is kept
+    std::vector<queue_entry> m_queue;
+    client_pool& m_clients;
+    izumo::http::file_cache* m_files;
+    upstream_set* m_upstreams;
     
 public:
-    acceptor(uint16_t port): ev_watcher(bind_listen_sock(port)) {
-	izumo::core::log::info("Listening on {}", port);
-    }
+    acceptor(int listen_fd, client_pool& clients, izumo::http::file_cache* files,
+	     upstream_set* upstreams):
+	ev_watcher(listen_fd), m_clients(clients), m_files(files), m_upstreams(upstreams)
+    {}
+    ~acceptor() { close(m_fd); }
     
+    // connections accepted by the loop come without their address
+    void
+    on_accepted(int fd) override
+    {
+	if (fd < 0) throw izumo::core::osexception(-fd);
+	metrics.accepted.inc();
+
+	izm_sockaddr addr;
+	addr.len = sizeof(addr.ipv4);
+	if (getpeername(fd, &addr.untyped, &addr.len) < 0) {
+	    std::memset(&addr, 0, sizeof(addr));
+	    addr.untyped.sa_family = AF_INET;
+	}
+
+	auto c = m_clients.construct(fd, addr, m_clients, m_files, m_upstreams);
+	c->start();
+    }
+
     bool
     on_event(bool r, bool) override
     {
 	if (!r) return false;
 
-	bool do_defer = false;
-
+	// accept until there's none left; this is edge triggered
 	while (true) {
-	    auto& qe = m_queue[m_qp];
+	    queue_entry qe;
+	    qe.addr.len = sizeof(qe.addr.ipv4);
 	    auto ret = accept4(m_fd, &qe.addr.untyped, &qe.addr.len, SOCK_NONBLOCK);
 	    
 	    if (ret < 0) {
@@ -238,36 +1231,202 @@ public:
 		break;
 	    }
 	    qe.fd = ret;
-
-	    do_defer = true;
-	    ++m_qp;
-	    if (m_qp == 128) break;
+	    metrics.accepted.inc();
+	    m_queue.push_back(qe);
 	}
 
-	return do_defer;
+	return !m_queue.empty();
     }
 
     void
     on_deferred() override {
-	for (std::size_t i = 0; i < m_qp; ++i) {
-	    izumo::core::mem_pool p;
-	    auto addr = p.make_unique<izm_sockaddr>();
-	    *addr = m_queue[i].addr;
-	    auto c = new client(m_queue[i].fd, std::move(addr), std::move(p));
-	    izumo::core::ev_loop::instance().add_watcher(*c);
+	for (auto& qe: m_queue) {
+	    auto c = m_clients.construct(qe.fd, qe.addr, m_clients, m_files, m_upstreams);
+	    c->start();
+	}
+
+	m_queue.clear();
+    }
+};
+
+// gives I/O blocks freed by a worker back to the kernel now and then,
+// so memory of a burst of connections does not stay resident
+class slab_trimmer: public izumo::core::ev_watcher {
+private:
+    constexpr static izumo::core::timedelta_ms_t INTERVAL = 5000;
+
+    izumo::core::timer_id m_timer = izumo::core::NULL_TIMER;
+
+public:
+    // never added as a watcher; only its timer is used
+    slab_trimmer(): ev_watcher(-1) {}
+
+    void
+    start()
+    {
+	m_timer = izumo::core::ev_loop::instance().add_timer(*this, INTERVAL);
+    }
+
+    void
+    stop()
+    {
+	izumo::core::ev_loop::instance().cancel_timer(m_timer);
+    }
+
+    void
+    on_timeout(izumo::core::timer_id) override
+    {
+	izumo::core::slab_allocator::trim();
+	start();
+    }
+
+    bool on_event(bool, bool) override { return false; }
+};
+
+// a worker thread running its own ev_loop with its own listening socket
+class worker {
+private:
+    std::size_t m_id;
+    int m_listen_fd;
+    int m_cpu;			// cpu to pin to, or -1
+
+    // loop of the worker thread, known once it has started
+    std::promise<izumo::core::ev_loop*> m_loop;
+    std::thread m_thread;
+
+    void
+    run()
+    {
+	izumo::core::logger::get().set_name(fmt::format("worker-{}", m_id));
+
+	if (m_cpu >= 0) {
+	    cpu_set_t set;
+	    CPU_ZERO(&set);
+	    CPU_SET(m_cpu, &set);
+	    auto err = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+	    if (err) {
+		izumo::core::log::warn("Failed to pin to cpu {}: {}", m_cpu,
+				       izumo::core::osexception(err).what());
+	    }
+	}
+
+	auto& loop = izumo::core::ev_loop::instance();
+	m_loop.set_value(&loop);
+
+	// every worker has its own cache, so lookups never contend
+	std::unique_ptr<izumo::http::file_cache> files;
+	if (cmdargs.root) {
+	    files = std::make_unique<izumo::http::file_cache>(cmdargs.root);
+	    loop.add_watcher(*files, izumo::core::EV_READ);
 	}
 
-	m_qp = 0;
+	std::unique_ptr<upstream_set> upstreams;
+	if (!cmdargs.upstreams.empty()) upstreams = std::make_unique<upstream_set>(cmdargs.upstreams);
+
+	// connections of this worker; those still open when it stops are
+	// left behind with the loop, as they were with `new`
+	client_pool clients;
+	acceptor ac(m_listen_fd, clients, files.get(), upstreams.get());
+
+	// every worker listens on a socket of its own, so accepting needs
+	// no EV_EXCLUSIVE. where the loop accepts, no edge is waited for
+	loop.add_watcher(ac, 0);
+	if (!loop.accept_multishot(ac)) loop.modify_watcher(ac, izumo::core::EV_READ);
+
+	slab_trimmer trimmer;
+	trimmer.start();
+	loop.run_forever();
+	trimmer.stop();
+
+	loop.remove_watcher(ac);
+	if (files) loop.remove_watcher(*files);
     }
+
+public:
+    worker(std::size_t id, int listen_fd, int cpu):
+	m_id(id), m_listen_fd(listen_fd), m_cpu(cpu),
+	m_thread(&worker::run, this)
+    {}
+
+    // ask worker loop to stop; `join` should be called afterwards
+    void
+    stop()
+    {
+	m_loop.get_future().get()->post([] { izumo::core::ev_loop::instance().stop(); });
+    }
+
+    void join() { m_thread.join(); }
 };
 
+// cpus this process is allowed to run on
+static std::vector<int>
+allowed_cpus()
+{
+    cpu_set_t set;
+    if (sched_getaffinity(0, sizeof(set), &set) < 0) {
+	throw izumo::core::osexception();
+    }
+
+    std::vector<int> ret;
+    for (int i = 0; i < CPU_SETSIZE; ++i) {
+	if (CPU_ISSET(i, &set)) ret.push_back(i);
+    }
+    return ret;
+}
+
 int
 main(int argc, char *argv[])
 {
     parse_opts(argc, argv);
-    acceptor ac(cmdargs.port_h);
 
-    auto& loop = izumo::core::ev_loop::instance();
-    loop.add_watcher(ac);
-    loop.run_forever();
+    // keep event loops clear of terminal writes; lines are dropped
+    // rather than stalling a loop when the terminal falls behind
+    izumo::core::logger::set_default_output(
+	std::make_unique<izumo::core::log_output_async>(STDOUT_FILENO));
+
+    if (cmdargs.evloop && !izumo::core::ev_loop::set_default_impl(cmdargs.evloop)) {
+	fmt::print("Unknown ev_loop implementation: {}\n", cmdargs.evloop);
+	std::exit(-1);
+    }
+
+    // workers open document root on their own; fail early instead
+    if (cmdargs.root) {
+	try {
+	    izumo::http::file_cache check(cmdargs.root);
+	} catch (const izumo::core::osexception& e) {
+	    fmt::print("Cannot serve {}: {}\n", cmdargs.root, e.what());
+	    std::exit(-1);
+	}
+    }
+
+    izumo::core::slab_allocator::set_huge_pages(cmdargs.huge_pages);
+
+    // a peer gone while sendfile or splice writes to it is reported
+    // as EPIPE; there's no MSG_NOSIGNAL for them
+    signal(SIGPIPE, SIG_IGN);
+
+    auto cpus = allowed_cpus();
+    std::size_t nthreads = cmdargs.threads ? cmdargs.threads : cpus.size();
+
+    // block termination signals before spawning workers so that
+    // only the main thread receives them, through `sigwait`
+    sigset_t sigs;
+    sigemptyset(&sigs);
+    sigaddset(&sigs, SIGINT);
+    sigaddset(&sigs, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &sigs, nullptr);
+
+    std::vector<std::unique_ptr<worker>> workers;
+    for (std::size_t i = 0; i < nthreads; ++i) {
+	auto cpu = cmdargs.pin_cpus ? cpus[i % cpus.size()] : -1;
+	workers.push_back(std::make_unique<worker>(i, bind_listen_sock(cmdargs.port_h), cpu));
+    }
+    izumo::core::log::info("Listening on {} with {} worker(s)", cmdargs.port_h, nthreads);
+
+    int sig;
+    sigwait(&sigs, &sig);
+    izumo::core::log::info("Received signal {}, shutting down", sig);
+
+    for (auto& w: workers) w->stop();
+    for (auto& w: workers) w->join();
 }
@@ -2,6 +2,11 @@
 
 #include <iostream>
 #include <string_view>
+#include <cerrno>
+#include <cstring>
+
+#include <limits.h>
+#include <sys/uio.h>
 
 namespace izumo::core {
     std::unique_ptr<log_output> logger::default_output { new log_output_stdout };
@@ -20,6 +25,32 @@ namespace izumo::core {
 	logger::default_output = std::move(output);
     }
 
+    void
+    logger::set_name(std::string name)
+    {
+	m_name = std::move(name);
+    }
+
+    void
+    logger::set_output(std::unique_ptr<log_output> output)
+    {
+	m_output = std::move(output);
+    }
+
+    // formatting local time is expensive, so it is done once per second
+    const char*
+    logger::m_time_string(std::time_t now) noexcept
+    {
+	if (now != m_time_cached) {
+	    std::tm tm;
+	    localtime_r(&now, &tm);
+	    std::strftime(m_time_str, sizeof(m_time_str), "%Y-%m-%d %H:%M:%S", &tm);
+	    m_time_cached = now;
+	}
+
+	return m_time_str;
+    }
+
     void
     log_output_stdout::out(const char *str, std::size_t len)
     {
@@ -29,4 +60,204 @@ namespace izumo::core {
 	// problem for simple logging
 	std::cout << std::string_view(str, len) << std::endl;
     }
+
+    // a byte ring written by one logging thread and read by the writer.
+    // positions only grow; they are masked when indexing
+    struct log_output_async::ring {
+	std::thread::id owner;
+	std::unique_ptr<char[]> buf;
+	std::size_t mask;
+
+	alignas(64) std::atomic<std::size_t> head {0}; // advanced by producer
+	alignas(64) std::atomic<std::size_t> tail {0}; // advanced by writer
+
+	ring(std::thread::id owner, std::size_t size):
+	    owner(owner), buf(new char[size]), mask(size - 1)
+	{}
+
+	std::size_t capacity() const noexcept { return mask + 1; }
+    };
+
+    static std::atomic<uint64_t> _log_output_async_serial {0};
+
+    log_output_async::log_output_async(int fd, overflow_policy policy, std::size_t ring_size):
+	m_serial(++_log_output_async_serial),
+	m_fd(fd),
+	m_policy(policy),
+	m_ring_size(ring_size)
+    {
+	assert(ring_size && (ring_size & (ring_size - 1)) == 0);
+	m_writer = std::thread(&log_output_async::m_writer_main, this);
+    }
+
+    log_output_async::~log_output_async()
+    {
+	{
+	    std::lock_guard<std::mutex> lock(m_mutex);
+	    m_stopping = true;
+	}
+	m_writer_cv.notify_one();
+	m_writer.join();
+    }
+
+    log_output_async::ring&
+    log_output_async::m_get_ring()
+    {
+	static thread_local uint64_t cached_serial = 0;
+	static thread_local ring* cached = nullptr;
+	if (cached_serial == m_serial) return *cached;
+
+	std::lock_guard<std::mutex> lock(m_mutex);
+
+	// a ring left by an exited thread may be picked up by a new thread
+	// with the same id; it is safe since there's still one producer
+	auto id = std::this_thread::get_id();
+	ring* ret = nullptr;
+	for (auto& r: m_rings) {
+	    if (r->owner == id) ret = r.get();
+	}
+
+	if (!ret) {
+	    m_rings.push_back(std::make_unique<ring>(id, m_ring_size));
+	    ret = m_rings.back().get();
+	}
+
+	cached_serial = m_serial;
+	cached = ret;
+	return *ret;
+    }
+
+    void
+    log_output_async::m_wake_writer()
+    {
+	std::lock_guard<std::mutex> lock(m_mutex);
+	m_writer_cv.notify_one();
+    }
+
+    void
+    log_output_async::out(const char* str, std::size_t len)
+    {
+	auto& r = m_get_ring();
+
+	// every line is terminated by a newline and stored as a whole
+	len = std::min(len, r.capacity() - 1);
+	auto need = len + 1;
+
+	auto head = r.head.load(std::memory_order_relaxed);
+	auto has_room = [&] {
+	    return r.capacity() - (head - r.tail.load(std::memory_order_acquire)) >= need;
+	};
+
+	if (!has_room()) {
+	    if (m_policy == overflow_policy::drop) {
+		m_dropped.fetch_add(1, std::memory_order_relaxed);
+		if (m_writer_idle.load()) m_wake_writer();
+		return;
+	    }
+
+	    std::unique_lock<std::mutex> lock(m_mutex);
+	    ++m_blocked;
+	    m_writer_cv.notify_one();
+	    m_space_cv.wait(lock, has_room);
+	    --m_blocked;
+	}
+
+	auto off = head & r.mask;
+	auto first = std::min(len, r.capacity() - off);
+	std::memcpy(r.buf.get() + off, str, first);
+	std::memcpy(r.buf.get(), str + first, len - first);
+	r.buf[(head + len) & r.mask] = '\n';
+
+	// pairs with the writer going idle; one of us sees the other
+	r.head.store(head + need, std::memory_order_seq_cst);
+	if (m_writer_idle.load(std::memory_order_seq_cst)) m_wake_writer();
+    }
+
+    // write out what is in every ring. return whether anything is written
+    bool
+    log_output_async::m_drain()
+    {
+	// rings are never removed, so pointers stay valid after unlocking
+	static thread_local std::vector<ring*> rings;
+	{
+	    std::lock_guard<std::mutex> lock(m_mutex);
+	    rings.clear();
+	    for (auto& r: m_rings) rings.push_back(r.get());
+	}
+
+	constexpr std::size_t MAX_IOV = IOV_MAX < 1024 ? IOV_MAX : 1024;
+	iovec iov[MAX_IOV];
+	ring* owners[MAX_IOV];
+	std::size_t niov = 0;
+
+	for (auto r: rings) {
+	    if (niov + 2 > MAX_IOV) break;
+
+	    auto head = r->head.load(std::memory_order_seq_cst);
+	    auto tail = r->tail.load(std::memory_order_relaxed);
+	    if (head == tail) continue;
+
+	    // pending bytes wrap around the end at most once
+	    auto off = tail & r->mask;
+	    auto first = std::min(head - tail, r->capacity() - off);
+	    iov[niov] = { r->buf.get() + off, first };
+	    owners[niov++] = r;
+	    if (first < head - tail) {
+		iov[niov] = { r->buf.get(), head - tail - first };
+		owners[niov++] = r;
+	    }
+	}
+
+	if (!niov) return false;
+
+	auto ret = writev(m_fd, iov, niov);
+	if (ret < 0 && errno == EINTR) return true;
+
+	// on other errors lines are discarded, otherwise they'd pile up forever
+	std::size_t written = ret < 0 ? SIZE_MAX : ret;
+	for (std::size_t i = 0; i < niov && written; ++i) {
+	    auto n = std::min(written, iov[i].iov_len);
+	    auto tail = owners[i]->tail.load(std::memory_order_relaxed);
+	    owners[i]->tail.store(tail + n, std::memory_order_release);
+	    written -= n;
+	}
+
+	if (m_blocked.load()) {
+	    std::lock_guard<std::mutex> lock(m_mutex);
+	    m_space_cv.notify_all();
+	}
+	return true;
+    }
+
+    // whether any ring has pending bytes; called with m_mutex held
+    bool
+    log_output_async::m_pending() const noexcept
+    {
+	for (auto& r: m_rings) {
+	    if (r->head.load(std::memory_order_seq_cst) != r->tail.load(std::memory_order_relaxed)) {
+		return true;
+	    }
+	}
+
+	return false;
+    }
+
+    void
+    log_output_async::m_writer_main()
+    {
+	while (true) {
+	    if (m_drain()) continue;
+
+	    std::unique_lock<std::mutex> lock(m_mutex);
+	    if (m_stopping) break;
+
+	    // lines written before we went idle would be missed otherwise
+	    m_writer_idle.store(true, std::memory_order_seq_cst);
+	    if (!m_pending()) m_writer_cv.wait_for(lock, std::chrono::milliseconds(100));
+	    m_writer_idle.store(false);
+	}
+
+	// flush whatever is left on shutdown
+	while (m_drain()) {}
+    }
 }
@@ -1,4 +1,5 @@
 #include <core/mem.hh>
+#include <core/slab.hh>
 
 #include <cassert>
 #include <cstdlib>
@@ -6,16 +7,54 @@
 #include <memory>
 
 namespace izumo::core {
+    // released chunks of current thread, linked through their headers.
+    // chunks are slab blocks, so those beyond the cache can be trimmed
+    struct _mem_chunk_cache {
+	_mem_chunk_header* head = nullptr;
+	std::size_t count = 0;
+	std::size_t limit = mem_pool::DEFAULT_CACHE_LIMIT;
+	uint64_t hits = 0;
+	uint64_t misses = 0;
+
+	void
+	trim(std::size_t n) noexcept
+	{
+	    while (count > n) {
+		auto prev = head->prev;
+		slab_allocator::deallocate(head, mem_pool::CHUNK_SIZE);
+		head = prev;
+		--count;
+	    }
+	}
+
+	~_mem_chunk_cache()
+	{
+	    trim(0);
+	    // pools destructed later on this thread free their chunks directly
+	    limit = 0;
+	}
+    };
+
+    static thread_local _mem_chunk_cache chunk_cache;
+
     // allocate a chunk of memory for pool
     // return nullptr when allocation failed
     static _mem_chunk_header*
     alloc_chunk() noexcept
     {
-	auto mem = std::malloc(mem_pool::CHUNK_SIZE);
-	if (!mem) return nullptr;
-	
+	void* mem = chunk_cache.head;
+	if (mem) {
+	    chunk_cache.head = chunk_cache.head->prev;
+	    --chunk_cache.count;
+	    ++chunk_cache.hits;
+	} else {
+	    mem = slab_allocator::allocate(mem_pool::CHUNK_SIZE);
+	    if (!mem) return nullptr;
+	    ++chunk_cache.misses;
+	}
+
 	auto ret = new (mem) _mem_chunk_header();
-	ret->remaining = mem_pool::CHUNK_SIZE - sizeof(ret);
+	ret->remaining = mem_pool::CHUNK_SIZE - sizeof(_mem_chunk_header);
 	return ret;
     }
 
@@ -23,9 +62,16 @@ namespace izumo::core {
     static void
     dealloc_chunk(_mem_chunk_header* ptr) noexcept
     {
-	free(ptr);
+	if (chunk_cache.count >= chunk_cache.limit) {
+	    slab_allocator::deallocate(ptr, mem_pool::CHUNK_SIZE);
+	    return;
+	}
+
+	ptr->prev = chunk_cache.head;
+	chunk_cache.head = ptr;
+	++chunk_cache.count;
     }
-    
+
     // allocate memory for a large object
     // return nullptr when allocation failed
     static _mem_large_meta*
@@ -38,7 +84,9 @@ namespace izumo::core {
 
 	auto _alignment = std::max(alignment, alignof(_mem_large_meta));
 	auto _size = size + sizeof(_mem_large_meta);
+	_size = (_size + _alignment - 1) / _alignment * _alignment;
 	auto mem = std::aligned_alloc(_alignment, _size);
+	if (!mem) return nullptr;
 
 	// put meta in the tail of memory only if the large object
 	// has a more struct align requirement
@@ -83,7 +131,6 @@ namespace izumo::core {
 	auto ret = static_cast<char*>(std::align(alignment, size, _ptr, chunk->remaining));
 	if (!ret) return nullptr;
 
-	ret += size;
 	chunk->remaining -= size;
 
 	return ret;
@@ -154,20 +201,85 @@ namespace izumo::core {
 	rhs.m_large_p = nullptr;
     }
 
+    mem_pool&
+    mem_pool::operator=(mem_pool&& rhs) noexcept
+    {
+	if (this == &rhs) return *this;
+
+	m_release();
+	m_chunk_p = rhs.m_chunk_p;
+	m_large_p = rhs.m_large_p;
+
+	rhs.m_chunk_p = nullptr;
+	rhs.m_large_p = nullptr;
+	return *this;
+    }
+
+    void
+    mem_pool::reset() noexcept
+    {
+	auto lp = m_large_p;
+	while (lp) {
+	    auto prev = lp->prev;
+	    dealloc_large(lp);
+	    lp = prev;
+	}
+	m_large_p = nullptr;
+
+	auto cp = m_chunk_p;
+	if (!cp) return;
+
+	while (cp->prev) {
+	    auto prev = cp->prev;
+	    dealloc_chunk(cp);
+	    cp = prev;
+	}
+
+	cp->remaining = CHUNK_SIZE - sizeof(_mem_chunk_header);
+	m_chunk_p = cp;
+    }
+
+    void
+    mem_pool::set_cache_limit(std::size_t chunks) noexcept
+    {
+	chunk_cache.limit = chunks;
+	chunk_cache.trim(chunks);
+    }
+
+    mem_pool_cache_stats
+    mem_pool::cache_stats() noexcept
+    {
+	mem_pool_cache_stats ret;
+	ret.hits = chunk_cache.hits;
+	ret.misses = chunk_cache.misses;
+	ret.retained_bytes = chunk_cache.count * CHUNK_SIZE;
+	return ret;
+    }
+
     mem_pool::~mem_pool()
     {
-	// deallocate every chunk
+	m_release();
+    }
+
+    // deallocate every chunk and large object
+    void
+    mem_pool::m_release() noexcept
+    {
 	auto cp = m_chunk_p;
 	while (cp) {
-	    cp = cp->prev;
+	    auto prev = cp->prev;
 	    dealloc_chunk(cp);
+	    cp = prev;
 	}
 
-	// deallocate every large object
 	auto lp = m_large_p;
 	while (lp) {
-	    lp = lp->prev;
+	    auto prev = lp->prev;
 	    dealloc_large(lp);
+	    lp = prev;
 	}
+
+	m_chunk_p = nullptr;
+	m_large_p = nullptr;
     }
 }
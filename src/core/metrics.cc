@@ -0,0 +1,134 @@
+#include <core/metrics.hh>
+
+#include <algorithm>
+#include <iterator>
+#include <stdexcept>
+
+#include <fmt/format.h>
+
+namespace izumo::core {
+    metrics_registry&
+    metrics_registry::instance()
+    {
+	static metrics_registry ret;
+	return ret;
+    }
+
+    uint32_t
+    metrics_registry::m_add(kind type, std::string name, std::string help, uint32_t ncells)
+    {
+	std::lock_guard<std::mutex> lock(m_mutex);
+
+	// shards are allocated at full size, so cells can be handed out
+	// after threads have got their shards
+	if (MAX_CELLS - m_cells < ncells) {
+	    throw std::length_error("metrics_registry: out of cells");
+	}
+
+	auto offset = m_cells;
+	m_cells += ncells;
+	m_entries.push_back({ type, std::move(name), std::move(help), offset });
+	return offset;
+    }
+
+    metrics_registry::cell_t*
+    metrics_registry::m_new_shard()
+    {
+	auto shard = std::make_unique<cell_t[]>(MAX_CELLS);
+	for (std::size_t i = 0; i < MAX_CELLS; ++i) {
+	    shard[i].store(0, std::memory_order_relaxed);
+	}
+
+	std::lock_guard<std::mutex> lock(m_mutex);
+	m_shards.push_back(std::move(shard));
+	return m_shards.back().get();
+    }
+
+    // sum of a cell over every shard; called with m_mutex held
+    uint64_t
+    metrics_registry::m_sum(uint32_t cell) const noexcept
+    {
+	uint64_t ret = 0;
+	for (auto& s: m_shards) ret += s[cell].load(std::memory_order_relaxed);
+	return ret;
+    }
+
+    counter
+    metrics_registry::add_counter(std::string name, std::string help)
+    {
+	return counter(m_add(kind::counter, std::move(name), std::move(help), 1));
+    }
+
+    gauge
+    metrics_registry::add_gauge(std::string name, std::string help)
+    {
+	return gauge(m_add(kind::gauge, std::move(name), std::move(help), 1));
+    }
+
+    histogram
+    metrics_registry::add_histogram(std::string name, std::string help)
+    {
+	return histogram(m_add(kind::histogram, std::move(name), std::move(help), histogram::CELLS));
+    }
+
+    void
+    metrics_registry::expose(std::string& out) const
+    {
+	std::lock_guard<std::mutex> lock(m_mutex);
+
+	auto it = std::back_inserter(out);
+	for (auto& e: m_entries) {
+	    fmt::format_to(it, "# HELP {} {}\n", e.name, e.help);
+
+	    switch (e.type) {
+	    case kind::counter:
+		fmt::format_to(it, "# TYPE {} counter\n{} {}\n", e.name, e.name, m_sum(e.offset));
+		break;
+
+	    case kind::gauge:
+		fmt::format_to(it, "# TYPE {} gauge\n{} {}\n", e.name, e.name,
+			       static_cast<int64_t>(m_sum(e.offset)));
+		break;
+
+	    case kind::histogram: {
+		fmt::format_to(it, "# TYPE {} histogram\n", e.name);
+
+		// buckets below the first and above the last observed one
+		// add nothing, so they are left out
+		unsigned first = 0, last = 0;
+		uint64_t counts[histogram::BUCKETS];
+		for (unsigned b = 0; b < histogram::BUCKETS; ++b) {
+		    counts[b] = m_sum(e.offset + b);
+		    if (!counts[b]) continue;
+		    if (!last) first = b;
+		    last = b + 1;
+		}
+
+		uint64_t cumulative = 0;
+		for (unsigned b = first; b < last; ++b) {
+		    cumulative += counts[b];
+		    fmt::format_to(it, "{}_bucket{{le=\"{}\"}} {}\n", e.name,
+				   histogram::bucket_max(b) / 1e9, cumulative);
+		}
+
+		// sum and count are read after buckets and may be ahead of them
+		auto count = std::max(cumulative, m_sum(e.offset + histogram::BUCKETS + 1));
+		fmt::format_to(it, "{}_bucket{{le=\"+Inf\"}} {}\n", e.name, count);
+		fmt::format_to(it, "{}_sum {}\n", e.name, m_sum(e.offset + histogram::BUCKETS) / 1e9);
+		fmt::format_to(it, "{}_count {}\n", e.name, count);
+		break;
+	    }
+	    }
+	}
+    }
+
+    uint64_t
+    histogram::bucket_max(unsigned bucket) noexcept
+    {
+	if (bucket < SUBS) return bucket;
+
+	unsigned shift = bucket / SUBS - 1;
+	uint64_t sub = bucket % SUBS;
+	return ((SUBS + sub) << shift) + ((uint64_t(1) << shift) - 1);
+    }
+}
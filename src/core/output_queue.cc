@@ -0,0 +1,137 @@
+#include <core/output_queue.hh>
+
+#include <algorithm>
+
+#include <errno.h>
+#include <sys/sendfile.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+namespace izumo::core {
+    void
+    output_queue::m_push(segment&& seg)
+    {
+	if (!seg.len) return;
+
+	m_bytes += seg.len;
+	m_segments.push_back(std::move(seg));
+    }
+
+    void
+    output_queue::push(std::string_view bytes, std::shared_ptr<const void> owner)
+    {
+	m_push({ kind::memory, -1, reinterpret_cast<const byte_t*>(bytes.data()), nullptr,
+		 0, bytes.size(), std::move(owner) });
+    }
+
+    void
+    output_queue::push(const byte_buffer& buf, std::size_t begin, std::size_t end)
+    {
+	if (!empty()) {
+	    auto& last = m_segments.back();
+	    if (last.type == kind::buffer && last.buf == &buf && last.offset + last.len == begin) {
+		last.len += end - begin;
+		m_bytes += end - begin;
+		return;
+	    }
+	}
+
+	m_push({ kind::buffer, -1, nullptr, &buf, begin, end - begin, {} });
+    }
+
+    void
+    output_queue::push_file(int fd, off_t offset, std::size_t len, std::shared_ptr<const void> owner)
+    {
+	m_push({ kind::file, fd, nullptr, nullptr, static_cast<std::size_t>(offset), len,
+		 std::move(owner) });
+    }
+
+    // mark n bytes from the head as written
+    void
+    output_queue::m_advance(std::size_t n) noexcept
+    {
+	m_bytes -= n;
+	while (n) {
+	    auto& seg = m_segments[m_head];
+	    auto step = std::min(n, seg.len);
+
+	    seg.len -= step;
+	    seg.offset += step;
+	    if (seg.ptr) seg.ptr += step;
+	    n -= step;
+
+	    if (seg.len) break;
+	    seg.owner.reset();
+	    ++m_head;
+	}
+
+	// storage is kept, so steady state does not allocate
+	if (empty()) clear();
+    }
+
+    output_queue::flush_result
+    output_queue::flush(int fd, std::size_t& written)
+    {
+	while (!empty()) {
+	    auto& head = m_segments[m_head];
+
+	    if (head.type == kind::file) {
+		off_t pos = head.offset;
+		auto ret = sendfile(fd, head.fd, &pos, head.len);
+		if (ret < 0) {
+		    if (errno == EINTR) continue;
+		    if (errno == EAGAIN || errno == EWOULDBLOCK) return flush_result::pending;
+		    return flush_result::error;
+		}
+
+		// the file is shorter than promised
+		if (ret == 0) {
+		    errno = EIO;
+		    return flush_result::error;
+		}
+
+		written += ret;
+		m_advance(ret);
+		continue;
+	    }
+
+	    // gather memory segments up to the next file segment
+	    iovec iov[MAX_IOV];
+	    std::size_t niov = 0;
+	    auto i = m_head;
+	    for (; i < m_segments.size() && niov < MAX_IOV; ++i) {
+		auto& seg = m_segments[i];
+		if (seg.type == kind::file) break;
+
+		auto ptr = seg.type == kind::buffer ? seg.buf->ptr() + seg.offset : seg.ptr;
+		iov[niov++] = { const_cast<byte_t*>(ptr), seg.len };
+	    }
+
+	    msghdr msg {};
+	    msg.msg_iov = iov;
+	    msg.msg_iovlen = niov;
+
+	    // more is coming right after; let it share packets
+	    auto flags = MSG_NOSIGNAL | (i < m_segments.size() ? MSG_MORE : 0);
+	    auto ret = sendmsg(fd, &msg, flags);
+	    if (ret < 0) {
+		if (errno == EINTR) continue;
+		if (errno == EAGAIN || errno == EWOULDBLOCK) return flush_result::pending;
+		return flush_result::error;
+	    }
+
+	    written += ret;
+	    m_advance(ret);
+	}
+
+	return flush_result::done;
+    }
+
+    void
+    output_queue::clear() noexcept
+    {
+	m_segments.clear();
+	m_head = 0;
+	m_bytes = 0;
+    }
+}
@@ -0,0 +1,196 @@
+#include <core/slab.hh>
+#include <core/metrics.hh>
+
+#include <algorithm>
+#include <atomic>
+#include <new>
+#include <vector>
+
+#include <sys/mman.h>
+
+namespace izumo::core {
+    static auto _slab_mapped = metrics_registry::instance().add_gauge(
+	"izumo_slab_mapped_bytes", "Bytes of slab arenas mapped");
+    static auto _slab_in_use = metrics_registry::instance().add_gauge(
+	"izumo_slab_in_use_bytes", "Bytes of slab blocks allocated");
+
+    static std::atomic<bool> _slab_huge_pages {false};
+
+    // free blocks of one class. resident ones are linked through their
+    // first word, so freeing never allocates; trimmed ones lose their
+    // content, so they are listed outside of blocks
+    struct _slab_class {
+	char* hot = nullptr;	// resident, most recently freed first
+	std::size_t hot_count = 0;
+	std::vector<char*> cold; // trimmed
+	char* carve = nullptr;	// unused tail of latest arena
+	char* carve_end = nullptr;
+    };
+
+    struct _slab_cache {
+	_slab_class classes[slab_allocator::CLASSES];
+	std::size_t mapped = 0;
+
+	~_slab_cache();
+    };
+
+    static thread_local _slab_cache slab_cache;
+    static thread_local bool slab_cache_gone = false;
+
+    _slab_cache::~_slab_cache()
+    {
+	// arenas may still hold blocks used by other threads, so they
+	// stay mapped; only free memory is released
+	slab_allocator::trim(0);
+	slab_cache_gone = true;
+    }
+
+    static char*&
+    next_of(char* block) noexcept
+    {
+	return *reinterpret_cast<char**>(block);
+    }
+
+    static unsigned
+    class_index(std::size_t size) noexcept
+    {
+	unsigned i = 0;
+	while (slab_allocator::CLASS_SIZES[i] != size) ++i;
+	return i;
+    }
+
+    // map an arena aligned to its size, so it can be backed by huge pages
+    static char*
+    map_arena() noexcept
+    {
+	constexpr auto size = slab_allocator::ARENA_SIZE;
+
+	auto mem = mmap(nullptr, size * 2, PROT_READ | PROT_WRITE,
+			MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+	if (mem == MAP_FAILED) return nullptr;
+
+	auto addr = reinterpret_cast<uintptr_t>(mem);
+	auto aligned = (addr + size - 1) & ~(size - 1);
+	if (aligned > addr) munmap(mem, aligned - addr);
+	munmap(reinterpret_cast<void*>(aligned + size), addr + size - aligned);
+
+	auto ret = reinterpret_cast<char*>(aligned);
+#ifdef MADV_HUGEPAGE
+	if (_slab_huge_pages.load(std::memory_order_relaxed)) madvise(ret, size, MADV_HUGEPAGE);
+#endif
+	return ret;
+    }
+
+    void*
+    slab_allocator::allocate(std::size_t size) noexcept
+    {
+	if (slab_cache_gone) return nullptr;
+
+	auto& c = slab_cache.classes[class_index(size)];
+
+	char* ret;
+	if (c.hot) {
+	    ret = c.hot;
+	    c.hot = next_of(ret);
+	    --c.hot_count;
+	} else if (!c.cold.empty()) {
+	    ret = c.cold.back();
+	    c.cold.pop_back();
+	} else {
+	    if (c.carve == c.carve_end) {
+		auto arena = map_arena();
+		if (!arena) return nullptr;
+
+		c.carve = arena;
+		c.carve_end = arena + ARENA_SIZE;
+		slab_cache.mapped += ARENA_SIZE;
+		_slab_mapped.add(ARENA_SIZE);
+	    }
+
+	    ret = c.carve;
+	    c.carve += size;
+	}
+
+	_slab_in_use.add(size);
+	return ret;
+    }
+
+    void
+    slab_allocator::deallocate(void* ptr, std::size_t size) noexcept
+    {
+	_slab_in_use.add(-static_cast<int64_t>(size));
+
+	// freed by thread-local objects destructed after the cache
+	if (slab_cache_gone) {
+	    madvise(ptr, size, MADV_DONTNEED);
+	    return;
+	}
+
+	auto& c = slab_cache.classes[class_index(size)];
+	auto block = static_cast<char*>(ptr);
+	next_of(block) = c.hot;
+	c.hot = block;
+	++c.hot_count;
+    }
+
+    std::size_t
+    slab_allocator::trim(std::size_t keep) noexcept
+    {
+	std::size_t ret = 0;
+
+	for (unsigned i = 0; i < CLASSES; ++i) {
+	    auto& c = slab_cache.classes[i];
+	    auto size = CLASS_SIZES[i];
+	    if (c.hot_count <= keep) continue;
+
+	    // if the list of trimmed blocks can't grow, they all stay resident
+	    auto n = c.hot_count - keep;
+	    auto first = c.cold.size();
+	    try {
+		c.cold.reserve(first + n);
+	    } catch (const std::bad_alloc&) {
+		continue;
+	    }
+
+	    // least recently freed blocks are at the back of the list
+	    char** link = &c.hot;
+	    for (std::size_t j = 0; j < keep; ++j) link = &next_of(*link);
+	    for (auto b = *link; b; b = next_of(b)) c.cold.push_back(b);
+	    *link = nullptr;
+	    c.hot_count = keep;
+
+	    // adjacent ones are given back with one madvise
+	    auto trimmed = c.cold.begin() + first;
+	    std::sort(trimmed, c.cold.end());
+	    for (auto j = trimmed; j != c.cold.end();) {
+		auto begin = *j;
+		auto end = begin + size;
+		for (++j; j != c.cold.end() && *j == end; ++j) end += size;
+		madvise(begin, end - begin, MADV_DONTNEED);
+	    }
+
+	    ret += n * size;
+	}
+
+	return ret;
+    }
+
+    void
+    slab_allocator::set_huge_pages(bool enabled) noexcept
+    {
+	_slab_huge_pages.store(enabled, std::memory_order_relaxed);
+    }
+
+    slab_stats
+    slab_allocator::stats() noexcept
+    {
+	slab_stats ret;
+	ret.mapped_bytes = slab_cache.mapped;
+	for (unsigned i = 0; i < CLASSES; ++i) {
+	    ret.free_bytes += slab_cache.classes[i].hot_count * CLASS_SIZES[i];
+	    ret.trimmed_bytes += slab_cache.classes[i].cold.size() * CLASS_SIZES[i];
+	}
+
+	return ret;
+    }
+}
@@ -0,0 +1,278 @@
+#include <core/timer_wheel.hh>
+
+#include <algorithm>
+#include <cassert>
+#include <limits>
+
+namespace izumo::core {
+    // index of first set bit at or after `from` in a bitmap of `nbits` bits
+    // return `nbits` if there is none
+    static unsigned
+    find_next_set(const uint64_t* map, unsigned from, unsigned nbits) noexcept
+    {
+	for (unsigned w = from / 64; w < nbits / 64; ++w) {
+	    auto bits = map[w];
+	    if (w == from / 64) bits &= ~uint64_t(0) << (from % 64);
+	    if (bits) return w * 64 + __builtin_ctzll(bits);
+	}
+
+	return nbits;
+    }
+
+    static timer_id
+    make_timer_id(uint32_t index, uint32_t generation) noexcept
+    {
+	return (static_cast<uint64_t>(generation) << 32) | index;
+    }
+
+    timer_wheel::timer_wheel(timestamp_ms_t now) noexcept:
+	m_now(now)
+    {
+	std::fill(&m_slots[0][0], &m_slots[0][0] + LEVELS * SLOTS, NIL);
+	std::fill(&m_bitmap[0][0], &m_bitmap[0][0] + LEVELS * SLOTS / 64, 0);
+    }
+
+    // get node of a pending timer, or nullptr if id is stale
+    timer_wheel::node*
+    timer_wheel::m_get(timer_id id) noexcept
+    {
+	auto index = static_cast<uint32_t>(id);
+	auto generation = static_cast<uint32_t>(id >> 32);
+	if (index >= m_nodes.size()) return nullptr;
+
+	auto& n = m_nodes[index];
+	if (n.generation != generation || !n.watcher) return nullptr;
+	return &n;
+    }
+
+    // file a node into the slot matching its deadline
+    // deadline must not be earlier than `m_now`
+    void
+    timer_wheel::m_insert(uint32_t index) noexcept
+    {
+	auto& n = m_nodes[index];
+	assert(n.deadline >= m_now);
+
+	auto delta = n.deadline - m_now;
+	unsigned level = 0;
+	while (level < LEVELS - 1 && delta >> (LEVEL_BITS * (level + 1))) ++level;
+
+	// out of range of the wheel; park in the farthest slot and
+	// let cascading file it again later
+	auto deadline = n.deadline;
+	constexpr auto max_delta = (uint64_t(1) << (LEVEL_BITS * LEVELS)) - 1;
+	if (delta > max_delta) deadline = m_now + max_delta;
+
+	m_link(index, level, (deadline >> (LEVEL_BITS * level)) & SLOT_MASK);
+    }
+
+    void
+    timer_wheel::m_link(uint32_t index, unsigned level, unsigned slot) noexcept
+    {
+	auto& n = m_nodes[index];
+	auto& head = m_slots[level][slot];
+
+	n.level = level;
+	n.slot = slot;
+	n.prev = NIL;
+	n.next = head;
+	if (head != NIL) m_nodes[head].prev = index;
+	head = index;
+
+	m_bitmap[level][slot / 64] |= uint64_t(1) << (slot % 64);
+    }
+
+    void
+    timer_wheel::m_unlink(uint32_t index) noexcept
+    {
+	auto& n = m_nodes[index];
+	auto& head = m_slots[n.level][n.slot];
+
+	if (n.prev != NIL) m_nodes[n.prev].next = n.next;
+	else head = n.next;
+	if (n.next != NIL) m_nodes[n.next].prev = n.prev;
+
+	if (head == NIL) {
+	    m_bitmap[n.level][n.slot / 64] &= ~(uint64_t(1) << (n.slot % 64));
+	}
+    }
+
+    // remove a node from wheel and its owner, and put it to free list
+    void
+    timer_wheel::m_release(uint32_t index) noexcept
+    {
+	m_unlink(index);
+
+	auto& n = m_nodes[index];
+	if (n.w_prev != NIL) m_nodes[n.w_prev].w_next = n.w_next;
+	else n.watcher->m_timers = n.w_next;
+	if (n.w_next != NIL) m_nodes[n.w_next].w_prev = n.w_prev;
+
+	n.watcher = nullptr;
+	if (++n.generation == 0) n.generation = 1; // 0 is reserved for NULL_TIMER
+	n.next = m_free;
+	m_free = index;
+	--m_count;
+    }
+
+    // re-file every timer of a higher level slot relative to `m_now`
+    void
+    timer_wheel::m_cascade(unsigned level, unsigned slot) noexcept
+    {
+	auto index = m_slots[level][slot];
+	m_slots[level][slot] = NIL;
+	m_bitmap[level][slot / 64] &= ~(uint64_t(1) << (slot % 64));
+
+	while (index != NIL) {
+	    auto next = m_nodes[index].next;
+	    m_insert(index);
+	    index = next;
+	}
+    }
+
+    // fire every timer in a level 0 slot
+    std::size_t
+    timer_wheel::m_fire(unsigned slot)
+    {
+	std::size_t fired = 0;
+
+	// callbacks may add or cancel timers, but never into this slot
+	// since new deadlines are always later than `m_now`
+	auto& head = m_slots[0][slot];
+	while (head != NIL) {
+	    auto index = head;
+	    auto& n = m_nodes[index];
+	    auto watcher = n.watcher;
+	    auto id = make_timer_id(index, n.generation);
+
+	    m_release(index);
+	    watcher->on_timeout(id);
+	    ++fired;
+	}
+
+	return fired;
+    }
+
+    timer_id
+    timer_wheel::add(ev_watcher& watcher, timestamp_ms_t deadline)
+    {
+	uint32_t index;
+	if (m_free != NIL) {
+	    index = m_free;
+	    m_free = m_nodes[index].next;
+	} else {
+	    index = m_nodes.size();
+	    m_nodes.emplace_back();
+	}
+
+	auto& n = m_nodes[index];
+	n.deadline = std::max(deadline, m_now + 1);
+	n.watcher = &watcher;
+
+	n.w_prev = NIL;
+	n.w_next = watcher.m_timers;
+	if (n.w_next != NIL) m_nodes[n.w_next].w_prev = index;
+	watcher.m_timers = index;
+
+	m_insert(index);
+	++m_count;
+
+	return make_timer_id(index, n.generation);
+    }
+
+    bool
+    timer_wheel::cancel(timer_id id) noexcept
+    {
+	auto n = m_get(id);
+	if (!n) return false;
+
+	m_release(static_cast<uint32_t>(id));
+	return true;
+    }
+
+    bool
+    timer_wheel::reschedule(timer_id id, timestamp_ms_t deadline) noexcept
+    {
+	auto n = m_get(id);
+	if (!n) return false;
+
+	auto index = static_cast<uint32_t>(id);
+	m_unlink(index);
+	n->deadline = std::max(deadline, m_now + 1);
+	m_insert(index);
+	return true;
+    }
+
+    void
+    timer_wheel::cancel_all(ev_watcher& watcher) noexcept
+    {
+	while (watcher.m_timers != NIL) {
+	    m_release(watcher.m_timers);
+	}
+    }
+
+    // earliest tick at which any slot needs attention: a level 0 slot
+    // fires, or a higher level slot is cascaded
+    timestamp_ms_t
+    timer_wheel::m_next_tick() const noexcept
+    {
+	auto next = std::numeric_limits<timestamp_ms_t>::max();
+	for (unsigned level = 0; level < LEVELS; ++level) {
+	    auto shift = LEVEL_BITS * level;
+	    auto cur = m_now >> shift;
+	    unsigned idx = cur & SLOT_MASK;
+
+	    uint64_t ahead;
+	    auto slot = find_next_set(m_bitmap[level], idx + 1, SLOTS);
+	    if (slot < SLOTS) {
+		ahead = slot - idx;
+	    } else {
+		// slots at or before current index belong to next round
+		slot = find_next_set(m_bitmap[level], 0, SLOTS);
+		if (slot == SLOTS) continue;
+		ahead = SLOTS - idx + slot;
+	    }
+
+	    next = std::min(next, (cur + ahead) << shift);
+	}
+
+	return next;
+    }
+
+    timedelta_ms_t
+    timer_wheel::next_timeout(timestamp_ms_t now) const noexcept
+    {
+	if (!m_count) return -1;
+
+	auto next = m_next_tick();
+	return next > now ? next - now : 0;
+    }
+
+    std::size_t
+    timer_wheel::expire(timestamp_ms_t now)
+    {
+	std::size_t fired = 0;
+
+	while (m_now < now) {
+	    // ticks in between are empty or only cascade empty slots
+	    auto tick = m_count ? m_next_tick() : now + 1;
+	    if (tick > now) {
+		m_now = now;
+		break;
+	    }
+
+	    m_now = tick;
+	    if ((tick & SLOT_MASK) == 0) {
+		for (unsigned level = 1; level < LEVELS; ++level) {
+		    unsigned idx = (tick >> (LEVEL_BITS * level)) & SLOT_MASK;
+		    m_cascade(level, idx);
+		    if (idx) break;
+		}
+	    }
+
+	    fired += m_fire(tick & SLOT_MASK);
+	}
+
+	return fired;
+    }
+}
@@ -0,0 +1,286 @@
+#include <http/body.hh>
+
+#include <algorithm>
+#include <cstring>
+
+#include <strings.h>
+
+namespace izumo::http {
+    // value of a hex digit, or -1
+    static int
+    hex_value(unsigned char c) noexcept
+    {
+	if (c >= '0' && c <= '9') return c - '0';
+	if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+	if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+	return -1;
+    }
+
+    // whether the last coding of a Transfer-Encoding value is chunked
+    static bool
+    last_coding_chunked(std::string_view value) noexcept
+    {
+	auto comma = value.rfind(',');
+	if (comma != value.npos) value.remove_prefix(comma + 1);
+
+	auto begin = value.find_first_not_of(" \t");
+	if (begin == value.npos) return false;
+	auto end = value.find_last_not_of(" \t");
+	value = value.substr(begin, end - begin + 1);
+
+	return value.size() == 7 && strncasecmp(value.data(), "chunked", 7) == 0;
+    }
+
+    /** parse_content_length: parse every Content-Length field of headers
+     *   duplicated fields must agree
+     *   @return:
+     *      false if a value is malformed or they disagree
+     */
+    static bool
+    parse_content_length(const header& headers, const header::entry* e, uint64_t& length) noexcept
+    {
+	auto first = e->value;
+	for (; e; e = headers.find_next(e)) {
+	    if (e->value != first) return false;
+	}
+
+	uint64_t ret = 0;
+	for (auto c: first) {
+	    if (c < '0' || c > '9') return false;
+	    if (ret > (UINT64_MAX - 9) / 10) return false;
+	    ret = ret * 10 + (c - '0');
+	}
+
+	length = ret;
+	return true;
+    }
+
+    void
+    body_decoder::start(body_framing framing, uint64_t length) noexcept
+    {
+	*this = body_decoder();
+	m_framing = framing;
+	m_remaining = framing == body_framing::length ? length : 0;
+	if (framing == body_framing::length && !length) m_framing = body_framing::none;
+    }
+
+    bool
+    body_decoder::start_request(const request& req) noexcept
+    {
+	auto length = req.headers.find(header_id::content_length);
+
+	// a request goes on until the server is told where it ends, so
+	// nothing but chunked may end it; with Content-Length as well, it
+	// could end elsewhere for an intermediary, which is how requests
+	// get smuggled
+	if (auto e = req.headers.find(header_id::transfer_encoding)) {
+	    const header::entry* last = e;
+	    while ((e = req.headers.find_next(e))) last = e;
+
+	    if (length || !last_coding_chunked(last->value)) return false;
+	    start(body_framing::chunked);
+	    return true;
+	}
+
+	if (length) {
+	    uint64_t n;
+	    if (!parse_content_length(req.headers, length, n)) return false;
+
+	    start(body_framing::length, n);
+	    return true;
+	}
+
+	start(body_framing::none);
+	return true;
+    }
+
+    bool
+    body_decoder::start_response(const response& res, bool head_request) noexcept
+    {
+	auto code = res.status_code;
+	if (head_request || (code >= 100 && code < 200) || code == 204 || code == 304) {
+	    start(body_framing::none);
+	    return true;
+	}
+
+	// Transfer-Encoding overrides Content-Length; a response whose
+	// coding is not chunked lasts until the connection is closed
+	if (auto e = res.headers.find(header_id::transfer_encoding)) {
+	    const header::entry* last = e;
+	    while ((e = res.headers.find_next(e))) last = e;
+
+	    start(last_coding_chunked(last->value) ? body_framing::chunked
+		  : body_framing::until_close);
+	    return true;
+	}
+
+	if (auto e = res.headers.find(header_id::content_length)) {
+	    uint64_t length;
+	    if (!parse_content_length(res.headers, e, length)) return false;
+
+	    start(body_framing::length, length);
+	    return true;
+	}
+
+	start(body_framing::until_close);
+	return true;
+    }
+
+    parse_result
+    body_decoder::decode(const core::byte_buffer_view& in, core::byte_buffer_view& data,
+			 std::size_t& consumed) noexcept
+    {
+	data = in.slice(0);
+	consumed = 0;
+
+	switch (m_framing) {
+	case body_framing::none:
+	    return parse_result::done;
+
+	case body_framing::length: {
+	    auto n = std::min<uint64_t>(m_remaining, in.size());
+	    data = in.slice(n);
+	    consumed = n;
+	    m_remaining -= n;
+	    m_size += n;
+	    return m_remaining ? parse_result::incomplete : parse_result::done;
+	}
+
+	case body_framing::until_close:
+	    data = in;
+	    consumed = in.size();
+	    m_size += in.size();
+	    return parse_result::incomplete;
+
+	case body_framing::chunked:
+	    return m_decode_chunked(in, data, consumed);
+	}
+
+	return parse_result::error;
+    }
+
+    parse_result
+    body_decoder::m_decode_chunked(const core::byte_buffer_view& in, core::byte_buffer_view& data,
+				   std::size_t& consumed) noexcept
+    {
+	auto begin = in.ptr();
+	auto end = begin + in.size();
+	auto p = begin;
+
+	auto fail = [this] {
+	    m_chunk = chunk_state::error;
+	    return parse_result::error;
+	};
+
+	// lines of framing are short, so they are examined a byte at a time
+	while (p < end) {
+	    switch (m_chunk) {
+	    case chunk_state::size: {
+		auto digit = hex_value(*p);
+		if (digit >= 0) {
+		    // 16 digits fit in 64 bits
+		    if (++m_digits > 16) return fail();
+		    m_remaining = m_remaining * 16 + digit;
+		    ++p;
+		    continue;
+		}
+
+		if (!m_digits) return fail();
+		if (*p == '\r') {
+		    m_chunk = chunk_state::size_lf;
+		} else if (*p == ';') {
+		    m_chunk = chunk_state::ext;
+		} else if (*p == ' ' || *p == '\t') {
+		    m_chunk = chunk_state::size_ws;
+		} else {
+		    return fail();
+		}
+		++p;
+		continue;
+	    }
+
+	    case chunk_state::size_ws:
+		// whitespace may only come before an extension (RFC 9112 7.1.1)
+		if (*p == ';') {
+		    m_chunk = chunk_state::ext;
+		} else if (*p != ' ' && *p != '\t') {
+		    return fail();
+		}
+		++p;
+		continue;
+
+	    case chunk_state::ext:
+	    case chunk_state::trailer_line: {
+		auto cr = static_cast<core::byte_t*>(std::memchr(p, '\r', end - p));
+		if (!cr) {
+		    p = end;
+		    continue;
+		}
+
+		p = cr + 1;
+		m_chunk = m_chunk == chunk_state::ext ? chunk_state::size_lf : chunk_state::trailer_lf;
+		continue;
+	    }
+
+	    case chunk_state::size_lf:
+		if (*p++ != '\n') return fail();
+		m_digits = 0;
+		m_chunk = m_remaining ? chunk_state::data : chunk_state::trailer;
+		continue;
+
+	    case chunk_state::data: {
+		auto n = std::min<uint64_t>(m_remaining, end - p);
+		data = in.slice(p - begin, p - begin + n);
+		p += n;
+		m_remaining -= n;
+		m_size += n;
+		if (!m_remaining) m_chunk = chunk_state::data_cr;
+
+		consumed = p - begin;
+		return parse_result::incomplete;
+	    }
+
+	    case chunk_state::data_cr:
+		if (*p++ != '\r') return fail();
+		m_chunk = chunk_state::data_lf;
+		continue;
+
+	    case chunk_state::data_lf:
+		if (*p++ != '\n') return fail();
+		m_chunk = chunk_state::size;
+		continue;
+
+	    case chunk_state::trailer:
+		if (*p == '\r') {
+		    m_chunk = chunk_state::end_lf;
+		    ++p;
+		} else {
+		    m_chunk = chunk_state::trailer_line;
+		}
+		continue;
+
+	    case chunk_state::trailer_lf:
+		if (*p++ != '\n') return fail();
+		m_chunk = chunk_state::trailer;
+		continue;
+
+	    case chunk_state::end_lf:
+		if (*p++ != '\n') return fail();
+		m_chunk = chunk_state::done;
+		consumed = p - begin;
+		return parse_result::done;
+
+	    case chunk_state::done:
+		return parse_result::done;
+
+	    case chunk_state::error:
+		return parse_result::error;
+	    }
+	}
+
+	consumed = p - begin;
+	if (m_chunk == chunk_state::done) return parse_result::done;
+	if (m_chunk == chunk_state::error) return parse_result::error;
+	return parse_result::incomplete;
+    }
+}
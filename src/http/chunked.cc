@@ -0,0 +1,96 @@
+#include <http/chunked.hh>
+
+#include <cerrno>
+
+#include <fmt/format.h>
+
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+
+namespace izumo::http {
+    // set a boolean option of TCP; fails on other sockets
+    static bool
+    set_tcp_option(int fd, int option, int val) noexcept
+    {
+	return setsockopt(fd, IPPROTO_TCP, option, &val, sizeof(val)) == 0;
+    }
+
+    core::task<int>
+    chunked_stream::m_drain(core::mem_pool&)
+    {
+	int ret = 0;
+	while (true) {
+	    auto flushed = m_queue.flush(m_sock.fd(), m_written);
+	    if (flushed == core::output_queue::flush_result::error) {
+		ret = -errno;
+		break;
+	    }
+	    if (flushed == core::output_queue::flush_result::done) break;
+
+	    ret = co_await core::async_writable(m_sock);
+	    if (ret < 0) break;
+	}
+
+	// what's left may refer to m_size_line, so it isn't left behind
+	if (ret < 0) m_queue.clear();
+	m_queued = false;
+	co_return ret;
+    }
+
+    void
+    chunked_stream::m_uncork() noexcept
+    {
+	// what the cork holds leaves once it's removed
+	if (m_corked) set_tcp_option(m_sock.fd(), TCP_CORK, 0);
+	m_corked = false;
+    }
+
+    int
+    chunked_stream::start() noexcept
+    {
+	m_corked = set_tcp_option(m_sock.fd(), TCP_CORK, 1);
+
+	// whatever the socket doesn't take goes with the first chunk
+	auto ret = m_queue.flush(m_sock.fd(), m_written);
+	return ret == core::output_queue::flush_result::error ? -errno : 0;
+    }
+
+    core::task<int>
+    chunked_stream::write(core::mem_pool& pool, std::string_view data, std::shared_ptr<const void> owner)
+    {
+	if (data.empty()) co_return 0;
+
+	m_queued = true;
+	auto len = fmt::format_to_n(m_size_line, sizeof(m_size_line), "{:x}\r\n", data.size()).size;
+	m_queue.push(std::string_view(m_size_line, len));
+	m_queue.push(data, std::move(owner));
+	m_queue.push("\r\n");
+
+	auto ret = co_await m_drain(pool);
+	m_uncork();
+	co_return ret;
+    }
+
+    core::task<int>
+    chunked_stream::finish(core::mem_pool& pool, std::string_view trailers)
+    {
+	m_queued = true;
+	m_queue.push("0\r\n");
+	if (trailers.size()) m_queue.push(trailers);
+	m_queue.push("\r\n");
+
+	// nothing comes after, so there's nothing to wait for
+	m_uncork();
+
+	// the connection may carry more messages, which keep its setting
+	int nodelay = 1;
+	socklen_t len = sizeof(nodelay);
+	if (getsockopt(m_sock.fd(), IPPROTO_TCP, TCP_NODELAY, &nodelay, &len) < 0) nodelay = 1;
+	if (!nodelay) set_tcp_option(m_sock.fd(), TCP_NODELAY, 1);
+
+	auto ret = co_await m_drain(pool);
+	if (!nodelay) set_tcp_option(m_sock.fd(), TCP_NODELAY, 0);
+	co_return ret;
+    }
+}
@@ -0,0 +1,159 @@
+#include <http/header.hh>
+
+#include <cstring>
+#include <limits>
+
+#include <strings.h>
+
+namespace izumo::http {
+    static bool
+    iequals(std::string_view a, std::string_view b) noexcept
+    {
+	return a.size() == b.size() && strncasecmp(a.data(), b.data(), a.size()) == 0;
+    }
+
+    static unsigned char
+    to_lower(unsigned char c) noexcept
+    {
+	return (c >= 'A' && c <= 'Z') ? c + ('a' - 'A') : c;
+    }
+
+    uint32_t
+    header_hash(std::string_view name) noexcept
+    {
+	// FNV-1a over lower-cased bytes
+	uint32_t h = 2166136261u;
+	for (unsigned char c: name) {
+	    h ^= to_lower(c);
+	    h *= 16777619u;
+	}
+	return h;
+    }
+
+    header_id
+    header_id_of(std::string_view name) noexcept
+    {
+	// well-known names rarely share a length, so at most a few
+	// comparisons are needed
+	switch (name.size()) {
+	case 2:
+	    if (iequals(name, "TE")) return header_id::te;
+	    break;
+	case 4:
+	    if (iequals(name, "Host")) return header_id::host;
+	    if (iequals(name, "Date")) return header_id::date;
+	    break;
+	case 5:
+	    if (iequals(name, "Range")) return header_id::range;
+	    break;
+	case 6:
+	    if (iequals(name, "Expect")) return header_id::expect;
+	    if (iequals(name, "Server")) return header_id::server;
+	    break;
+	case 7:
+	    if (iequals(name, "Upgrade")) return header_id::upgrade;
+	    if (iequals(name, "Trailer")) return header_id::trailer;
+	    break;
+	case 8:
+	    if (iequals(name, "If-Range")) return header_id::if_range;
+	    break;
+	case 10:
+	    if (iequals(name, "Connection")) return header_id::connection;
+	    if (iequals(name, "Keep-Alive")) return header_id::keep_alive;
+	    break;
+	case 12:
+	    if (iequals(name, "Content-Type")) return header_id::content_type;
+	    break;
+	case 13:
+	    if (iequals(name, "Last-Modified")) return header_id::last_modified;
+	    break;
+	case 14:
+	    if (iequals(name, "Content-Length")) return header_id::content_length;
+	    break;
+	case 15:
+	    if (iequals(name, "X-Forwarded-For")) return header_id::x_forwarded_for;
+	    break;
+	case 17:
+	    if (iequals(name, "Transfer-Encoding")) return header_id::transfer_encoding;
+	    if (iequals(name, "If-Modified-Since")) return header_id::if_modified_since;
+	    break;
+	}
+
+	return header_id::other;
+    }
+
+    void
+    header::m_grow()
+    {
+	auto capacity = m_capacity ? m_capacity * 2 : INITIAL_CAPACITY;
+	auto entries = static_cast<entry*>(m_pool->allocate(capacity * sizeof(entry), alignof(entry)));
+
+	// old array stays in the pool until it is released
+	if (m_size) std::memcpy(entries, m_entries, m_size * sizeof(entry));
+	m_entries = entries;
+	m_capacity = capacity;
+    }
+
+    void
+    header::emplace(std::string_view name, std::string_view value)
+    {
+	if (m_size == m_capacity) m_grow();
+
+	auto& e = m_entries[m_size];
+	e.name = name;
+	e.value = value;
+	e.hash = header_hash(name);
+	e.id = header_id_of(name);
+
+	auto& index = m_index[static_cast<std::size_t>(e.id)];
+	if (e.id != header_id::other && index == NOT_FOUND
+	    && m_size < std::numeric_limits<uint16_t>::max()) {
+	    index = m_size + 1;
+	}
+
+	++m_size;
+    }
+
+    const header::entry*
+    header::find(header_id id) const noexcept
+    {
+	if (id == header_id::other) return nullptr;
+
+	auto index = m_index[static_cast<std::size_t>(id)];
+	return index == NOT_FOUND ? nullptr : m_entries + index - 1;
+    }
+
+    const header::entry*
+    header::find(std::string_view name) const noexcept
+    {
+	auto id = header_id_of(name);
+	if (id != header_id::other) return find(id);
+
+	auto hash = header_hash(name);
+	for (auto& e: *this) {
+	    if (e.hash == hash && iequals(e.name, name)) return &e;
+	}
+
+	return nullptr;
+    }
+
+    const header::entry*
+    header::find_next(const entry* prev) const noexcept
+    {
+	for (auto e = prev + 1; e < end(); ++e) {
+	    if (e->hash == prev->hash && e->id == prev->id && iequals(e->name, prev->name)) {
+		return e;
+	    }
+	}
+
+	return nullptr;
+    }
+
+    void
+    header::clear() noexcept
+    {
+	m_entries = nullptr;
+	m_size = m_capacity = 0;
+	std::memset(m_index, 0, sizeof(m_index));
+    }
+}
@@ -1,68 +1,34 @@
 #include <http/parser.hh>
+#include <http/scan.hh>
+#include <core/metrics.hh>
 
 #include <cassert>
 #include <cstring>
 
-static unsigned char*
-scan_equal(unsigned char* begin, unsigned char* end, char target)
-{
-    for (auto p = begin; p < end; ++p) {
-	if (*p == target) return p;
-    }
-
-    return end;
-}
+// scanning is dispatched to the fastest kernels for current cpu
 
 static unsigned char*
-scan_not_equal(unsigned char* begin, unsigned char* end, char target)
+scan_equal(unsigned char* begin, unsigned char* end, unsigned char target)
 {
-    for (auto p = begin; p < end; ++p) {
-	if (*p != target) return p;
-    }
-
-    return end;
+    return izumo::http::scan::active->equal(begin, end, target);
 }
 
 static unsigned char*
-scan_in_range(unsigned char* begin, unsigned char* end, char min, char max)
+scan_not_equal(unsigned char* begin, unsigned char* end, unsigned char target)
 {
-    for (auto p = begin; p < end; ++p) {
-	if (*p >= min && *p <= max) return p;
-    }
-
-    return end;
+    return izumo::http::scan::active->not_equal(begin, end, target);
 }
 
-static unsigned char* 
-scan_not_in_range(unsigned char* begin, unsigned char* end, char min, char max)
-{
-    for (auto p = begin; p < end; ++p) {
-	if (*p < min || *p > max) return p;
-    }
-
-    return end;
-}
-
-static bool
-is_tchar(char c)
+static unsigned char*
+scan_in_range(unsigned char* begin, unsigned char* end, unsigned char min, unsigned char max)
 {
-    // XXX: ASCII only? it's unlikely that this will cause problem through
-    return (c >= 'a' && c <= 'z')
-	|| (c >= 'A' && c <= 'Z')
-	|| (c >= '0' && c <= '9')
-	|| c == '!' || c == '#' || c == '$' || c == '\''
-	|| c == '*' || c == '+' || c == '-' || c == '.'
-	|| c == '^' || c == '_' || c == '`' || c == '~';
+    return izumo::http::scan::active->in_range(begin, end, min, max);
 }
 
 static unsigned char*
 scan_not_token(unsigned char* begin, unsigned char* end)
 {
-    for (auto p = begin; p < end; ++p) {
-	if (!is_tchar(*p)) return p;
-    }
-
-    return end;
+    return izumo::http::scan::active->not_token(begin, end);
 }
 
 // for removing trailing spaces
@@ -77,127 +43,337 @@ rscan_not_equal(unsigned char* begin, unsigned char* end, char target)
 }
 
 namespace izumo::http {
-    static void
-    expect_crlf(unsigned char* p)
-    {
-	if (p[0] != '\r' || p[1] != '\n') throw bad_request();
-    }
+    static auto _parser_requests = core::metrics_registry::instance().add_counter(
+	"izumo_http_requests_parsed_total", "Request headers parsed successfully");
+    static auto _parser_errors = core::metrics_registry::instance().add_counter(
+	"izumo_http_parse_errors_total", "Request headers rejected as malformed");
+    static auto _response_parsed = core::metrics_registry::instance().add_counter(
+	"izumo_http_responses_parsed_total", "Response headers parsed successfully");
+    static auto _response_errors = core::metrics_registry::instance().add_counter(
+	"izumo_http_response_parse_errors_total", "Response headers rejected as malformed");
 
-    static void
-    parse_header(header& h, unsigned char* p, unsigned char* end)
+    std::size_t
+    header_completed(const core::byte_buffer_view& view) noexcept
     {
-	while (*p != '\r') {
-	    // parse field
-	    auto field_begin = p;
-	    p = scan_not_token(p, end);
-	    assert(p != end); // never return end since `header_completed` must be called beforehand
-
-	    // no space allowed before colon 
-	    if (*p != ':') throw bad_request();
-	    auto field_end = p;
-
-	    p = scan_not_equal(p, end, ' '); 
-	    if (p == end) throw bad_request();
-	    
-	    auto value_begin = p;
-
-	    p = scan_equal(p, end, '\r'); 
-	    assert(p != end);
-	    expect_crlf(p);
+	auto begin = view.ptr();
+	auto end = view.ptr() + view.size();
 
-	    auto value_end = scan_not_equal(value_begin, p, ' ') + 1;
+	auto p = scan::active->header_end(begin, end);
+	if (p == end) return 0;
+	return p - begin + 4;
+    }
 
-	    // empty value is not allowed
-	    if (value_end == value_begin) throw bad_request();
+    // return only minor version, since major is always 1
+    // return -1 if malformed
+    static int
+    parse_httpver(unsigned char* p, unsigned char* end) noexcept
+    {
+	if (end - p < 8) return -1;
+	if (   p[0] != 'H' || p[1] != 'T' || p[2] != 'T' || p[3] != 'P'
+	    || p[4] != '/' || p[5] != '1' || p[6] != '.') {
+	    return -1;
+	}
 
-	    p += 2; // skip CRLF
+	if (p[7] != '0' && p[7] != '1') return -1;
+	return p[7] - '0';
+    }
 
-	    h.emplace(std::string_view(reinterpret_cast<const char*>(field_begin),
-				       field_end - field_begin),
-		      std::string_view(reinterpret_cast<const char*>(value_begin),
-				       value_end - value_begin));
-	}
+    // offset of p from the beginning of view
+    static std::size_t
+    offset_of(const core::byte_buffer_view& view, const unsigned char* p) noexcept
+    {
+	return p - view.ptr();
+    }
 
-	expect_crlf(p);
+    static std::string_view
+    make_string_view(const core::byte_buffer_view& view, std::size_t begin, std::size_t end) noexcept
+    {
+	return std::string_view(reinterpret_cast<const char*>(view.ptr() + begin), end - begin);
     }
 
-    static bool
-    is_header_end(unsigned char* p)
+    parse_result
+    _header_parser::m_fail() noexcept
     {
-	return p[0] == '\r' && p[1] == '\n' && p[2] == '\r' && p[3] == '\n';
+	m_state = state::error;
+	return parse_result::error;
     }
-    
-    std::size_t
-    header_completed(const core::byte_buffer_view& view) noexcept
+
+    parse_result
+    _header_parser::m_parse_fields(header& headers, const core::byte_buffer_view& view,
+				   unsigned char* p)
     {
-	if (view.size() < 4) return 0;
-	
-	auto p = view.ptr();
+	auto begin = view.ptr();
 	auto end = view.ptr() + view.size();
 
+	// every state either consumes its element and moves on, or
+	// records where it stopped and returns `incomplete`
 	while (true) {
-	    p = scan_equal(p, end, '\r');
-	    if (end - p < 4) return 0;
-
-	    if (is_header_end(p)) break;
-	    ++p;
+	    switch (m_state) {
+	    case state::field_name: {
+		if (p == end) break;
+		// empty line ends the header
+		if (*p == '\r' && offset_of(view, p) == m_mark) {
+		    m_state = state::header_end;
+		    continue;
+		}
+
+		p = scan_not_token(p, end);
+		if (p == end) break;
+
+		// no space allowed before colon
+		if (*p != ':' || offset_of(view, p) == m_mark) return m_fail();
+
+		m_name_end = offset_of(view, p);
+		++p;
+		m_state = state::field_ows;
+		continue;
+	    }
+
+	    case state::field_ows: {
+		p = scan_not_equal(p, end, ' ');
+		if (p == end) break;
+
+		m_value_begin = offset_of(view, p);
+		m_state = state::field_value;
+		continue;
+	    }
+
+	    case state::field_value: {
+		p = scan_equal(p, end, '\r');
+		if (p == end) break;
+
+		auto value_begin = begin + m_value_begin;
+		auto value_end = rscan_not_equal(value_begin, p, ' ') + 1;
+
+		// empty value is not allowed
+		if (value_end == value_begin) return m_fail();
+
+		m_value_end = offset_of(view, value_end);
+		++p;
+		m_state = state::field_lf;
+		continue;
+	    }
+
+	    case state::field_lf: {
+		if (p == end) break;
+		if (*p != '\n') return m_fail();
+
+		headers.emplace(make_string_view(view, m_mark, m_name_end),
+				make_string_view(view, m_value_begin, m_value_end));
+		m_mark = offset_of(view, ++p);
+		m_state = state::field_name;
+		continue;
+	    }
+
+	    case state::header_end: {
+		// p points to the CR of the empty line
+		if (end - p < 2) break;
+		if (p[1] != '\n') return m_fail();
+
+		p += 2;
+		m_state = state::done;
+		continue;
+	    }
+
+	    case state::done:
+		m_pos = offset_of(view, p);
+		return parse_result::done;
+
+	    case state::error:
+		return parse_result::error;
+
+	    default:		// start line is parsed by derived parsers
+		assert(false);
+		return m_fail();
+	    }
+
+	    // ran out of input; resume from here next time
+	    m_pos = offset_of(view, p);
+	    return parse_result::incomplete;
 	}
-	return p - view.ptr() + 4;
     }
 
-    // return only minor version, since major is always 1
-    static int
-    parse_httpver(unsigned char* p, unsigned char* end)
+    void
+    request_parser::reset() noexcept
     {
-	if (end - p < 8) throw bad_request();
-	if (   p[0] != 'H' || p[1] != 'T' || p[2] != 'T' || p[3] != 'P'
-	    || p[4] != '/' || p[5] != '1' || p[6] != '.') {
-	    throw bad_request();
-	}
-
-	if (p[7] != '0' && p[7] != '1') throw bad_request();
-	return p[7] - '0';
+	*this = request_parser();
     }
 
-    void
-    parse_request(request& req, const core::byte_buffer_view& view)
+    parse_result
+    request_parser::parse(request& req, const core::byte_buffer_view& view)
     {
-	auto p = view.ptr();
+	if (m_state == state::done) return parse_result::done;
+	if (m_state == state::error) return parse_result::error;
+
+	auto begin = view.ptr();
 	auto end = view.ptr() + view.size();
+	auto p = begin + m_pos;
+
+	auto fail = [this] {
+	    _parser_errors.inc();
+	    return m_fail();
+	};
+
+	while (m_state < state::field_name) {
+	    switch (m_state) {
+	    case state::method: {
+		p = scan_not_token(p, end);
+		if (p == end) break;
+		if (*p != ' ' || p == begin) return fail();
+
+		req.method = make_string_view(view, 0, offset_of(view, p));
+		m_mark = offset_of(view, ++p);
+		m_state = state::target;
+		continue;
+	    }
+
+	    case state::target: {
+		// target ends at the first space or control character
+		p = scan_in_range(p, end, 0, ' ');
+		if (p == end) break;
+		if (*p != ' ' || offset_of(view, p) == m_mark) return fail();
+
+		req.target = make_string_view(view, m_mark, offset_of(view, p));
+		++p;
+		m_state = state::version;
+		continue;
+	    }
+
+	    case state::version: {
+		// "HTTP/1.x" CRLF
+		if (end - p < 10) break;
+
+		auto minor = parse_httpver(p, end);
+		if (minor < 0) return fail();
+		if (p[8] != '\r' || p[9] != '\n') return fail();
+
+		req.httpver_major = 1;
+		req.httpver_minor = minor;
+		p += 10;
+		m_mark = offset_of(view, p);
+		m_state = state::field_name;
+		continue;
+	    }
+
+	    default:
+		assert(false);
+		return fail();
+	    }
+
+	    m_pos = offset_of(view, p);
+	    return parse_result::incomplete;
+	}
 
-	// parse request-line
-	auto method_begin = p;
-	p = scan_not_token(p, end);
-	assert(p != end);
+	auto ret = m_parse_fields(req.headers, view, p);
+	if (ret == parse_result::done) _parser_requests.inc();
+	if (ret == parse_result::error) _parser_errors.inc();
+	return ret;
+    }
 
-	if (*p != ' ') throw bad_request();
-	auto method_end = p++;
+    void
+    response_parser::reset() noexcept
+    {
+	*this = response_parser();
+    }
 
-	auto target_begin = p;
-	p = scan_equal(p, end, ' ');
-	if (p == end) throw bad_request();
-	if (*p != ' ') throw bad_request();
-	auto target_end = p++;
+    parse_result
+    response_parser::parse(response& res, const core::byte_buffer_view& view)
+    {
+	if (m_state == state::done) return parse_result::done;
+	if (m_state == state::error) return parse_result::error;
 
-	req.method = std::string_view(reinterpret_cast<char*>(method_begin),
-				      method_end - method_begin);
-	req.target = std::string_view(reinterpret_cast<char*>(target_begin),
-				      target_end - target_begin);
-	req.httpver_major = 1;
-	req.httpver_minor = parse_httpver(p, end);
+	auto end = view.ptr() + view.size();
+	auto p = view.ptr() + m_pos;
+
+	auto fail = [this] {
+	    _response_errors.inc();
+	    return m_fail();
+	};
+
+	while (m_state < state::field_name) {
+	    switch (m_state) {
+	    case state::status: {
+		// "HTTP/1.x" SP 3DIGIT
+		if (end - p < 12) break;
+
+		auto minor = parse_httpver(p, end);
+		if (minor < 0 || p[8] != ' ') return fail();
+
+		int code = 0;
+		for (auto d = p + 9; d < p + 12; ++d) {
+		    if (*d < '0' || *d > '9') return fail();
+		    code = code * 10 + (*d - '0');
+		}
+
+		res.httpver_major = 1;
+		res.httpver_minor = minor;
+		res.status_code = code;
+		p += 12;
+		m_state = state::status_end;
+		continue;
+	    }
+
+	    case state::status_end: {
+		// the reason phrase is optional, and so is SP before it
+		// with some servers
+		if (p == end) break;
+		if (*p == ' ') {
+		    m_mark = offset_of(view, ++p);
+		    m_state = state::reason;
+		    continue;
+		}
+
+		if (*p != '\r') return fail();
+		m_mark = offset_of(view, p);
+		m_state = state::reason;
+		continue;
+	    }
+
+	    case state::reason: {
+		p = scan_equal(p, end, '\r');
+		if (p == end) break;
+
+		res.status_message = make_string_view(view, m_mark, offset_of(view, p));
+		++p;
+		m_state = state::reason_lf;
+		continue;
+	    }
+
+	    case state::reason_lf: {
+		if (p == end) break;
+		if (*p != '\n') return fail();
+
+		m_mark = offset_of(view, ++p);
+		m_state = state::field_name;
+		continue;
+	    }
+
+	    default:
+		assert(false);
+		return fail();
+	    }
+
+	    m_pos = offset_of(view, p);
+	    return parse_result::incomplete;
+	}
 
-	p += 8;
-	expect_crlf(p);
-	p += 2;
+	auto ret = m_parse_fields(res.headers, view, p);
+	if (ret == parse_result::done) _response_parsed.inc();
+	if (ret == parse_result::error) _response_errors.inc();
+	return ret;
+    }
 
-	parse_header(req.headers, p, end);
+    void
+    parse_request(request& req, const core::byte_buffer_view& view)
+    {
+	request_parser parser;
+	if (parser.parse(req, view) != parse_result::done) throw bad_request();
     }
 
     void
     parse_response(response& res, const core::byte_buffer_view& view)
     {
-	// TODO
-	(void)res;
-	(void)view;
+	response_parser parser;
+	if (parser.parse(res, view) != parse_result::done) throw bad_response();
     }
 }
@@ -0,0 +1,326 @@
+#include <http/scan.hh>
+
+#include <cstring>
+
+#if defined (__x86_64__) || defined (__i386__)
+#define IZM_SCAN_X86
+#include <immintrin.h>
+#endif
+
+namespace izumo::http::scan {
+    struct tchar_table_t {
+	bool v[256];
+    };
+
+    static constexpr tchar_table_t
+    make_tchar_table()
+    {
+	tchar_table_t ret {};
+	for (int c = 0; c < 256; ++c) {
+	    ret.v[c] = (c >= 'a' && c <= 'z')
+		|| (c >= 'A' && c <= 'Z')
+		|| (c >= '0' && c <= '9')
+		|| c == '!' || c == '#' || c == '$' || c == '%'
+		|| c == '&' || c == '\'' || c == '*' || c == '+'
+		|| c == '-' || c == '.' || c == '^' || c == '_'
+		|| c == '`' || c == '|' || c == '~';
+	}
+	return ret;
+    }
+
+    static constexpr auto tchar_table = make_tchar_table();
+
+    bool
+    is_tchar(byte_t c) noexcept
+    {
+	return tchar_table.v[c];
+    }
+
+    // scalar kernels; also used for tails of vectorized kernels
+
+    static byte_t*
+    scalar_equal(byte_t* begin, byte_t* end, byte_t c)
+    {
+	auto ret = std::memchr(begin, c, end - begin);
+	return ret ? static_cast<byte_t*>(ret) : end;
+    }
+
+    static byte_t*
+    scalar_not_equal(byte_t* begin, byte_t* end, byte_t c)
+    {
+	for (auto p = begin; p < end; ++p) {
+	    if (*p != c) return p;
+	}
+
+	return end;
+    }
+
+    static byte_t*
+    scalar_in_range(byte_t* begin, byte_t* end, byte_t lo, byte_t hi)
+    {
+	for (auto p = begin; p < end; ++p) {
+	    if (static_cast<byte_t>(*p - lo) <= static_cast<byte_t>(hi - lo)) return p;
+	}
+
+	return end;
+    }
+
+    static byte_t*
+    scalar_not_token(byte_t* begin, byte_t* end)
+    {
+	for (auto p = begin; p < end; ++p) {
+	    if (!tchar_table.v[*p]) return p;
+	}
+
+	return end;
+    }
+
+    static byte_t*
+    scalar_header_end(byte_t* begin, byte_t* end)
+    {
+	auto p = begin;
+	while (end - p >= 4) {
+	    p = scalar_equal(p, end - 3, '\r');
+	    if (p == end - 3) break;
+	    if (p[1] == '\n' && p[2] == '\r' && p[3] == '\n') return p;
+	    ++p;
+	}
+
+	return end;
+    }
+
+    const kernels scalar = {
+	"scalar",
+	scalar_equal,
+	scalar_not_equal,
+	scalar_in_range,
+	scalar_not_token,
+	scalar_header_end,
+    };
+
+#if defined (IZM_SCAN_X86)
+    // 16 byte kernels
+
+    __attribute__((target("sse4.2"))) static byte_t*
+    sse42_equal(byte_t* begin, byte_t* end, byte_t c)
+    {
+	auto p = begin;
+	auto needle = _mm_set1_epi8(c);
+	for (; end - p >= 16; p += 16) {
+	    auto b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+	    unsigned mask = _mm_movemask_epi8(_mm_cmpeq_epi8(b, needle));
+	    if (mask) return p + __builtin_ctz(mask);
+	}
+
+	return scalar_equal(p, end, c);
+    }
+
+    __attribute__((target("sse4.2"))) static byte_t*
+    sse42_not_equal(byte_t* begin, byte_t* end, byte_t c)
+    {
+	auto p = begin;
+	auto needle = _mm_set1_epi8(c);
+	for (; end - p >= 16; p += 16) {
+	    auto b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+	    unsigned mask = ~_mm_movemask_epi8(_mm_cmpeq_epi8(b, needle)) & 0xffff;
+	    if (mask) return p + __builtin_ctz(mask);
+	}
+
+	return scalar_not_equal(p, end, c);
+    }
+
+    __attribute__((target("sse4.2"))) static byte_t*
+    sse42_in_range(byte_t* begin, byte_t* end, byte_t lo, byte_t hi)
+    {
+	// x in [lo, hi] iff (x - lo) <= (hi - lo) as unsigned
+	auto p = begin;
+	auto vlo = _mm_set1_epi8(lo);
+	auto vspan = _mm_set1_epi8(hi - lo);
+	for (; end - p >= 16; p += 16) {
+	    auto b = _mm_sub_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(p)), vlo);
+	    unsigned mask = _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_min_epu8(b, vspan), b));
+	    if (mask) return p + __builtin_ctz(mask);
+	}
+
+	return scalar_in_range(p, end, lo, hi);
+    }
+
+    __attribute__((target("sse4.2"))) static byte_t*
+    sse42_not_token(byte_t* begin, byte_t* end)
+    {
+	// PCMPESTRI takes at most 8 ranges, so '{' to 0xff is matched as a
+	// whole and the two tchars in it ('|' and '~') are filtered afterwards
+	const auto ranges = _mm_setr_epi8(
+	    '\x00', ' ', '"', '"', '(', ')', ',', ',',
+	    '/', '/', ':', '@', '[', ']', '{', '\xff');
+
+	auto p = begin;
+	while (end - p >= 16) {
+	    auto b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+	    int idx = _mm_cmpestri(ranges, 16, b, 16,
+				   _SIDD_UBYTE_OPS | _SIDD_CMP_RANGES | _SIDD_LEAST_SIGNIFICANT);
+	    if (idx == 16) {
+		p += 16;
+		continue;
+	    }
+
+	    p += idx;
+	    if (!tchar_table.v[*p]) return p;
+	    ++p;
+	}
+
+	return scalar_not_token(p, end);
+    }
+
+    __attribute__((target("sse4.2"))) static byte_t*
+    sse42_header_end(byte_t* begin, byte_t* end)
+    {
+	auto p = begin;
+	auto cr = _mm_set1_epi8('\r');
+	auto lf = _mm_set1_epi8('\n');
+	for (; end - p >= 16 + 3; p += 16) {
+	    auto b0 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+	    auto b1 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + 1));
+	    auto b2 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + 2));
+	    auto b3 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + 3));
+
+	    unsigned mask = _mm_movemask_epi8(_mm_cmpeq_epi8(b0, cr))
+		& _mm_movemask_epi8(_mm_cmpeq_epi8(b1, lf))
+		& _mm_movemask_epi8(_mm_cmpeq_epi8(b2, cr))
+		& _mm_movemask_epi8(_mm_cmpeq_epi8(b3, lf));
+	    if (mask) return p + __builtin_ctz(mask);
+	}
+
+	return scalar_header_end(p, end);
+    }
+
+    static const kernels sse42 = {
+	"sse4.2",
+	sse42_equal,
+	sse42_not_equal,
+	sse42_in_range,
+	sse42_not_token,
+	sse42_header_end,
+    };
+
+    // 32 byte kernels
+
+    __attribute__((target("avx2"))) static byte_t*
+    avx2_equal(byte_t* begin, byte_t* end, byte_t c)
+    {
+	auto p = begin;
+	auto needle = _mm256_set1_epi8(c);
+	for (; end - p >= 32; p += 32) {
+	    auto b = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p));
+	    unsigned mask = _mm256_movemask_epi8(_mm256_cmpeq_epi8(b, needle));
+	    if (mask) return p + __builtin_ctz(mask);
+	}
+
+	return sse42_equal(p, end, c);
+    }
+
+    __attribute__((target("avx2"))) static byte_t*
+    avx2_not_equal(byte_t* begin, byte_t* end, byte_t c)
+    {
+	// runs of the same byte are short in practice (e.g. OWS), so
+	// check the first byte before setting up vectors
+	if (begin == end || *begin != c) return begin;
+
+	auto p = begin;
+	auto needle = _mm256_set1_epi8(c);
+	for (; end - p >= 32; p += 32) {
+	    auto b = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p));
+	    unsigned mask = ~_mm256_movemask_epi8(_mm256_cmpeq_epi8(b, needle));
+	    if (mask) return p + __builtin_ctz(mask);
+	}
+
+	return sse42_not_equal(p, end, c);
+    }
+
+    __attribute__((target("avx2"))) static byte_t*
+    avx2_in_range(byte_t* begin, byte_t* end, byte_t lo, byte_t hi)
+    {
+	auto p = begin;
+	auto vlo = _mm256_set1_epi8(lo);
+	auto vspan = _mm256_set1_epi8(hi - lo);
+	for (; end - p >= 32; p += 32) {
+	    auto b = _mm256_sub_epi8(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(p)), vlo);
+	    unsigned mask = _mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_min_epu8(b, vspan), b));
+	    if (mask) return p + __builtin_ctz(mask);
+	}
+
+	return sse42_in_range(p, end, lo, hi);
+    }
+
+    __attribute__((target("avx2"))) static byte_t*
+    avx2_header_end(byte_t* begin, byte_t* end)
+    {
+	auto p = begin;
+	auto cr = _mm256_set1_epi8('\r');
+	auto lf = _mm256_set1_epi8('\n');
+	for (; end - p >= 32 + 3; p += 32) {
+	    auto b0 = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p));
+	    auto b1 = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p + 1));
+	    auto b2 = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p + 2));
+	    auto b3 = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p + 3));
+
+	    unsigned mask = _mm256_movemask_epi8(_mm256_cmpeq_epi8(b0, cr))
+		& _mm256_movemask_epi8(_mm256_cmpeq_epi8(b1, lf))
+		& _mm256_movemask_epi8(_mm256_cmpeq_epi8(b2, cr))
+		& _mm256_movemask_epi8(_mm256_cmpeq_epi8(b3, lf));
+	    if (mask) return p + __builtin_ctz(mask);
+	}
+
+	return sse42_header_end(p, end);
+    }
+
+    static const kernels avx2 = {
+	"avx2",
+	avx2_equal,
+	avx2_not_equal,
+	avx2_in_range,
+	sse42_not_token,	// PCMPESTRI has no 32 byte variant
+	avx2_header_end,
+    };
+
+    // what the parser runs, as chosen by "parse" of bench_http_scan. its
+    // scans stop at the end of a token or a line, too soon for setting
+    // up wide vectors to pay off; avx2 is the slowest there. the CR of
+    // each line, and the empty line in turn, are found faster by memchr,
+    // which libc vectorizes itself, than by the kernels above. only the
+    // request target runs long enough for vectors, which sse4.2 has.
+    static const kernels tuned = {
+	"tuned",
+	scalar_equal,
+	scalar_not_equal,
+	sse42_in_range,
+	scalar_not_token,
+	scalar_header_end,
+    };
+#endif	// IZM_SCAN_X86
+
+    static const kernels&
+    select_kernels() noexcept
+    {
+#if defined (IZM_SCAN_X86)
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2")) return avx2;
+	if (__builtin_cpu_supports("sse4.2")) return sse42;
+#endif
+	return scalar;
+    }
+
+    const kernels* active = &select_kernels();
+
+    std::vector<const kernels*>
+    supported()
+    {
+	std::vector<const kernels*> ret { &scalar };
+#if defined (IZM_SCAN_X86)
+	if (__builtin_cpu_supports("sse4.2")) ret.push_back(&sse42);
+	if (__builtin_cpu_supports("avx2")) ret.push_back(&avx2);
+	if (__builtin_cpu_supports("sse4.2")) ret.push_back(&tuned);
+#endif
+	return ret;
+    }
+}
@@ -0,0 +1,303 @@
+#include <http/static_file.hh>
+#include <core/exception.hh>
+
+#include <charconv>
+#include <cstring>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <strings.h>
+#include <unistd.h>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+
+namespace izumo::http {
+    // anything that changes content or metadata, or unlinks the path
+    constexpr uint32_t WATCH_MASK = IN_MODIFY | IN_ATTRIB | IN_MOVE_SELF | IN_DELETE_SELF;
+
+    cached_file::~cached_file() { close(fd); }
+
+    file_cache::file_cache(const std::string& root, std::size_t capacity):
+	ev_watcher(inotify_init1(IN_NONBLOCK | IN_CLOEXEC)),
+	m_root(root),
+	m_capacity(capacity)
+    {
+	if (m_fd < 0) throw core::osexception();
+
+	struct stat st;
+	int err = 0;
+	if (stat(root.c_str(), &st) < 0) err = errno;
+	else if (!S_ISDIR(st.st_mode)) err = ENOTDIR;
+
+	if (err) {
+	    close(m_fd);
+	    throw core::osexception(err);
+	}
+
+	if (m_root.empty() || m_root.back() != '/') m_root.push_back('/');
+    }
+
+    file_cache::~file_cache()
+    {
+	close(m_fd);		// removes every watch
+    }
+
+    static int
+    hex_value(char c) noexcept
+    {
+	if (c >= '0' && c <= '9') return c - '0';
+	if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+	if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+	return -1;
+    }
+
+    // decode target into m_path as a path under root
+    // return false if it's malformed or refers to a parent directory
+    bool
+    file_cache::m_resolve(std::string_view target)
+    {
+	target = target.substr(0, target.find_first_of("?#"));
+	if (target.empty() || target[0] != '/') return false;
+
+	m_path.assign(m_root);
+	for (std::size_t i = 1; i < target.size(); ++i) {
+	    auto c = target[i];
+	    if (c == '%') {
+		if (i + 2 >= target.size()) return false;
+		auto hi = hex_value(target[i + 1]), lo = hex_value(target[i + 2]);
+		if (hi < 0 || lo < 0) return false;
+		c = hi * 16 + lo;
+		i += 2;
+	    }
+	    if (c == '\0') return false;
+	    m_path.push_back(c);
+	}
+
+	// every segment is checked after decoding, so %2e%2e is caught too
+	auto rest = std::string_view(m_path).substr(m_root.size());
+	while (true) {
+	    auto slash = rest.find('/');
+	    auto seg = rest.substr(0, slash);
+	    if (seg == "..") return false;
+	    if (slash == rest.npos) break;
+	    rest.remove_prefix(slash + 1);
+	}
+
+	if (m_path.back() == '/') m_path += "index.html";
+	return true;
+    }
+
+    // open and stat the file at m_path
+    int
+    file_cache::m_open(std::shared_ptr<const cached_file>& out)
+    {
+	int fd = open(m_path.c_str(), O_RDONLY | O_CLOEXEC | O_NONBLOCK);
+	if (fd < 0) return errno;
+
+	auto file = std::make_shared<cached_file>(fd);
+
+	struct stat st;
+	if (fstat(fd, &st) < 0) return errno;
+	if (!S_ISREG(st.st_mode)) return EACCES;
+
+	file->size = st.st_size;
+	file->mtime = st.st_mtime;
+	file->content_type = content_type_of(m_path);
+	format_http_date(file->mtime, file->last_modified);
+
+	out = std::move(file);
+	return 0;
+    }
+
+    void
+    file_cache::m_erase(lru_list::iterator it)
+    {
+	auto range = m_by_wd.equal_range(it->wd);
+	std::size_t sharing = 0;
+	for (auto i = range.first; i != range.second;) {
+	    if (i->second == it) {
+		i = m_by_wd.erase(i);
+	    } else {
+		++sharing;
+		++i;
+	    }
+	}
+
+	// hard links share an inode and thus a watch
+	if (!sharing) inotify_rm_watch(m_fd, it->wd);
+
+	m_by_path.erase(it->path);
+	m_lru.erase(it);
+    }
+
+    int
+    file_cache::lookup(std::string_view target, std::shared_ptr<const cached_file>& out)
+    {
+	if (!m_resolve(target)) return EINVAL;
+
+	auto found = m_by_path.find(m_path);
+	if (found != m_by_path.end()) {
+	    m_lru.splice(m_lru.begin(), m_lru, found->second);
+	    out = found->second->file;
+	    return 0;
+	}
+
+	// the watch is added before opening, so a change in between is
+	// not missed; at worst it drops the entry needlessly
+	int wd = inotify_add_watch(m_fd, m_path.c_str(), WATCH_MASK);
+
+	auto err = m_open(out);
+	if (err || wd < 0) {
+	    // serve without caching if the file can't be watched
+	    if (wd >= 0 && m_by_wd.find(wd) == m_by_wd.end()) inotify_rm_watch(m_fd, wd);
+	    return err;
+	}
+
+	if (m_lru.size() >= m_capacity) m_erase(std::prev(m_lru.end()));
+
+	m_lru.push_front({ m_path, wd, out });
+	m_by_path.emplace(m_lru.front().path, m_lru.begin());
+	m_by_wd.emplace(wd, m_lru.begin());
+	return 0;
+    }
+
+    bool
+    file_cache::on_event(bool r, bool)
+    {
+	if (!r) return false;
+
+	alignas(inotify_event) char buf[4096];
+	while (true) {
+	    auto ret = read(m_fd, buf, sizeof(buf));
+	    if (ret < 0) {
+		if (errno == EINTR) continue;
+		if (errno == EAGAIN || errno == EWOULDBLOCK) break;
+		throw core::osexception();
+	    }
+
+	    for (char* p = buf; p < buf + ret;) {
+		auto ev = reinterpret_cast<inotify_event*>(p);
+		p += sizeof(inotify_event) + ev->len;
+
+		// every event of a watch invalidates its files. removing a
+		// watch the kernel has already dropped fails harmlessly
+		for (auto found = m_by_wd.find(ev->wd); found != m_by_wd.end();
+		     found = m_by_wd.find(ev->wd)) {
+		    m_erase(found->second);
+		}
+	    }
+	}
+
+	return false;
+    }
+
+    range_result
+    parse_range(std::string_view value, uint64_t size, byte_range& out) noexcept
+    {
+	constexpr std::string_view unit = "bytes=";
+	if (value.size() < unit.size() || strncasecmp(value.data(), unit.data(), unit.size())) {
+	    return range_result::none;
+	}
+	value.remove_prefix(unit.size());
+
+	auto begin = value.find_first_not_of(" \t");
+	auto end = value.find_last_not_of(" \t");
+	if (begin == value.npos) return range_result::none;
+	value = value.substr(begin, end - begin + 1);
+
+	auto dash = value.find('-');
+	if (dash == value.npos || value.find(',') != value.npos) return range_result::none;
+
+	auto parse_num = [](std::string_view s, uint64_t& n) {
+	    auto ret = std::from_chars(s.data(), s.data() + s.size(), n);
+	    return !s.empty() && ret.ec == std::errc() && ret.ptr == s.data() + s.size();
+	};
+
+	uint64_t first, last;
+	auto first_str = value.substr(0, dash), last_str = value.substr(dash + 1);
+
+	if (first_str.empty()) {
+	    // suffix range: last n bytes
+	    uint64_t n;
+	    if (!parse_num(last_str, n)) return range_result::none;
+	    if (!n || !size) return range_result::unsatisfiable;
+	    out = { n < size ? size - n : 0, size - 1 };
+	    return range_result::ok;
+	}
+
+	if (!parse_num(first_str, first)) return range_result::none;
+	if (last_str.empty()) {
+	    last = UINT64_MAX;
+	} else if (!parse_num(last_str, last) || last < first) {
+	    return range_result::none;
+	}
+
+	if (first >= size) return range_result::unsatisfiable;
+	out = { first, last < size ? last : size - 1 };
+	return range_result::ok;
+    }
+
+    constexpr const char* HTTP_DATE_FORMAT = "%a, %d %b %Y %H:%M:%S GMT";
+
+    std::size_t
+    format_http_date(std::time_t t, char* buf) noexcept
+    {
+	std::tm tm;
+	gmtime_r(&t, &tm);
+	return std::strftime(buf, 30, HTTP_DATE_FORMAT, &tm);
+    }
+
+    std::time_t
+    parse_http_date(std::string_view value) noexcept
+    {
+	char buf[32];
+	if (value.size() >= sizeof(buf)) return -1;
+	std::memcpy(buf, value.data(), value.size());
+	buf[value.size()] = '\0';
+
+	std::tm tm;
+	std::memset(&tm, 0, sizeof(tm));
+	auto end = strptime(buf, HTTP_DATE_FORMAT, &tm);
+	if (!end || *end) return -1;
+
+	return timegm(&tm);
+    }
+
+    std::string_view
+    content_type_of(std::string_view path) noexcept
+    {
+	static constexpr struct {
+	    std::string_view ext;
+	    std::string_view type;
+	} types[] = {
+	    { "html", "text/html; charset=utf-8" },
+	    { "htm", "text/html; charset=utf-8" },
+	    { "css", "text/css; charset=utf-8" },
+	    { "js", "text/javascript; charset=utf-8" },
+	    { "json", "application/json" },
+	    { "txt", "text/plain; charset=utf-8" },
+	    { "xml", "application/xml" },
+	    { "svg", "image/svg+xml" },
+	    { "png", "image/png" },
+	    { "jpg", "image/jpeg" },
+	    { "jpeg", "image/jpeg" },
+	    { "gif", "image/gif" },
+	    { "webp", "image/webp" },
+	    { "ico", "image/x-icon" },
+	    { "wasm", "application/wasm" },
+	    { "pdf", "application/pdf" },
+	};
+
+	auto dot = path.rfind('.');
+	if (dot != path.npos && path.find('/', dot) == path.npos) {
+	    auto ext = path.substr(dot + 1);
+	    for (auto& t: types) {
+		if (t.ext.size() == ext.size() && !strncasecmp(t.ext.data(), ext.data(), ext.size())) {
+		    return t.type;
+		}
+	    }
+	}
+
+	return "application/octet-stream";
+    }
+}
@@ -0,0 +1,94 @@
+#include <http/types.hh>
+
+#include <strings.h>
+
+namespace izumo::http {
+    static bool
+    iequals(std::string_view a, std::string_view b) noexcept
+    {
+	return a.size() == b.size() && strncasecmp(a.data(), b.data(), a.size()) == 0;
+    }
+
+    // check if a comma separated header value contains token
+    static bool
+    has_token(std::string_view value, std::string_view token) noexcept
+    {
+	while (value.size()) {
+	    auto comma = value.find(',');
+	    auto item = value.substr(0, comma);
+
+	    auto begin = item.find_first_not_of(" \t");
+	    auto end = item.find_last_not_of(" \t");
+	    if (begin != item.npos && iequals(item.substr(begin, end - begin + 1), token)) {
+		return true;
+	    }
+
+	    if (comma == value.npos) break;
+	    value.remove_prefix(comma + 1);
+	}
+
+	return false;
+    }
+
+    static bool
+    keep_alive(int httpver_minor, const header& headers) noexcept
+    {
+	// HTTP/1.1 persists by default, HTTP/1.0 only when asked to
+	auto ret = httpver_minor >= 1;
+
+	for (auto e = headers.find(header_id::connection); e; e = headers.find_next(e)) {
+	    if (has_token(e->value, "close")) return false;
+	    if (has_token(e->value, "keep-alive")) ret = true;
+	}
+
+	return ret;
+    }
+
+    bool
+    keep_alive(const request& req) noexcept
+    {
+	return keep_alive(req.httpver_minor, req.headers);
+    }
+
+    bool
+    keep_alive(const response& res) noexcept
+    {
+	return keep_alive(res.httpver_minor, res.headers);
+    }
+
+    bool
+    hop_by_hop(const header& headers, const header::entry& e) noexcept
+    {
+	switch (e.id) {
+	case header_id::connection:
+	case header_id::keep_alive:
+	case header_id::te:
+	case header_id::transfer_encoding:
+	case header_id::upgrade:
+	    return true;
+	case header_id::content_length:
+	case header_id::host:
+	    // never nominated by Connection: the next hop would frame the
+	    // body, or route the message, other than this one did
+	    return false;
+	default:
+	    break;
+	}
+
+	if (iequals(e.name, "Proxy-Connection")) return true;
+
+	// and those the sender has named in Connection
+	for (auto c = headers.find(header_id::connection); c; c = headers.find_next(c)) {
+	    if (has_token(c->value, e.name)) return true;
+	}
+
+	return false;
+    }
+
+    bool
+    idempotent(std::string_view method) noexcept
+    {
+	return method == "GET" || method == "HEAD" || method == "OPTIONS"
+	    || method == "TRACE" || method == "PUT" || method == "DELETE";
+    }
+}
@@ -0,0 +1,350 @@
+#include <http/upstream.hh>
+#include <http/body.hh>
+#include <http/parser.hh>
+#include <core/ev_loop.hh>
+#include <core/metrics.hh>
+
+#include <cerrno>
+#include <cstddef>
+#include <cstring>
+#include <string>
+
+#include <unistd.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/un.h>
+
+namespace izumo::http {
+    static auto _upstream_connects = core::metrics_registry::instance().add_counter(
+	"izumo_upstream_connections_opened_total", "Connections opened to upstream servers");
+    static auto _upstream_reuses = core::metrics_registry::instance().add_counter(
+	"izumo_upstream_connections_reused_total", "Requests sent on idle upstream connections");
+
+    /** decode_body: feed received bytes to decoder until it wants more
+     *   @parameters:
+     *      used: set to bytes of in taken by decoder
+     */
+    static parse_result
+    decode_body(body_decoder& decoder, const core::byte_buffer_view& in, std::string& body,
+		std::size_t& used)
+    {
+	used = 0;
+	while (true) {
+	    core::byte_buffer_view data;
+	    std::size_t consumed;
+	    auto ret = decoder.decode(in.slice(used, in.size()), data, consumed);
+	    body.append(static_cast<std::string_view>(data));
+	    used += consumed;
+
+	    if (ret != parse_result::incomplete || !consumed) return ret;
+	}
+    }
+
+    bool
+    parse_upstream_address(std::string_view text, upstream_address& addr)
+    {
+	std::memset(&addr.addr, 0, sizeof(addr.addr));
+
+	constexpr std::string_view UNIX_PREFIX = "unix:";
+	if (text.substr(0, UNIX_PREFIX.size()) == UNIX_PREFIX) {
+	    auto path = text.substr(UNIX_PREFIX.size());
+	    auto& un = reinterpret_cast<sockaddr_un&>(addr.addr);
+	    if (path.empty() || path.size() >= sizeof(un.sun_path)) return false;
+
+	    un.sun_family = AF_UNIX;
+	    std::memcpy(un.sun_path, path.data(), path.size());
+	    addr.len = offsetof(sockaddr_un, sun_path) + path.size() + 1;
+	    return true;
+	}
+
+	// port follows the last colon, as v6 addresses are bracketed
+	auto colon = text.rfind(':');
+	if (colon == text.npos || colon + 1 == text.size()) return false;
+	auto host = text.substr(0, colon);
+	auto port = text.substr(colon + 1);
+	if (host.size() >= 2 && host.front() == '[' && host.back() == ']') {
+	    host = host.substr(1, host.size() - 2);
+	}
+	if (host.empty()) return false;
+
+	addrinfo hints;
+	std::memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+	hints.ai_flags = AI_NUMERICSERV;
+
+	addrinfo* result;
+	if (getaddrinfo(std::string(host).c_str(), std::string(port).c_str(), &hints, &result)) {
+	    return false;
+	}
+
+	// the first address is the one the resolver prefers
+	std::memcpy(&addr.addr, result->ai_addr, result->ai_addrlen);
+	addr.len = result->ai_addrlen;
+	freeaddrinfo(result);
+	return true;
+    }
+
+    core::task<int>
+    upstream_connection::receive_head(core::mem_pool&, response_parser& parser, response& res,
+				      core::byte_buffer& buf, std::size_t& received)
+    {
+	if (buf.size() < INITIAL_HEADER_SIZE) buf.resize(INITIAL_HEADER_SIZE);
+	received = 0;
+
+	// interim responses are dropped
+	while (true) {
+	    auto result = parse_result::incomplete;
+	    if (received) result = parser.parse(res, core::byte_buffer_view(buf, received));
+	    if (result == parse_result::error) co_return -EPROTO;
+
+	    if (result == parse_result::done) {
+		auto code = res.status_code;
+		if (code >= 200 || code == 101) co_return 0;
+
+		auto size = parser.consumed();
+		std::memmove(buf.ptr(), buf.ptr() + size, received - size);
+		received -= size;
+		parser.reset();
+		res.clear();
+		continue;
+	    }
+
+	    if (received == buf.size()) {
+		if (received >= MAX_HEADER_SIZE) co_return -EMSGSIZE;
+
+		// parsed fields refer to the old location if it moves, so it
+		// is parsed again from the start
+		auto old = buf.ptr();
+		buf.resize(received * 2);
+		if (buf.ptr() != old) {
+		    parser.reset();
+		    res.clear();
+		}
+	    }
+
+	    auto ret = co_await core::async_recv(m_sock, buf.ptr() + received, buf.size() - received);
+	    if (ret < 0) co_return ret;
+	    if (ret == 0) co_return received ? -EPROTO : -ECONNRESET;
+	    received += ret;
+	}
+    }
+
+    upstream::upstream(const upstream_address& addr, const options& opts):
+	ev_watcher(-1), m_addr(addr), m_options(opts)
+    {}
+
+    upstream::~upstream()
+    {
+	if (m_timer != core::NULL_TIMER) core::ev_loop::instance().cancel_timer(m_timer);
+	m_reap();
+	while (m_idle) {
+	    auto c = m_idle;
+	    m_unlink(c);
+	    m_conns.destroy(c);
+	}
+    }
+
+    void
+    upstream::m_unlink(upstream_connection* c) noexcept
+    {
+	(c->m_prev ? c->m_prev->m_next : m_idle) = c->m_next;
+	(c->m_next ? c->m_next->m_prev : m_idle_tail) = c->m_prev;
+	c->m_prev = c->m_next = nullptr;
+	--m_idle_count;
+    }
+
+    void
+    upstream::m_close(upstream_connection* c)
+    {
+	// the loop may be dispatching a batch which still holds an event of
+	// its socket, so it's freed once the batch is over
+	c->m_next = m_closed;
+	m_closed = c;
+	if (!m_reap_posted) {
+	    m_reap_posted = true;
+	    core::ev_loop::instance().post([this] { m_reap(); });
+	}
+    }
+
+    void
+    upstream::m_reap() noexcept
+    {
+	m_reap_posted = false;
+	while (m_closed) {
+	    auto c = m_closed;
+	    m_closed = c->m_next;
+
+	    // the socket is closed by its destructor
+	    m_conns.destroy(c);
+	}
+    }
+
+    core::task<int>
+    upstream::acquire(core::mem_pool&, upstream_connection*& conn)
+    {
+	// those closed by upstream while idle are of no use
+	while (m_idle) {
+	    auto c = m_idle;
+	    m_unlink(c);
+	    if (c->m_sock.hangup()) {
+		m_close(c);
+		continue;
+	    }
+
+	    _upstream_reuses.inc();
+	    conn = c;
+	    co_return 0;
+	}
+
+	auto family = m_addr.addr.ss_family;
+	int fd = ::socket(family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if (fd < 0) co_return -errno;
+
+	// requests are sent with a single write, so there's nothing to
+	// wait for before sending
+	if (family == AF_INET || family == AF_INET6) {
+	    int val = 1;
+	    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &val, sizeof(val));
+	}
+
+	auto c = m_conns.construct(fd);
+	c->m_sock.set_timeout(m_options.timeout);
+
+	auto ret = co_await core::async_connect(c->m_sock, reinterpret_cast<const sockaddr*>(&m_addr.addr),
+						m_addr.len);
+	if (ret < 0) {
+	    m_close(c);
+	    co_return ret;
+	}
+
+	_upstream_connects.inc();
+	conn = c;
+	co_return 0;
+    }
+
+    void
+    upstream::release(upstream_connection* c, bool reusable)
+    {
+	if (!reusable || !m_options.max_idle) {
+	    m_close(c);
+	    return;
+	}
+
+	auto& loop = core::ev_loop::instance();
+	c->m_reused = true;
+	c->m_idle_since = loop.now();
+
+	c->m_next = m_idle;
+	(m_idle ? m_idle->m_prev : m_idle_tail) = c;
+	m_idle = c;
+	++m_idle_count;
+
+	// least recently used ones go first
+	if (m_idle_count > m_options.max_idle) {
+	    auto victim = m_idle_tail;
+	    m_unlink(victim);
+	    m_close(victim);
+	}
+
+	if (m_timer == core::NULL_TIMER) m_timer = loop.add_timer(*this, m_options.idle_timeout);
+    }
+
+    void
+    upstream::on_timeout(core::timer_id)
+    {
+	auto& loop = core::ev_loop::instance();
+	auto now = loop.now();
+	m_timer = core::NULL_TIMER;
+
+	// the list is ordered by release time, so expired ones are at tail
+	while (m_idle_tail
+	       && static_cast<core::timedelta_ms_t>(now - m_idle_tail->m_idle_since) >= m_options.idle_timeout) {
+	    auto c = m_idle_tail;
+	    m_unlink(c);
+	    m_close(c);
+	}
+
+	if (m_idle_tail) {
+	    auto elapsed = static_cast<core::timedelta_ms_t>(now - m_idle_tail->m_idle_since);
+	    m_timer = loop.add_timer(*this, m_options.idle_timeout - elapsed);
+	}
+    }
+
+    core::task<upstream::exchange_result>
+    upstream::m_exchange(core::mem_pool& pool, upstream_connection& c, std::string_view request,
+			 upstream_response& out)
+    {
+	auto& sock = c.m_sock;
+
+	out.res.clear();
+	out.body.clear();
+
+	auto ret = co_await core::async_send(sock, request.data(), request.size());
+	if (ret < 0) co_return exchange_result { int(ret), false, true };
+
+	response_parser parser;
+	std::size_t received = 0;
+	ret = co_await c.receive_head(pool, parser, out.res, out.head, received);
+	if (ret < 0) co_return exchange_result { int(ret), false, !received };
+
+	// then the body, starting with what has come along with the header
+	auto head_size = parser.consumed();
+	body_decoder decoder;
+	auto head_request = request.substr(0, 5) == "HEAD ";
+	if (!decoder.start_response(out.res, head_request)) co_return exchange_result { -EPROTO, false, false };
+
+	std::size_t used;
+	auto rest = core::byte_buffer_view(out.head, head_size, received);
+	auto result = decode_body(decoder, rest, out.body, used);
+
+	// bytes after the response mean upstream is out of step
+	auto persist = used == rest.size() && keep_alive(out.res);
+
+	if (result == parse_result::incomplete) {
+	    core::byte_buffer buf(16384);
+	    while (result == parse_result::incomplete) {
+		ret = co_await core::async_recv(sock, buf.ptr(), buf.size());
+		if (ret < 0) co_return exchange_result { int(ret), false, false };
+		if (ret == 0) {
+		    if (decoder.framing() != body_framing::until_close) {
+			co_return exchange_result { -EPROTO, false, false };
+		    }
+		    result = parse_result::done;
+		    break;
+		}
+
+		result = decode_body(decoder, core::byte_buffer_view(buf, ret), out.body, used);
+		if (used < static_cast<std::size_t>(ret)) persist = false;
+	    }
+	}
+
+	if (result == parse_result::error) co_return exchange_result { -EPROTO, false, false };
+
+	// fields refer to head, which stays in place when shrunk
+	out.head.resize(head_size);
+	persist = persist && decoder.framing() != body_framing::until_close
+	    && out.res.status_code != 101;
+	co_return exchange_result { 0, persist, false };
+    }
+
+    core::task<int>
+    upstream::fetch(core::mem_pool& pool, std::string_view request, upstream_response& out)
+    {
+	while (true) {
+	    upstream_connection* c;
+	    auto ret = co_await acquire(pool, c);
+	    if (ret < 0) co_return ret;
+
+	    auto reused = c->reused();
+	    auto result = co_await m_exchange(pool, *c, request, out);
+	    release(c, !result.error && result.keep_alive);
+
+	    // upstream may have closed it while idle, unnoticed so far
+	    auto method = request.substr(0, request.find(' '));
+	    if (result.error && result.nothing_back && reused && idempotent(method)) continue;
+	    co_return result.error;
+	}
+    }
+}
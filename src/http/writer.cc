@@ -0,0 +1,162 @@
+#include <http/writer.hh>
+
+#include <charconv>
+#include <cstring>
+
+namespace izumo::http {
+    struct status_entry {
+	int code;
+	std::string_view reason;
+	std::string_view line;	// whole HTTP/1.1 status line
+    };
+
+#define STATUS(code, reason) { code, reason, "HTTP/1.1 " #code " " reason "\r\n" }
+
+    static constexpr status_entry status_table[] = {
+	STATUS(100, "Continue"),
+	STATUS(101, "Switching Protocols"),
+	STATUS(200, "OK"),
+	STATUS(201, "Created"),
+	STATUS(202, "Accepted"),
+	STATUS(204, "No Content"),
+	STATUS(206, "Partial Content"),
+	STATUS(301, "Moved Permanently"),
+	STATUS(302, "Found"),
+	STATUS(304, "Not Modified"),
+	STATUS(400, "Bad Request"),
+	STATUS(403, "Forbidden"),
+	STATUS(404, "Not Found"),
+	STATUS(405, "Method Not Allowed"),
+	STATUS(408, "Request Timeout"),
+	STATUS(411, "Length Required"),
+	STATUS(413, "Payload Too Large"),
+	STATUS(416, "Range Not Satisfiable"),
+	STATUS(431, "Request Header Fields Too Large"),
+	STATUS(500, "Internal Server Error"),
+	STATUS(501, "Not Implemented"),
+	STATUS(502, "Bad Gateway"),
+	STATUS(503, "Service Unavailable"),
+	STATUS(504, "Gateway Timeout"),
+	STATUS(505, "HTTP Version Not Supported"),
+    };
+
+#undef STATUS
+
+    static const status_entry*
+    find_status(int code) noexcept
+    {
+	for (auto& e: status_table) {
+	    if (e.code == code) return &e;
+	}
+
+	return nullptr;
+    }
+
+    std::string_view
+    reason_phrase(int status_code) noexcept
+    {
+	auto e = find_status(status_code);
+	return e ? e->reason : std::string_view();
+    }
+
+    char*
+    message_writer::m_reserve(std::size_t n)
+    {
+	auto size = m_buf.size() ? m_buf.size() : 256;
+	while (size < m_pos + n) size *= 2;
+	if (size != m_buf.size()) m_buf.resize(size);
+
+	auto ret = reinterpret_cast<char*>(m_buf.ptr()) + m_pos;
+	m_pos += n;
+	return ret;
+    }
+
+    void
+    message_writer::write(std::string_view bytes)
+    {
+	if (bytes.empty()) return;
+	std::memcpy(m_reserve(bytes.size()), bytes.data(), bytes.size());
+    }
+
+    void
+    response_writer::status_line(const response& res)
+    {
+	auto e = find_status(res.status_code);
+	if (e && res.httpver_major == 1 && res.httpver_minor == 1
+	    && (res.status_message.empty() || res.status_message == e->reason)) {
+	    write(e->line);
+	    return;
+	}
+
+	// "HTTP/" major "." minor SP 3DIGIT SP reason CRLF
+	char line[16];
+	auto p = line;
+	std::memcpy(p, "HTTP/", 5);
+	p += 5;
+	*p++ = '0' + res.httpver_major % 10;
+	*p++ = '.';
+	*p++ = '0' + res.httpver_minor % 10;
+	*p++ = ' ';
+	p = std::to_chars(p, line + sizeof(line), res.status_code % 1000).ptr;
+	*p++ = ' ';
+	write(std::string_view(line, p - line));
+
+	write(res.status_message.empty() ? (e ? e->reason : std::string_view()) : res.status_message);
+	write("\r\n");
+    }
+
+    void
+    message_writer::header(std::string_view name, std::string_view value)
+    {
+	auto p = m_reserve(name.size() + value.size() + 4);
+	std::memcpy(p, name.data(), name.size());
+	p += name.size();
+	*p++ = ':';
+	*p++ = ' ';
+	std::memcpy(p, value.data(), value.size());
+	p += value.size();
+	*p++ = '\r';
+	*p++ = '\n';
+    }
+
+    void
+    message_writer::header(std::string_view name, uint64_t value)
+    {
+	char digits[20];
+	auto end = std::to_chars(digits, digits + sizeof(digits), value).ptr;
+	header(name, std::string_view(digits, end - digits));
+    }
+
+    void
+    message_writer::fields(const http::header& headers)
+    {
+	for (auto& e: headers) header(e.name, e.value);
+    }
+
+    void
+    response_writer::head(const response& res)
+    {
+	status_line(res);
+	fields(res.headers);
+    }
+
+    void
+    request_writer::request_line(const request& req)
+    {
+	// method SP target SP "HTTP/1.1" CRLF
+	auto p = m_reserve(req.method.size() + req.target.size() + 12);
+	std::memcpy(p, req.method.data(), req.method.size());
+	p += req.method.size();
+	*p++ = ' ';
+	std::memcpy(p, req.target.data(), req.target.size());
+	p += req.target.size();
+	std::memcpy(p, " HTTP/1.1\r\n", 11);
+    }
+
+    void
+    request_writer::head(const request& req)
+    {
+	request_line(req);
+	fields(req.headers);
+    }
+}
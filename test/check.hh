@@ -0,0 +1,19 @@
+#ifndef IZUMO_TEST_CHECK_HH_
+#define IZUMO_TEST_CHECK_HH_
+
+#include <cstdio>
+
+namespace izumo::test {
+    inline int failures = 0;
+}
+
+// report a failed condition and go on, so that a run shows every failure
+#define CHECK(cond)							\
+    do {								\
+	if (!(cond)) {							\
+	    std::fprintf(stderr, "%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #cond); \
+	    ++izumo::test::failures;					\
+	}								\
+    } while (0)
+
+#endif	// IZUMO_TEST_CHECK_HH_
@@ -0,0 +1,234 @@
+#include "../check.hh"
+
+#include <core/timer_wheel.hh>
+
+#include <algorithm>
+#include <map>
+#include <vector>
+
+using namespace izumo;
+using namespace izumo::core;
+
+// a watcher recording when each of its timers fires
+class recorder: public ev_watcher {
+public:
+    struct fired_timer {
+	timer_id id;
+	timestamp_ms_t at;
+    };
+
+    timestamp_ms_t now = 0; // time given to the running `expire`
+    std::vector<fired_timer> fired;
+
+    recorder(): ev_watcher(-1) {}
+
+    bool on_event(bool, bool) override { return false; }
+    void on_timeout(timer_id id) override { fired.push_back({ id, now }); }
+
+    // advance the wheel to `to`, `step` milliseconds at a time
+    void
+    advance(timer_wheel& wheel, timestamp_ms_t to, timestamp_ms_t step = 1)
+    {
+	while (now < to) {
+	    now = std::min(now + step, to);
+	    wheel.expire(now);
+	}
+    }
+};
+
+// a timer fires at its deadline, neither earlier nor later
+static bool
+fires_at(const recorder& r, timer_id id, timestamp_ms_t at)
+{
+    auto count = std::count_if(r.fired.begin(), r.fired.end(),
+			       [id](auto& f) { return f.id == id; });
+    auto it = std::find_if(r.fired.begin(), r.fired.end(),
+			   [id](auto& f) { return f.id == id; });
+    return count == 1 && it->at == at;
+}
+
+static void
+test_level_boundaries()
+{
+    // 300ms before a level 2 boundary: level 0 wraps at +300 and every
+    // 256ms after, level 1 wraps at +300 too and every 65536ms after
+    constexpr timestamp_ms_t START = 3 * 65536 - 300;
+    constexpr timestamp_ms_t AFTER[] = {
+	1, 255, 256, 299, 300, 301, 555, 556, 557,		// level 0 -> 1
+	65535, 65836, 65837, 65838, 131372, 131373, 200000,	// level 1 -> 2
+    };
+
+    recorder r;
+    timer_wheel wheel(START);
+    r.now = START;
+
+    std::map<timer_id, timestamp_ms_t> deadlines;
+    for (auto after: AFTER) deadlines[wheel.add(r, START + after)] = START + after;
+    CHECK(wheel.size() == std::size(AFTER));
+
+    r.advance(wheel, START + 200000);
+    CHECK(r.fired.size() == std::size(AFTER));
+    for (auto [id, deadline]: deadlines) CHECK(fires_at(r, id, deadline));
+    CHECK(wheel.size() == 0);
+    CHECK(wheel.next_timeout(r.now) == -1);
+}
+
+static void
+test_expiry_order()
+{
+    constexpr timestamp_ms_t START = 65536 - 1000;
+    constexpr std::size_t TIMERS = 2000;
+
+    recorder r;
+    timer_wheel wheel(START);
+    r.now = START;
+
+    // deadlines up to 2^18ms ahead, spread over 3 levels
+    std::map<timer_id, timestamp_ms_t> deadlines;
+    uint32_t seed = 12345;
+    auto random = [&seed] { return (seed = seed * 1103515245 + 12345) >> 8; };
+    for (std::size_t i = 0; i < TIMERS; ++i) {
+	auto deadline = START + 1 + random() % (1 << 18);
+	deadlines[wheel.add(r, deadline)] = deadline;
+    }
+
+    // in uneven steps, as a loop wakes up; each timer fires in the first
+    // step reaching its deadline, and in the order of deadlines
+    timestamp_ms_t last = START;
+    std::vector<timestamp_ms_t> order;
+    while (wheel.size()) {
+	auto timeout = wheel.next_timeout(r.now);
+	CHECK(timeout >= 0);
+
+	auto fired = r.fired.size();
+	r.advance(wheel, r.now + 1 + random() % 3000, 3000);
+	for (auto i = fired; i < r.fired.size(); ++i) {
+	    auto deadline = deadlines[r.fired[i].id];
+	    CHECK(deadline > last && deadline <= r.now);
+	    order.push_back(deadline);
+	}
+	last = r.now;
+    }
+
+    CHECK(r.fired.size() == TIMERS);
+    CHECK(std::is_sorted(order.begin(), order.end()));
+}
+
+static void
+test_next_timeout()
+{
+    recorder r;
+    timer_wheel wheel(1000);
+    r.now = 1000;
+
+    CHECK(wheel.next_timeout(1000) == -1);
+    auto id = wheel.add(r, 1010);
+    CHECK(wheel.next_timeout(1000) == 10);
+    CHECK(wheel.next_timeout(1020) == 0);
+
+    // a deadline in the past fires on the next tick
+    wheel.add(r, 10);
+    CHECK(wheel.next_timeout(1000) == 1);
+    r.advance(wheel, 1001);
+    CHECK(r.fired.size() == 1 && r.fired[0].id != id);
+
+    // far deadlines wake the loop early to cascade, never late
+    wheel.cancel(id);
+    wheel.add(r, 1000 + 100000);
+    auto timeout = wheel.next_timeout(1001);
+    CHECK(timeout > 0 && timeout <= 100000 - 1);
+}
+
+static void
+test_cancel()
+{
+    recorder r;
+    timer_wheel wheel(0);
+
+    auto a = wheel.add(r, 10);
+    auto b = wheel.add(r, 20);
+    CHECK(wheel.cancel(a));
+    CHECK(!wheel.cancel(a));
+    CHECK(wheel.size() == 1);
+
+    r.advance(wheel, 20);
+    CHECK(r.fired.size() == 1 && fires_at(r, b, 20));
+
+    // a fired timer can't be cancelled or rescheduled
+    CHECK(!wheel.cancel(b));
+    CHECK(!wheel.reschedule(b, 100));
+    CHECK(!wheel.cancel(NULL_TIMER));
+
+    // nor can an id whose node was reused by a newer timer, which is
+    // left pending
+    auto c = wheel.add(r, 30);
+    auto d = wheel.add(r, 40);
+    CHECK(static_cast<uint32_t>(c) == static_cast<uint32_t>(b) ||
+	  static_cast<uint32_t>(d) == static_cast<uint32_t>(b));
+    CHECK(c != a && c != b && d != a && d != b);
+    CHECK(!wheel.cancel(a));
+    CHECK(!wheel.cancel(b));
+    CHECK(!wheel.reschedule(a, 35));
+    CHECK(wheel.size() == 2);
+
+    r.advance(wheel, 40);
+    CHECK(r.fired.size() == 3 && fires_at(r, c, 30) && fires_at(r, d, 40));
+
+    // cancelling every timer of a watcher leaves others pending
+    recorder other;
+    auto e = wheel.add(r, 50);
+    auto f = wheel.add(other, 50);
+    wheel.add(r, 60);
+    wheel.cancel_all(r);
+    CHECK(wheel.size() == 1);
+    CHECK(!wheel.cancel(e));
+    other.now = r.now;
+    other.advance(wheel, 60);
+    CHECK(r.fired.size() == 3 && fires_at(other, f, 50));
+}
+
+static void
+test_reschedule()
+{
+    recorder r;
+    timer_wheel wheel(100);
+    r.now = 100;
+
+    // shorter, from level 1 to level 0 and from level 2 to level 1
+    auto a = wheel.add(r, 100 + 1000);
+    auto b = wheel.add(r, 100 + 100000);
+    CHECK(wheel.reschedule(a, 100 + 10));
+    CHECK(wheel.reschedule(b, 100 + 5000));
+
+    // longer, from level 0 to level 2, and within level 0
+    auto c = wheel.add(r, 100 + 20);
+    auto d = wheel.add(r, 100 + 30);
+    CHECK(wheel.reschedule(c, 100 + 70000));
+    CHECK(wheel.reschedule(d, 100 + 40));
+    CHECK(wheel.size() == 4);
+    CHECK(wheel.next_timeout(100) == 10);
+
+    r.advance(wheel, 100 + 70000);
+    CHECK(r.fired.size() == 4);
+    CHECK(fires_at(r, a, 100 + 10));
+    CHECK(fires_at(r, d, 100 + 40));
+    CHECK(fires_at(r, b, 100 + 5000));
+    CHECK(fires_at(r, c, 100 + 70000));
+
+    // to the past: the next tick
+    auto e = wheel.add(r, r.now + 500);
+    CHECK(wheel.reschedule(e, 0));
+    r.advance(wheel, r.now + 1);
+    CHECK(fires_at(r, e, r.now));
+}
+
+int
+main()
+{
+    test_level_boundaries();
+    test_expiry_order();
+    test_next_timeout();
+    test_cancel();
+    test_reschedule();
+    return izumo::test::failures != 0;
+}
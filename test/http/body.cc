@@ -0,0 +1,208 @@
+#include "../check.hh"
+
+#include <core/byte_buffer.hh>
+#include <core/mem.hh>
+#include <http/body.hh>
+#include <http/types.hh>
+
+#include <cstring>
+#include <initializer_list>
+#include <string>
+#include <string_view>
+
+using namespace izumo;
+
+// result of decoding a chunked body received in pieces
+struct decoded {
+    http::parse_result result = http::parse_result::incomplete;
+    std::string body;
+    std::string rest;		// bytes after the body
+};
+
+// decode a chunked body received in given pieces; bytes left unconsumed
+// are given again along with the next piece, as the server does
+static decoded
+decode_chunked(std::initializer_list<std::string_view> pieces)
+{
+    http::body_decoder decoder;
+    decoder.start(http::body_framing::chunked);
+
+    decoded ret;
+    for (auto piece: pieces) {
+	ret.rest += piece;
+	while (!ret.rest.empty()) {
+	    core::byte_buffer buf(ret.rest.size());
+	    std::memcpy(buf.ptr(), ret.rest.data(), ret.rest.size());
+
+	    core::byte_buffer_view data;
+	    std::size_t consumed;
+	    ret.result = decoder.decode(core::byte_buffer_view(buf), data, consumed);
+	    ret.body.append(reinterpret_cast<const char*>(data.ptr()), data.size());
+	    ret.rest.erase(0, consumed);
+
+	    if (ret.result != http::parse_result::incomplete) {
+		CHECK(decoder.size() == ret.body.size());
+		return ret;
+	    }
+	    if (!consumed) break;
+	}
+    }
+
+    return ret;
+}
+
+// decode a chunked body received a byte at a time
+static decoded
+decode_bytewise(std::string_view bytes)
+{
+    http::body_decoder decoder;
+    decoder.start(http::body_framing::chunked);
+
+    decoded ret;
+    for (std::size_t i = 0; i < bytes.size(); ++i) {
+	core::byte_buffer buf(1);
+	buf.ptr()[0] = bytes[i];
+
+	core::byte_buffer_view data;
+	std::size_t consumed;
+	ret.result = decoder.decode(core::byte_buffer_view(buf), data, consumed);
+	ret.body.append(reinterpret_cast<const char*>(data.ptr()), data.size());
+	CHECK(consumed == 1 || ret.result == http::parse_result::error);
+
+	if (ret.result != http::parse_result::incomplete) {
+	    ret.rest = bytes.substr(i + consumed);
+	    return ret;
+	}
+    }
+
+    return ret;
+}
+
+static bool
+done(const decoded& d, std::string_view body, std::string_view rest = "")
+{
+    return d.result == http::parse_result::done && d.body == body && d.rest == rest;
+}
+
+static bool
+failed(const decoded& d)
+{
+    return d.result == http::parse_result::error;
+}
+
+static void
+test_chunks()
+{
+    CHECK(done(decode_chunked({ "0\r\n\r\n" }), ""));
+    CHECK(done(decode_chunked({ "5\r\nhello\r\n6\r\n world\r\n0\r\n\r\n" }), "hello world"));
+    CHECK(done(decode_chunked({ "A\r\n0123456789\r\n0\r\n\r\nGET /" }), "0123456789", "GET /"));
+    CHECK(done(decode_chunked({ "a\r\n0123456789\r\n0\r\n\r\n" }), "0123456789"));
+}
+
+static void
+test_size_split_across_calls()
+{
+    auto body = std::string(26, 'x');
+    auto bytes = "1a\r\n" + body + "\r\n0\r\n\r\n";
+
+    CHECK(done(decode_chunked({ "1", "a\r\n" + body + "\r\n0\r\n\r\n" }), body));
+    CHECK(done(decode_chunked({ "1a", "\r", "\n", body, "\r\n0", "\r\n\r\n" }), body));
+    CHECK(done(decode_bytewise(bytes), body));
+    CHECK(done(decode_bytewise("3;a=b\r\nabc\r\n0;c\r\nX-Sum: 1\r\n\r\nrest"), "abc", "rest"));
+}
+
+static void
+test_size_digits()
+{
+    // 16 digits fit in 64 bits, leading zeros or not
+    CHECK(done(decode_chunked({ "000000000000000a\r\n0123456789\r\n0\r\n\r\n" }), "0123456789"));
+    CHECK(decode_chunked({ "ffffffffffffffff\r\nabc" }).result == http::parse_result::incomplete);
+
+    CHECK(failed(decode_chunked({ "0000000000000000a\r\n" })));
+    CHECK(failed(decode_chunked({ "10000000000000000\r\n" })));
+    CHECK(failed(decode_chunked({ "00000000", "000000000", "\r\n" })));
+    CHECK(failed(decode_chunked({ "\r\n" })));
+    CHECK(failed(decode_chunked({ "g\r\n" })));
+    CHECK(failed(decode_chunked({ "-1\r\n" })));
+}
+
+static void
+test_extensions_and_trailers()
+{
+    CHECK(done(decode_chunked({ "5;name=value;q=\"a;b\"\r\nhello\r\n0;last\r\n\r\n" }), "hello"));
+    CHECK(done(decode_chunked({ "5;a\r\nhello\r\n0\r\nX-Checksum: 1\r\nX-Other: 2\r\n\r\nGET" }),
+	       "hello", "GET"));
+    CHECK(done(decode_chunked({ "0\r\nX-A: 1\r", "\nX-B", ": 2\r\n", "\r", "\n" }), ""));
+
+    // BWS may come before an extension, and nowhere else
+    CHECK(done(decode_chunked({ "5 ;a=b\r\nhello\r\n0\r\n\r\n" }), "hello"));
+    CHECK(done(decode_chunked({ "5 \t ", " ;a\r\nhello\r\n0\r\n\r\n" }), "hello"));
+    CHECK(failed(decode_chunked({ "1 garbage\r\nx\r\n0\r\n\r\n" })));
+    CHECK(failed(decode_chunked({ "1 \r\nx\r\n0\r\n\r\n" })));
+    CHECK(failed(decode_chunked({ "1\t1\r\nx\r\n0\r\n\r\n" })));
+    CHECK(failed(decode_chunked({ "1garbage\r\nx\r\n0\r\n\r\n" })));
+}
+
+static void
+test_cr_without_lf()
+{
+    CHECK(failed(decode_chunked({ "5\rhello\r\n0\r\n\r\n" })));
+    CHECK(failed(decode_chunked({ "5;ext\rhello\r\n0\r\n\r\n" })));
+    CHECK(failed(decode_chunked({ "5\r\nhello\rX0\r\n\r\n" })));
+    CHECK(failed(decode_chunked({ "5\r\nhelloX\r\n0\r\n\r\n" })));
+    CHECK(failed(decode_chunked({ "0\r\nX-A: 1\rX" })));
+    CHECK(failed(decode_chunked({ "0\r\n\r", "X" })));
+}
+
+// decoder set up for a request with given fields
+static bool
+start_request(std::initializer_list<std::pair<std::string_view, std::string_view>> fields,
+	      http::body_decoder& decoder)
+{
+    core::mem_pool pool;
+    http::request req(pool);
+    req.method = "POST";
+    req.target = "/";
+    for (auto [name, value]: fields) req.headers.emplace(name, value);
+    return decoder.start_request(req);
+}
+
+static void
+test_request_framing()
+{
+    http::body_decoder d;
+
+    CHECK(start_request({ { "Transfer-Encoding", "chunked" } }, d));
+    CHECK(d.framing() == http::body_framing::chunked);
+    CHECK(start_request({ { "Transfer-Encoding", "gzip, chunked" } }, d));
+    CHECK(d.framing() == http::body_framing::chunked);
+    CHECK(!start_request({ { "Transfer-Encoding", "chunked, gzip" } }, d));
+
+    // both, in either order, could end the body in two places
+    CHECK(!start_request({ { "Transfer-Encoding", "chunked" }, { "Content-Length", "5" } }, d));
+    CHECK(!start_request({ { "Content-Length", "5" }, { "Transfer-Encoding", "chunked" } }, d));
+
+    CHECK(start_request({ { "Content-Length", "5" } }, d));
+    CHECK(d.framing() == http::body_framing::length && d.remaining() == 5);
+    CHECK(start_request({ { "Content-Length", "5" }, { "Content-Length", "5" } }, d));
+    CHECK(d.framing() == http::body_framing::length && d.remaining() == 5);
+    CHECK(!start_request({ { "Content-Length", "5" }, { "Content-Length", "6" } }, d));
+    CHECK(!start_request({ { "Content-Length", "5" }, { "Content-Length", "05" } }, d));
+    CHECK(!start_request({ { "Content-Length", "5, 5" } }, d));
+    CHECK(!start_request({ { "Content-Length", "-1" } }, d));
+
+    CHECK(start_request({}, d));
+    CHECK(d.framing() == http::body_framing::none);
+}
+
+int
+main()
+{
+    test_chunks();
+    test_size_split_across_calls();
+    test_size_digits();
+    test_extensions_and_trailers();
+    test_cr_without_lf();
+    test_request_framing();
+    return izumo::test::failures != 0;
+}
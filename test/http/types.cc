@@ -0,0 +1,79 @@
+#include "../check.hh"
+
+#include <core/mem.hh>
+#include <http/header.hh>
+#include <http/types.hh>
+
+#include <string_view>
+
+using namespace izumo;
+
+// whether the field of given name is dropped when forwarding headers
+static bool
+dropped(const http::header& headers, std::string_view name)
+{
+    auto e = headers.find(name);
+    return e && http::hop_by_hop(headers, *e);
+}
+
+static void
+test_hop_by_hop()
+{
+    core::mem_pool pool;
+    http::header h(pool);
+    h.emplace("Host", "example.com");
+    h.emplace("Connection", "keep-alive, X-Private");
+    h.emplace("Keep-Alive", "timeout=5");
+    h.emplace("X-Private", "1");
+    h.emplace("X-Public", "1");
+    h.emplace("Proxy-Connection", "close");
+    h.emplace("Upgrade", "websocket");
+
+    CHECK(dropped(h, "Connection"));
+    CHECK(dropped(h, "Keep-Alive"));
+    CHECK(dropped(h, "x-private"));
+    CHECK(dropped(h, "Proxy-Connection"));
+    CHECK(dropped(h, "Upgrade"));
+    CHECK(!dropped(h, "X-Public"));
+    CHECK(!dropped(h, "Host"));
+}
+
+static void
+test_connection_cant_drop_framing()
+{
+    // a client naming framing fields would have the next hop read the
+    // body differently, smuggling a request past the proxy
+    core::mem_pool pool;
+    http::header h(pool);
+    h.emplace("Host", "example.com");
+    h.emplace("Content-Length", "5");
+    h.emplace("Connection", "close, Content-Length");
+    h.emplace("Connection", "Host");
+
+    CHECK(!dropped(h, "Content-Length"));
+    CHECK(!dropped(h, "Host"));
+
+    // always dropped, as the proxy frames bodies on its own
+    http::header t(pool);
+    t.emplace("Transfer-Encoding", "chunked");
+    t.emplace("Connection", "Transfer-Encoding");
+    CHECK(dropped(t, "Transfer-Encoding"));
+}
+
+static void
+test_idempotent()
+{
+    CHECK(http::idempotent("GET"));
+    CHECK(http::idempotent("PUT"));
+    CHECK(!http::idempotent("POST"));
+    CHECK(!http::idempotent("PATCH"));
+}
+
+int
+main()
+{
+    test_hop_by_hop();
+    test_connection_cant_drop_framing();
+    test_idempotent();
+    return izumo::test::failures != 0;
+}
@@ -0,0 +1,134 @@
+#include "../check.hh"
+
+#include <core/byte_buffer.hh>
+#include <core/mem.hh>
+#include <core/slab.hh>
+#include <http/types.hh>
+#include <http/writer.hh>
+
+#include <cstdlib>
+#include <new>
+#include <string_view>
+
+using namespace izumo;
+
+// allocations made while counting, through malloc or operator new
+static bool counting = false;
+static std::size_t allocations = 0;
+
+static void
+count() noexcept
+{
+    if (counting) ++allocations;
+}
+
+extern "C" {
+    void* __libc_malloc(std::size_t);
+    void* __libc_calloc(std::size_t, std::size_t);
+    void* __libc_realloc(void*, std::size_t);
+
+    void* malloc(std::size_t size) { count(); return __libc_malloc(size); }
+    void* calloc(std::size_t n, std::size_t size) { count(); return __libc_calloc(n, size); }
+    void* realloc(void* ptr, std::size_t size) { count(); return __libc_realloc(ptr, size); }
+}
+
+static void*
+counted_new(std::size_t size)
+{
+    count();
+    if (auto ret = __libc_malloc(size ? size : 1)) return ret;
+    throw std::bad_alloc();
+}
+
+void* operator new(std::size_t size) { return counted_new(size); }
+void* operator new[](std::size_t size) { return counted_new(size); }
+void operator delete(void* ptr) noexcept { std::free(ptr); }
+void operator delete[](void* ptr) noexcept { std::free(ptr); }
+void operator delete(void* ptr, std::size_t) noexcept { std::free(ptr); }
+void operator delete[](void* ptr, std::size_t) noexcept { std::free(ptr); }
+
+// serialize a response the way a client of the server does
+static std::size_t
+write_response(core::byte_buffer& buf, const http::response& res, std::string_view body)
+{
+    http::response_writer w(buf);
+    w.head(res);
+    w.write(http::static_header::server);
+    w.header("Content-Length", body.size());
+    w.end_head();
+    w.write(body);
+    return w.size();
+}
+
+static void
+test_response_writer_allocates_nothing()
+{
+    core::mem_pool pool;
+    http::response res(pool);
+    res.status_code = 404;
+    res.headers.emplace("Content-Type", "text/html; charset=utf-8");
+    res.headers.emplace("Cache-Control", "no-cache");
+    res.headers.emplace("Set-Cookie", "session=8f14e45fceea167a5a36dedd4bea2543; Path=/; HttpOnly");
+
+    std::string_view body = "<html><body>not found</body></html>";
+
+    // warm up: the buffer grows to its working size
+    core::byte_buffer buf;
+    auto size = write_response(buf, res, body);
+
+    std::string_view expected =
+	"HTTP/1.1 404 Not Found\r\n"
+	"Content-Type: text/html; charset=utf-8\r\n"
+	"Cache-Control: no-cache\r\n"
+	"Set-Cookie: session=8f14e45fceea167a5a36dedd4bea2543; Path=/; HttpOnly\r\n"
+	"Server: Izumo\r\n"
+	"Content-Length: 35\r\n"
+	"\r\n"
+	"<html><body>not found</body></html>";
+    CHECK(std::string_view(reinterpret_cast<char*>(buf.ptr()), size) == expected);
+
+    auto mapped = core::slab_allocator::stats().mapped_bytes;
+    counting = true;
+    for (int i = 0; i < 10000; ++i) size = write_response(buf, res, body);
+    counting = false;
+
+    CHECK(allocations == 0);
+    CHECK(core::slab_allocator::stats().mapped_bytes == mapped);
+    CHECK(size == expected.size());
+}
+
+static void
+test_request_writer_allocates_nothing()
+{
+    core::mem_pool pool;
+    http::request req(pool);
+    req.method = "GET";
+    req.target = "/index.html";
+    req.httpver_major = 1;
+    req.httpver_minor = 1;
+    req.headers.emplace("Host", "example.com");
+    req.headers.emplace("Accept", "*/*");
+
+    core::byte_buffer buf;
+    auto write = [&] {
+	http::request_writer w(buf);
+	w.head(req);
+	w.end_head();
+	return w.size();
+    };
+    write();
+
+    counting = true;
+    for (int i = 0; i < 10000; ++i) write();
+    counting = false;
+
+    CHECK(allocations == 0);
+}
+
+int
+main()
+{
+    test_response_writer_allocates_nothing();
+    test_request_writer_allocates_nothing();
+    return izumo::test::failures != 0;
+}